@@ -6,16 +6,19 @@
 
 #include "token.hpp"
 
-bool assemble_file(std::string filepath);
+// debug_lines adds a section mapping each instruction to its source line
+bool assemble_file(std::string filepath, bool debug_lines = false);
 
-bool _token_data_label_pass(const std::vector<Token>& tokens, std::vector<uint8_t>& bytecode, uint32_t& bytecode_top_ptr,
+bool _token_data_label_pass(const std::vector<Token>& tokens, std::vector<uint8_t>& data, uint32_t& bss_size,
     std::unordered_map<std::string, uint32_t>& data_ptrs_out, std::unordered_map<std::string, uint32_t>& label_ptrs_out);
 
 bool _token_instruction_pass(const std::vector<Token>& tokens, std::vector<uint8_t>& bytecode, uint32_t& bytecode_top_ptr,
     const std::unordered_map<std::string, uint32_t>& data_ptrs, std::unordered_map<std::string, uint32_t>& label_ptrs,
-    std::unordered_map<std::string, std::vector<uint32_t>>& label_ref_ptrs_out);
+    std::unordered_map<std::string, std::vector<uint32_t>>& label_ref_ptrs_out, std::vector<std::pair<uint32_t, uint32_t>>& debug_lines_out);
 
 void _write_label_refs(std::vector<uint8_t>& bytecode, const std::unordered_map<std::string, uint32_t>& label_ptrs,
     const std::unordered_map<std::string, std::vector<uint32_t>>& label_ref_ptrs);
 
-void _write_header(std::vector<uint8_t>& bytecode, const std::unordered_map<std::string, uint32_t>& label_ptrs, uint32_t data_size);
\ No newline at end of file
+void _write_executable(std::vector<uint8_t>& file, const std::vector<uint8_t>& bytecode, uint32_t bytecode_top_ptr,
+    const std::vector<uint8_t>& data, uint32_t bss_size, const std::unordered_map<std::string, uint32_t>& data_ptrs,
+    const std::unordered_map<std::string, uint32_t>& label_ptrs, const std::vector<std::pair<uint32_t, uint32_t>>* debug_lines);
\ No newline at end of file
@@ -5,20 +5,71 @@
 #include "ISA.hpp"
 
 static const std::unordered_map<std::string, uint8_t> reg_name_map = {
-    {"ax", 0}, {"bx", 1}, {"cx", 2}, {"dx", 3}, {"fax", 4}, {"fbx", 5}, {"fcx", 6}
+    {"ax", 0}, {"bx", 1}, {"cx", 2}, {"dx", 3}, {"r4", 4}, {"r5", 5}, {"r6", 6}, {"r7", 7},
+    {"r8", 8}, {"r9", 9}, {"r10", 10}, {"r11", 11}, {"r12", 12}, {"r13", 13}, {"r14", 14}, {"r15", 15},
+    {"fax", 16}, {"fbx", 17}, {"fcx", 18}, {"f3", 19}, {"f4", 20}, {"f5", 21}, {"f6", 22}, {"f7", 23},
+    {"f8", 24}, {"f9", 25}, {"f10", 26}, {"f11", 27}, {"f12", 28}, {"f13", 29}, {"f14", 30}, {"f15", 31}
+};
+
+static const std::unordered_map<std::string, uint8_t> vector_reg_name_map = {
+    {"v0", 0}, {"v1", 1}, {"v2", 2}, {"v3", 3}, {"v4", 4}, {"v5", 5}, {"v6", 6}, {"v7", 7}
 };
 
 static const std::unordered_map<std::string, uint8_t> instruction_name_map = {
     {INSTR_LOAD_STR, INSTR_LOAD}, {INSTR_LOADS_STR, INSTR_LOADS}, {INSTR_LOADC_STR, INSTR_LOADC},
     {INSTR_STORE_STR, INSTR_STORE}, {INSTR_STORES_STR, INSTR_STORES},
+    {INSTR_LOADB_STR, INSTR_LOADB}, {INSTR_LOADBI_STR, INSTR_LOADBI}, {INSTR_LOADH_STR, INSTR_LOADH}, {INSTR_LOADHI_STR, INSTR_LOADHI},
+    {INSTR_STOREB_STR, INSTR_STOREB}, {INSTR_STOREH_STR, INSTR_STOREH},
+    {INSTR_XADD_STR, INSTR_XADD}, {INSTR_XCHG_STR, INSTR_XCHG}, {INSTR_CAS_STR, INSTR_CAS}, {INSTR_FENCE_STR, INSTR_FENCE},
     {INSTR_COPY_STR, INSTR_COPY},
     {INSTR_ADD_STR, INSTR_ADD}, {INSTR_SUB_STR, INSTR_SUB}, {INSTR_MUL_STR, INSTR_MUL}, {INSTR_DIV_STR, INSTR_DIV},
     {INSTR_IDIV_STR, INSTR_IDIV}, {INSTR_SHL_STR, INSTR_SHL}, {INSTR_SHR_STR, INSTR_SHR},
     {INSTR_AND_STR, INSTR_AND}, {INSTR_OR_STR, INSTR_OR}, {INSTR_XOR_STR, INSTR_XOR}, {INSTR_NOT_STR, INSTR_NOT},
     {INSTR_FADD_STR, INSTR_FADD}, {INSTR_FSUB_STR, INSTR_FSUB}, {INSTR_FMUL_STR, INSTR_FMUL}, {INSTR_FDIV_STR, INSTR_FDIV},
+    {INSTR_ADD64_STR, INSTR_ADD64}, {INSTR_SUB64_STR, INSTR_SUB64}, {INSTR_MUL64_STR, INSTR_MUL64}, {INSTR_DIV64_STR, INSTR_DIV64},
+    {INSTR_IDIV64_STR, INSTR_IDIV64}, {INSTR_CMP64_STR, INSTR_CMP64}, {INSTR_CMPI64_STR, INSTR_CMPI64},
+    {INSTR_DADD_STR, INSTR_DADD}, {INSTR_DSUB_STR, INSTR_DSUB}, {INSTR_DMUL_STR, INSTR_DMUL}, {INSTR_DDIV_STR, INSTR_DDIV},
+    {INSTR_DCMP_STR, INSTR_DCMP}, {INSTR_FTOD_STR, INSTR_FTOD}, {INSTR_DTOF_STR, INSTR_DTOF},
+    {INSTR_FMIN_STR, INSTR_FMIN}, {INSTR_FMAX_STR, INSTR_FMAX}, {INSTR_FFMA_STR, INSTR_FFMA}, {INSTR_FSQRT_STR, INSTR_FSQRT},
+    {INSTR_FABS_STR, INSTR_FABS}, {INSTR_FFLOOR_STR, INSTR_FFLOOR}, {INSTR_FSIN_STR, INSTR_FSIN}, {INSTR_FCOS_STR, INSTR_FCOS},
     {INSTR_CMP_STR, INSTR_CMP}, {INSTR_CMPI_STR, INSTR_CMPI}, {INSTR_CMPF_STR, INSTR_CMPF},
     {INSTR_PUSH_STR, INSTR_PUSH}, {INSTR_POP_STR, INSTR_POP}, {INSTR_CALL_STR, INSTR_CALL}, {INSTR_RET_STR, INSTR_RET},
     {INSTR_SYSCALL_STR, INSTR_SYSCALL},
+    {INSTR_TAILCALL_STR, INSTR_TAILCALL}, {INSTR_ENTER_STR, INSTR_ENTER}, {INSTR_LEAVE_STR, INSTR_LEAVE},
+    {INSTR_VLOAD_STR, INSTR_VLOAD}, {INSTR_VLOADA_STR, INSTR_VLOADA}, {INSTR_VSTORE_STR, INSTR_VSTORE}, {INSTR_VSTOREA_STR, INSTR_VSTOREA},
+    {INSTR_VCOPY_STR, INSTR_VCOPY}, {INSTR_VSPLAT_STR, INSTR_VSPLAT}, {INSTR_VEXTRACT_STR, INSTR_VEXTRACT},
+    {INSTR_VINSERT_STR, INSTR_VINSERT}, {INSTR_VSHUF_STR, INSTR_VSHUF},
+    {INSTR_VADD_STR, INSTR_VADD}, {INSTR_VSUB_STR, INSTR_VSUB}, {INSTR_VMUL_STR, INSTR_VMUL}, {INSTR_VMIN_STR, INSTR_VMIN},
+    {INSTR_VMAX_STR, INSTR_VMAX}, {INSTR_VCMPEQ_STR, INSTR_VCMPEQ}, {INSTR_VCMPGT_STR, INSTR_VCMPGT},
+    {INSTR_VAND_STR, INSTR_VAND}, {INSTR_VOR_STR, INSTR_VOR}, {INSTR_VXOR_STR, INSTR_VXOR},
+    {INSTR_VFADD_STR, INSTR_VFADD}, {INSTR_VFSUB_STR, INSTR_VFSUB}, {INSTR_VFMUL_STR, INSTR_VFMUL}, {INSTR_VFMIN_STR, INSTR_VFMIN},
+    {INSTR_VFMAX_STR, INSTR_VFMAX}, {INSTR_VFCMPEQ_STR, INSTR_VFCMPEQ}, {INSTR_VFCMPLT_STR, INSTR_VFCMPLT},
     {INSTR_STOP_STR, INSTR_STOP},
-    {INSTR_JMP_STR, INSTR_JMP}, {INSTR_JMPZ_STR, INSTR_JMPZ}, {INSTR_JMPS_STR, INSTR_JMPS}, {INSTR_JMPC_STR, INSTR_JMPC}
+    {INSTR_JMP_STR, INSTR_JMP}, {INSTR_JMPZ_STR, INSTR_JMPZ}, {INSTR_JMPS_STR, INSTR_JMPS}, {INSTR_JMPC_STR, INSTR_JMPC},
+    {INSTR_BEQ_STR, INSTR_BEQ}, {INSTR_BNE_STR, INSTR_BNE}, {INSTR_BLT_STR, INSTR_BLT}, {INSTR_BGE_STR, INSTR_BGE},
+    {INSTR_BLTI_STR, INSTR_BLTI}, {INSTR_BGEI_STR, INSTR_BGEI},
+    {INSTR_BEQF_STR, INSTR_BEQF}, {INSTR_BNEF_STR, INSTR_BNEF}, {INSTR_BLTF_STR, INSTR_BLTF}, {INSTR_BGEF_STR, INSTR_BGEF}
+};
+
+// Instructions whose second operand may be a literal (or label/data address), assembled as the immediate form
+static const std::unordered_map<uint8_t, uint8_t> immediate_instruction_map = {
+    {INSTR_ADD, INSTR_ADD_IMM}, {INSTR_SUB, INSTR_SUB_IMM}, {INSTR_MUL, INSTR_MUL_IMM}, {INSTR_DIV, INSTR_DIV_IMM},
+    {INSTR_IDIV, INSTR_IDIV_IMM}, {INSTR_SHL, INSTR_SHL_IMM}, {INSTR_SHR, INSTR_SHR_IMM},
+    {INSTR_AND, INSTR_AND_IMM}, {INSTR_OR, INSTR_OR_IMM}, {INSTR_XOR, INSTR_XOR_IMM},
+    {INSTR_CMP, INSTR_CMP_IMM}, {INSTR_CMPI, INSTR_CMPI_IMM}
+};
+
+// Instructions with a three register form, "add cx ax bx" assembles as the form writing cx instead of ax
+static const std::unordered_map<uint8_t, uint8_t> three_register_instruction_map = {
+    {INSTR_ADD, INSTR_ADD3}, {INSTR_SUB, INSTR_SUB3}, {INSTR_MUL, INSTR_MUL3}, {INSTR_DIV, INSTR_DIV3},
+    {INSTR_IDIV, INSTR_IDIV3}, {INSTR_SHL, INSTR_SHL3}, {INSTR_SHR, INSTR_SHR3},
+    {INSTR_AND, INSTR_AND3}, {INSTR_OR, INSTR_OR3}, {INSTR_XOR, INSTR_XOR3},
+    {INSTR_FADD, INSTR_FADD3}, {INSTR_FSUB, INSTR_FSUB3}, {INSTR_FMUL, INSTR_FMUL3}, {INSTR_FDIV, INSTR_FDIV3}
+};
+
+// Instructions assembled as a different opcode when given a [base + index*scale + disp] operand
+static const std::unordered_map<uint8_t, uint8_t> memory_operand_instruction_map = {
+    {INSTR_LOAD, INSTR_LOADX}, {INSTR_STORE, INSTR_STOREX},
+    {INSTR_LOADB, INSTR_LOADBX}, {INSTR_LOADBI, INSTR_LOADBIX}, {INSTR_LOADH, INSTR_LOADHX}, {INSTR_LOADHI, INSTR_LOADHIX},
+    {INSTR_STOREB, INSTR_STOREBX}, {INSTR_STOREH, INSTR_STOREHX}
 };
\ No newline at end of file
@@ -8,15 +8,30 @@ enum class TokenType
     Unknown,
 
     DataDirective,
+    BssDirective,
     ProgramDirective,
 
     Label,
     Instruction,
     Register,
+    VectorRegister,
     IntLiteral,
     FloatLiteral,
     HexLiteral,
-    StringLiteral
+    StringLiteral,
+    MemoryOperand
+};
+
+// [base + index*scale + disp], registers left out are MEMORY_OPERAND_NO_REG
+struct MemoryOperand
+{
+    uint8_t base_reg_id;
+    uint8_t index_reg_id;
+    uint8_t scale;
+    uint32_t disp;
+
+    // Data or label name added to disp by the assembler
+    std::string disp_symbol;
 };
 
 struct Token
@@ -33,6 +48,8 @@ struct Token
 
     std::string text;
 
+    MemoryOperand memory;
+
     int line;
 };
 
@@ -40,6 +57,8 @@ char to_lower(char c);
 
 bool is_token_register(const std::string& token, uint8_t& reg_id);
 
+bool is_token_vector_register(const std::string& token, uint8_t& reg_id);
+
 bool is_token_instruction(const std::string& token, uint8_t& instruction);
 
 bool is_token_label(const std::string& token);
@@ -52,6 +71,10 @@ bool is_token_float_literal(const std::string& token, float& value);
 
 bool is_token_data_directive(const std::string& token);
 
+bool is_token_bss_directive(const std::string& token);
+
 bool is_token_program_directive(const std::string& token);
 
+bool is_token_memory_operand(const std::string& token, MemoryOperand& memory);
+
 Token create_token(const std::string& text, int line);
\ No newline at end of file
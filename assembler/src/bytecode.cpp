@@ -1,25 +1,53 @@
 #include <vector>
 #include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <cstring>
 
 #include "bytecode.hpp"
 #include "token.hpp"
 #include "parse.hpp"
 #include "pattern.hpp"
+#include "isa_map.hpp"
 
 #include "ISA.hpp"
 #include "syscall.hpp"
 #include "bytes.hpp"
+#include "executable.hpp"
 
-const uint32_t BYTECODE_HEADER_SIZE = 16;
+enum class SectionMode
+{
+    Program,
+    Data,
+    Bss,
+};
+
+static bool _section_directive(const Token& token, SectionMode& mode)
+{
+    switch (token.type)
+    {
+        case TokenType::DataDirective: mode = SectionMode::Data; return true;
+        case TokenType::BssDirective: mode = SectionMode::Bss; return true;
+        case TokenType::ProgramDirective: mode = SectionMode::Program; return true;
+        default: return false;
+    }
+}
 
-bool _token_data_label_pass(const std::vector<Token>& tokens, std::vector<uint8_t>& bytecode, uint32_t& bytecode_top_ptr,
+static void _append_int(std::vector<uint8_t>& bytes, uint32_t value)
+{
+    bytes.resize(bytes.size() + 4);
+    write_int(&bytes[bytes.size() - 4], value);
+}
+
+bool _token_data_label_pass(const std::vector<Token>& tokens, std::vector<uint8_t>& data, uint32_t& bss_size,
     std::unordered_map<std::string, uint32_t>& data_ptrs_out, std::unordered_map<std::string, uint32_t>& label_ptrs_out)
 {
-    // Find any data blocks and store in bytecode
+    // Find any data blocks and store in data, names in bss blocks only reserve space
     // Scan for labels
-    bool data_mode = false;
+    SectionMode mode = SectionMode::Program;
+    std::vector<std::pair<std::string, uint32_t>> bss_ptrs;
     for (size_t token_idx = 0; token_idx < tokens.size(); token_idx++)
     {
         const Token& token = tokens[token_idx];
@@ -35,76 +63,214 @@ bool _token_data_label_pass(const std::vector<Token>& tokens, std::vector<uint8_
             label_ptrs_out[token.text] = 0;
         }
 
-        if (!data_mode)
+        if (_section_directive(token, mode) || mode == SectionMode::Program)
         {
-            if (token.type == TokenType::DataDirective)
+            continue;
+        }
+
+        if (token.type == TokenType::Unknown && data_ptrs_out.contains(token.text))
+        {
+            std::cout << "ERROR: Found duplicate data label \"" << token.text << "\"\n";
+            continue;
+        }
+
+        if (mode == SectionMode::Bss)
+        {
+            // name size, the size is rounded up so every name stays word aligned
+            if (token.type != TokenType::Unknown || token_idx + 1 >= tokens.size() ||
+                (tokens[token_idx + 1].type != TokenType::IntLiteral && tokens[token_idx + 1].type != TokenType::HexLiteral))
             {
-                data_mode = true;
+                std::cout << "ERROR: Expected name and size in [bss] on line " << token.line << "\n";
+                return false;
             }
 
+            data_ptrs_out[token.text] = 0;
+            bss_ptrs.emplace_back(token.text, bss_size);
+            bss_size += (tokens[token_idx + 1].value + 3) & ~3u;
+            token_idx++;
             continue;
         }
 
         switch (token.type)
         {
-            case TokenType::ProgramDirective:
-            {
-                data_mode = false;
-                break;
-            }
             case TokenType::Unknown:
             {
-                if (data_ptrs_out.contains(token.text))
-                {
-                    std::cout << "ERROR: Found duplicate data label \"" << token.text << "\"\n";
-                    break;
-                }
-
-                // Program will be loaded in from 0 memory in VM, subtract header
-                data_ptrs_out[token.text] = bytecode_top_ptr - BYTECODE_HEADER_SIZE;
+                // Data is loaded in at 0 memory in VM
+                data_ptrs_out[token.text] = data.size();
                 break;
             }
             case TokenType::StringLiteral:
             {
-                memcpy(&bytecode[bytecode_top_ptr], token.text.c_str(), token.text.length() + 1);
-                bytecode_top_ptr += token.text.length() + 1;
+                data.insert(data.end(), token.text.begin(), token.text.end());
+                data.push_back(0);
                 break;
             }
             case TokenType::IntLiteral:
             case TokenType::HexLiteral: // fallthrough
             {
-                write_int(&bytecode[bytecode_top_ptr], token.value);
-                bytecode_top_ptr += 4;
+                _append_int(data, token.value);
                 break;
             }
             case TokenType::FloatLiteral:
             {
                 uint32_t value = *(uint32_t*)&token.fvalue;
-                write_int(&bytecode[bytecode_top_ptr], value);
-                bytecode_top_ptr += 4;
+                _append_int(data, value);
                 break;
             }
         }
     }
 
+    // bss follows the data
+    const uint32_t bss_addr = (data.size() + 3) & ~3u;
+    for (const auto& [name, offset] : bss_ptrs)
+    {
+        data_ptrs_out[name] = bss_addr + offset;
+    }
+
+    return true;
+}
+
+static bool _is_jump_instruction(uint8_t instruction)
+{
+    switch (instruction)
+    {
+        case INSTR_JMP:
+        case INSTR_JMPZ:
+        case INSTR_JMPS:
+        case INSTR_JMPC:
+        case INSTR_BEQ:
+        case INSTR_BNE:
+        case INSTR_BLT:
+        case INSTR_BGE:
+        case INSTR_BLTI:
+        case INSTR_BGEI:
+        case INSTR_BEQF:
+        case INSTR_BNEF:
+        case INSTR_BLTF:
+        case INSTR_BGEF:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Function labels are main and any label used other than as a jump target (called, loaded as an address or named by a
+// memory operand), the rest are local to the function they sit in. label_refs_out maps labels to the tokens naming them
+static void _find_function_labels(const std::vector<Token>& tokens, const std::unordered_map<std::string, uint32_t>& label_ptrs,
+    std::unordered_set<std::string>& function_labels_out, std::unordered_map<std::string, std::vector<size_t>>& label_refs_out)
+{
+    function_labels_out.insert("main");
+
+    SectionMode mode = SectionMode::Program;
+    uint8_t instruction = 0;
+    for (size_t token_idx = 0; token_idx < tokens.size(); token_idx++)
+    {
+        const Token& token = tokens[token_idx];
+
+        if (_section_directive(token, mode) || mode != SectionMode::Program)
+        {
+            continue;
+        }
+
+        const std::string* name = nullptr;
+        if (token.type == TokenType::Instruction) instruction = token.instruction;
+        if (token.type == TokenType::Unknown) name = &token.text;
+        if (token.type == TokenType::MemoryOperand) name = &token.memory.disp_symbol;
+
+        if (!name || !label_ptrs.contains(*name)) continue;
+
+        label_refs_out[*name].push_back(token_idx);
+        if (token.type != TokenType::Unknown || !_is_jump_instruction(instruction))
+        {
+            function_labels_out.insert(*name);
+        }
+    }
+}
+
+// "call X" directly followed by "ret" can reuse the current frame, but only when nothing the function put on the stack
+// can still be in use: stack arguments pushed for X or locals whose address was passed to it. So the function must not
+// push, enter or stores anywhere between its entry and the call, it must not be fallen into from the code before it,
+// and the labels between the entry and the call may only be jumped to from that same stretch of code
+static bool _is_tail_call(const std::vector<Token>& tokens, size_t token_idx, const std::unordered_set<std::string>& function_labels,
+    const std::unordered_map<std::string, std::vector<size_t>>& label_refs)
+{
+    if (token_idx + 2 >= tokens.size() || tokens[token_idx + 2].type != TokenType::Instruction ||
+        tokens[token_idx + 2].instruction != INSTR_RET)
+    {
+        return false;
+    }
+
+    size_t entry_idx = 0;
+    std::vector<const std::string*> local_labels;
+    for (size_t i = token_idx;; i--)
+    {
+        if (i == 0 || tokens[i - 1].type == TokenType::DataDirective || tokens[i - 1].type == TokenType::BssDirective ||
+            tokens[i - 1].type == TokenType::ProgramDirective)
+        {
+            // Function entry was not found
+            return false;
+        }
+
+        const Token& token = tokens[i - 1];
+        if (token.type == TokenType::Instruction &&
+            (token.instruction == INSTR_PUSH || token.instruction == INSTR_ENTER || token.instruction == INSTR_STORES))
+        {
+            return false;
+        }
+
+        if (token.type != TokenType::Label) continue;
+
+        if (function_labels.contains(token.text))
+        {
+            entry_idx = i - 1;
+            break;
+        }
+
+        local_labels.push_back(&token.text);
+    }
+
+    // The last instruction before the entry has to leave, or the frame may carry on from the previous function
+    for (size_t i = entry_idx; i-- > 0 && tokens[i].type != TokenType::ProgramDirective;)
+    {
+        if (tokens[i].type != TokenType::Instruction) continue;
+
+        if (tokens[i].instruction != INSTR_RET && tokens[i].instruction != INSTR_TAILCALL && tokens[i].instruction != INSTR_JMP)
+        {
+            return false;
+        }
+        break;
+    }
+
+    // Jumps to the labels crossed have to come from the code checked above, anything else may have pushed first
+    for (const std::string* label : local_labels)
+    {
+        auto iter = label_refs.find(*label);
+        if (iter == label_refs.end()) continue;
+
+        for (size_t ref : iter->second)
+        {
+            if (ref < entry_idx || ref >= token_idx) return false;
+        }
+    }
+
     return true;
 }
 
 bool _token_instruction_pass(const std::vector<Token>& tokens, std::vector<uint8_t>& bytecode, uint32_t& bytecode_top_ptr,
     const std::unordered_map<std::string, uint32_t>& data_ptrs, std::unordered_map<std::string, uint32_t>& label_ptrs,
-    std::unordered_map<std::string, std::vector<uint32_t>>& label_ref_ptrs_out)
+    std::unordered_map<std::string, std::vector<uint32_t>>& label_ref_ptrs_out, std::vector<std::pair<uint32_t, uint32_t>>& debug_lines_out)
 {
-    bool data_mode = false;
+    std::unordered_set<std::string> function_labels;
+    std::unordered_map<std::string, std::vector<size_t>> label_refs;
+    _find_function_labels(tokens, label_ptrs, function_labels, label_refs);
+
+    SectionMode mode = SectionMode::Program;
     for (size_t token_idx = 0; token_idx < tokens.size(); token_idx++)
     {
         const Token& token = tokens[token_idx];
 
-        if (data_mode)
+        if (_section_directive(token, mode) || mode != SectionMode::Program)
         {
-            if (token.type == TokenType::ProgramDirective)
-            {
-                data_mode = false;
-            }
             continue;
         }
 
@@ -122,15 +288,46 @@ bool _token_instruction_pass(const std::vector<Token>& tokens, std::vector<uint8
                 {
                     std::cout << "\nERROR: Could not assemble program - invalid instruction (" << static_cast<int>(token.instruction) <<
                         ") pattern on line " << token.line << "\n";
-                    return 1;
+                    return false;
                 }
 
-                bytecode[bytecode_top_ptr] = token.instruction;
+                uint8_t instruction = token.instruction;
+
+                // Pattern is valid so the second operand exists, anything but a register selects the immediate form
+                if (auto iter = immediate_instruction_map.find(instruction); iter != immediate_instruction_map.end() &&
+                    tokens[token_idx + 2].type != TokenType::Register)
+                {
+                    instruction = iter->second;
+                }
+
+                if (auto iter = memory_operand_instruction_map.find(instruction); iter != memory_operand_instruction_map.end() &&
+                    tokens[token_idx + 2].type == TokenType::MemoryOperand)
+                {
+                    instruction = iter->second;
+                }
+
+                // Lines start with an instruction or label, so a third register can only be an operand of this one
+                if (auto iter = three_register_instruction_map.find(instruction); iter != three_register_instruction_map.end() &&
+                    token_idx + 3 < tokens.size() && tokens[token_idx + 2].type == TokenType::Register &&
+                    tokens[token_idx + 3].type == TokenType::Register)
+                {
+                    instruction = iter->second;
+                }
+
+                // The ret is still written, it may be reached by a jump
+                if (instruction == INSTR_CALL && _is_tail_call(tokens, token_idx, function_labels, label_refs))
+                {
+                    instruction = INSTR_TAILCALL;
+                }
+
+                bytecode[bytecode_top_ptr] = instruction;
+                debug_lines_out.emplace_back(bytecode_top_ptr, token.line);
 
                 bytecode_top_ptr++;
                 break;
             }
             case TokenType::Register:
+            case TokenType::VectorRegister: // fallthrough
             {
                 bytecode[bytecode_top_ptr] = token.reg_id;
 
@@ -147,11 +344,44 @@ bool _token_instruction_pass(const std::vector<Token>& tokens, std::vector<uint8
             }
             case TokenType::FloatLiteral:
             {
-                write_int(&bytecode[bytecode_top_ptr], token.fvalue);
+                uint32_t value = *(uint32_t*)&token.fvalue;
+                write_int(&bytecode[bytecode_top_ptr], value);
                 
                 bytecode_top_ptr += 4;
                 break;
             }
+            case TokenType::MemoryOperand:
+            {
+                const MemoryOperand& memory = token.memory;
+                bytecode[bytecode_top_ptr] = memory.base_reg_id;
+                bytecode[bytecode_top_ptr + 1] = memory.index_reg_id;
+                bytecode[bytecode_top_ptr + 2] = memory.scale;
+
+                uint32_t disp = memory.disp;
+                if (!memory.disp_symbol.empty())
+                {
+                    if (data_ptrs.contains(memory.disp_symbol))
+                    {
+                        disp += data_ptrs.at(memory.disp_symbol);
+                    }
+                    else if (label_ptrs.contains(memory.disp_symbol))
+                    {
+                        // Label addresses are only known once the pass is done, written as an offset from the label
+                        label_ref_ptrs_out[memory.disp_symbol].push_back(bytecode_top_ptr + 3);
+                    }
+                    else
+                    {
+                        std::cout << "\nERROR: Could not assemble program (UNKNOWN SYMBOL : " << memory.disp_symbol << " on line " <<
+                            token.line << ")\n";
+                        return false;
+                    }
+                }
+
+                write_int(&bytecode[bytecode_top_ptr + 3], disp);
+
+                bytecode_top_ptr += 7;
+                break;
+            }
             case TokenType::Unknown:
             {
                 // Test if label
@@ -175,11 +405,6 @@ bool _token_instruction_pass(const std::vector<Token>& tokens, std::vector<uint8
                 std::cout << "\nERROR: Could not assemble program (UNKNOWN TOKEN : " << token.text << ")\n";
                 return false;
             }
-            case TokenType::DataDirective:
-            {
-                data_mode = true;
-                break;
-            }
         }
     }
 
@@ -196,52 +421,123 @@ void _write_label_refs(std::vector<uint8_t>& bytecode, const std::unordered_map<
 
         uint32_t label_ptr = label_ptrs.at(label);
 
+        // Added so a memory operand keeps its offset from the label, plain references start at 0
         for (uint32_t ref : refs)
         {
-            write_int(&bytecode[ref], label_ptr);
+            write_int(&bytecode[ref], load_int(&bytecode[ref]) + label_ptr);
         }
     }
 }
 
-void _write_header(std::vector<uint8_t>& bytecode, const std::unordered_map<std::string, uint32_t>& label_ptrs, uint32_t data_size)
+// bytes is null for sections that take no space in the file
+static void _append_section(std::vector<uint8_t>& file, uint32_t type, const uint8_t* bytes, uint32_t size, uint32_t addr)
+{
+    // Section entries follow the header in the order their sections are appended
+    const uint32_t entry = EXECUTABLE_HEADER_SIZE + load_int(&file[20]) * EXECUTABLE_SECTION_ENTRY_SIZE;
+    write_int(&file[20], load_int(&file[20]) + 1);
+
+    // Code and data start on a page so the loader could map them in place
+    if (type == SECTION_CODE || type == SECTION_DATA)
+    {
+        file.resize((file.size() + EXECUTABLE_SECTION_ALIGN - 1) / EXECUTABLE_SECTION_ALIGN * EXECUTABLE_SECTION_ALIGN, 0);
+    }
+
+    write_int(&file[entry], type);
+    write_int(&file[entry + 4], file.size());
+    write_int(&file[entry + 8], size);
+    write_int(&file[entry + 12], addr);
+
+    if (bytes) file.insert(file.end(), bytes, bytes + size);
+}
+
+static void _append_symbols(std::vector<uint8_t>& symbols, const std::unordered_map<std::string, uint32_t>& ptrs, uint8_t kind)
+{
+    // Sorted so the same source always gives the same file
+    std::vector<std::pair<uint32_t, std::string>> sorted;
+    for (const auto& [name, addr] : ptrs)
+    {
+        sorted.emplace_back(addr, name);
+    }
+    std::sort(sorted.begin(), sorted.end());
+
+    for (const auto& [addr, name] : sorted)
+    {
+        const uint8_t length = std::min<size_t>(name.length(), 255);
+        _append_int(symbols, addr);
+        symbols.push_back(kind);
+        symbols.push_back(length);
+        symbols.insert(symbols.end(), name.begin(), name.begin() + length);
+    }
+}
+
+void _write_executable(std::vector<uint8_t>& file, const std::vector<uint8_t>& bytecode, uint32_t bytecode_top_ptr,
+    const std::vector<uint8_t>& data, uint32_t bss_size, const std::unordered_map<std::string, uint32_t>& data_ptrs,
+    const std::unordered_map<std::string, uint32_t>& label_ptrs, const std::vector<std::pair<uint32_t, uint32_t>>* debug_lines)
 {
-    // Store ISA and syscall versions
-    write_int(&bytecode[0], ISA_version);
-    write_int(&bytecode[4], SYSCALL_version);
+    const uint32_t section_count = 4 + (debug_lines ? 1 : 0);
+    file.assign(EXECUTABLE_HEADER_SIZE + section_count * EXECUTABLE_SECTION_ENTRY_SIZE, 0);
+
+    // Store format, ISA and syscall versions and entry point, the section count is filled in as sections are added
+    write_int(&file[0], EXECUTABLE_MAGIC);
+    write_int(&file[4], EXECUTABLE_FORMAT_VERSION);
+    write_int(&file[8], ISA_version);
+    write_int(&file[12], SYSCALL_version);
+    write_int(&file[16], label_ptrs.at("main"));
+
+    _append_section(file, SECTION_CODE, &bytecode[EXECUTABLE_CODE_ADDR], bytecode_top_ptr - EXECUTABLE_CODE_ADDR,
+        EXECUTABLE_CODE_ADDR);
+    _append_section(file, SECTION_DATA, data.data(), data.size(), 0);
 
-    // Store entry point and data size
-    write_int(&bytecode[8], label_ptrs.at("main"));
-    write_int(&bytecode[12], data_size);
+    // Only the size is stored, the loader zero fills it
+    _append_section(file, SECTION_BSS, nullptr, bss_size, (data.size() + 3) & ~3u);
+
+    std::vector<uint8_t> symbols;
+    _append_symbols(symbols, label_ptrs, SYMBOL_CODE);
+    _append_symbols(symbols, data_ptrs, SYMBOL_DATA);
+    _append_section(file, SECTION_SYMBOLS, symbols.data(), symbols.size(), 0);
+
+    if (debug_lines)
+    {
+        std::vector<uint8_t> lines;
+        for (const auto& [addr, line] : *debug_lines)
+        {
+            _append_int(lines, addr);
+            _append_int(lines, line);
+        }
+        _append_section(file, SECTION_DEBUG_LINES, lines.data(), lines.size(), 0);
+    }
 }
 
-bool assemble_file(std::string filepath)
+bool assemble_file(std::string filepath, bool debug_lines)
 {
     std::vector<Token> tokens = parse_tokens_from_file(filepath);
 
-    std::vector<uint8_t> bytecode(tokens.size() * 4, 0);
+    std::vector<uint8_t> data;
+    uint32_t bss_size = 0;
 
-    uint32_t bytecode_top_ptr = BYTECODE_HEADER_SIZE;
-    
     std::unordered_map<std::string, uint32_t> data_ptrs;
     std::unordered_map<std::string, uint32_t> label_ptrs;
     
-    if (!_token_data_label_pass(tokens, bytecode, bytecode_top_ptr, data_ptrs, label_ptrs))
+    if (!_token_data_label_pass(tokens, data, bss_size, data_ptrs, label_ptrs))
     {
         std::cout << "ERROR: Data-label pass failed\n";
         return false;
     }
 
-    uint32_t data_size = bytecode_top_ptr - BYTECODE_HEADER_SIZE;
-
     if (!label_ptrs.contains("main"))
     {
         std::cout << "ERROR: Program does not contain main (.main label) entry point\n";
         return false;
     }
-    
+
+    // Code addresses start at the code section's addr, the bytes before it are not written out
+    std::vector<uint8_t> bytecode(EXECUTABLE_CODE_ADDR + tokens.size() * 7, 0);
+    uint32_t bytecode_top_ptr = EXECUTABLE_CODE_ADDR;
+
     std::unordered_map<std::string, std::vector<uint32_t>> label_ref_ptrs;
+    std::vector<std::pair<uint32_t, uint32_t>> lines;
 
-    if (!_token_instruction_pass(tokens, bytecode, bytecode_top_ptr, data_ptrs, label_ptrs, label_ref_ptrs))
+    if (!_token_instruction_pass(tokens, bytecode, bytecode_top_ptr, data_ptrs, label_ptrs, label_ref_ptrs, lines))
     {
         std::cout << "ERROR: Instruction pass failed\n";
         return false;
@@ -249,7 +545,8 @@ bool assemble_file(std::string filepath)
 
     _write_label_refs(bytecode, label_ptrs, label_ref_ptrs);
 
-    _write_header(bytecode, label_ptrs, data_size);
+    std::vector<uint8_t> file;
+    _write_executable(file, bytecode, bytecode_top_ptr, data, bss_size, data_ptrs, label_ptrs, debug_lines ? &lines : nullptr);
 
     // Get input file name
     std::string out_filepath = parse_file_path_out_file_name(filepath);
@@ -257,10 +554,7 @@ bool assemble_file(std::string filepath)
     std::cout << "Assembled file \"" << out_filepath << "\"\n";
 
     std::ofstream out_file(out_filepath, std::ios::binary);
-    for (uint32_t i = 0; i < bytecode_top_ptr; i++)
-    {
-        out_file << bytecode[i];
-    }
+    out_file.write(reinterpret_cast<const char*>(file.data()), file.size());
 
     return true;
 }
\ No newline at end of file
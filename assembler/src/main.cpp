@@ -1,10 +1,14 @@
 #include "bytecode.hpp"
 
+#include <string>
+
 int main(int argv, char** argc)
 {
-    if (argv < 2) return 1;
+    // assembler [-g] file.asm, -g also writes source lines for each instruction
+    bool debug_lines = argv > 2 && std::string(argc[1]) == "-g";
+    if (argv < 2 + debug_lines) return 1;
 
-    if (!assemble_file(argc[1])) return 1;
+    if (!assemble_file(argc[1 + debug_lines], debug_lines)) return 1;
 
     return 0;
 }
\ No newline at end of file
@@ -23,6 +23,7 @@ std::vector<Token> parse_tokens_from_file(std::string filepath)
     bool parsing_comment = false;
     bool parsing_string = false;
     bool parsing_string_escape = false;
+    bool parsing_memory_operand = false;
     int line = 1;
 
     for (int i = 0; i < file_buffer.size(); i++)
@@ -62,8 +63,15 @@ std::vector<Token> parse_tokens_from_file(std::string filepath)
 
             parsing_string_escape = false;
         }
+        else if (parsing_memory_operand && c == ' ')
+        {
+            // Memory operands stay one token, [nums + cx*4] becomes [nums+cx*4]
+            continue;
+        }
         else if (c == ' ' || c == ',' || c == '\n' || c == ';')
         {
+            parsing_memory_operand = false;
+
             if (token_buffer.size() > 0)
             {
                 tokens.push_back(create_token(token_buffer, line));
@@ -89,6 +97,9 @@ std::vector<Token> parse_tokens_from_file(std::string filepath)
                 continue;
             }
 
+            if (!parsing_string && c == '[') parsing_memory_operand = true;
+            if (!parsing_string && c == ']') parsing_memory_operand = false;
+
             if (parsing_string)
             {
                 if (c == '\\')
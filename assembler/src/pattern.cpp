@@ -1,43 +1,126 @@
 #include "pattern.hpp"
 
+// Second operand is a literal/label/data address for the immediate form
+#define IMMEDIATE_PATTERNS {TokenType::Register, TokenType::IntLiteral}, {TokenType::Register, TokenType::HexLiteral}, \
+    {TokenType::Register, TokenType::Unknown}
+
+#define TWO_REGISTER_PATTERN {TokenType::Register, TokenType::Register}
+#define THREE_REGISTER_PATTERN {TokenType::Register, TokenType::Register, TokenType::Register}
+
 const std::unordered_map<uint8_t, std::vector<std::vector<TokenType>>> instruction_token_patterns = {
-    {INSTR_LOAD, {{TokenType::Register, TokenType::Register}}},
+    {INSTR_LOAD, {{TokenType::Register, TokenType::Register}, {TokenType::Register, TokenType::MemoryOperand}}},
     {INSTR_LOADS, {{TokenType::Register, TokenType::IntLiteral}, {TokenType::Register, TokenType::HexLiteral}}},
     {INSTR_LOADC, {{TokenType::Register, TokenType::IntLiteral}, {TokenType::Register, TokenType::HexLiteral},
         {TokenType::Register, TokenType::FloatLiteral}, {TokenType::Register, TokenType::Unknown}}},
-    {INSTR_STORE, {{TokenType::Register, TokenType::Register}}},
+    {INSTR_STORE, {{TokenType::Register, TokenType::Register}, {TokenType::Register, TokenType::MemoryOperand}}},
+    {INSTR_LOADB, {{TokenType::Register, TokenType::Register}, {TokenType::Register, TokenType::MemoryOperand}}},
+    {INSTR_LOADBI, {{TokenType::Register, TokenType::Register}, {TokenType::Register, TokenType::MemoryOperand}}},
+    {INSTR_LOADH, {{TokenType::Register, TokenType::Register}, {TokenType::Register, TokenType::MemoryOperand}}},
+    {INSTR_LOADHI, {{TokenType::Register, TokenType::Register}, {TokenType::Register, TokenType::MemoryOperand}}},
+    {INSTR_STOREB, {{TokenType::Register, TokenType::Register}, {TokenType::Register, TokenType::MemoryOperand}}},
+    {INSTR_STOREH, {{TokenType::Register, TokenType::Register}, {TokenType::Register, TokenType::MemoryOperand}}},
     {INSTR_STORES, {{TokenType::Register, TokenType::IntLiteral}, {TokenType::Register, TokenType::HexLiteral}}},
+    {INSTR_XADD, {{TokenType::Register, TokenType::Register}}},
+    {INSTR_XCHG, {{TokenType::Register, TokenType::Register}}},
+    {INSTR_CAS, {{TokenType::Register, TokenType::Register, TokenType::Register}}},
+    {INSTR_FENCE, {}},
     {INSTR_COPY, {{TokenType::Register, TokenType::Register}}},
-    {INSTR_ADD, {{TokenType::Register, TokenType::Register}}},
-    {INSTR_SUB, {{TokenType::Register, TokenType::Register}}},
-    {INSTR_MUL, {{TokenType::Register, TokenType::Register}}},
-    {INSTR_DIV, {{TokenType::Register, TokenType::Register}}},
-    {INSTR_IDIV, {{TokenType::Register, TokenType::Register}}},
-    {INSTR_SHL, {{TokenType::Register, TokenType::Register}}},
-    {INSTR_SHR, {{TokenType::Register, TokenType::Register}}},
-    {INSTR_AND, {{TokenType::Register, TokenType::Register}}},
-    {INSTR_OR, {{TokenType::Register, TokenType::Register}}},
-    {INSTR_XOR, {{TokenType::Register, TokenType::Register}}},
+    {INSTR_ADD, {TWO_REGISTER_PATTERN, THREE_REGISTER_PATTERN, IMMEDIATE_PATTERNS}},
+    {INSTR_SUB, {TWO_REGISTER_PATTERN, THREE_REGISTER_PATTERN, IMMEDIATE_PATTERNS}},
+    {INSTR_MUL, {TWO_REGISTER_PATTERN, THREE_REGISTER_PATTERN, IMMEDIATE_PATTERNS}},
+    {INSTR_DIV, {TWO_REGISTER_PATTERN, THREE_REGISTER_PATTERN, IMMEDIATE_PATTERNS}},
+    {INSTR_IDIV, {TWO_REGISTER_PATTERN, THREE_REGISTER_PATTERN, IMMEDIATE_PATTERNS}},
+    {INSTR_SHL, {TWO_REGISTER_PATTERN, THREE_REGISTER_PATTERN, IMMEDIATE_PATTERNS}},
+    {INSTR_SHR, {TWO_REGISTER_PATTERN, THREE_REGISTER_PATTERN, IMMEDIATE_PATTERNS}},
+    {INSTR_AND, {TWO_REGISTER_PATTERN, THREE_REGISTER_PATTERN, IMMEDIATE_PATTERNS}},
+    {INSTR_OR, {TWO_REGISTER_PATTERN, THREE_REGISTER_PATTERN, IMMEDIATE_PATTERNS}},
+    {INSTR_XOR, {TWO_REGISTER_PATTERN, THREE_REGISTER_PATTERN, IMMEDIATE_PATTERNS}},
     {INSTR_NOT, {{TokenType::Register}}},
-    {INSTR_FADD, {{TokenType::Register, TokenType::Register}}},
-    {INSTR_FSUB, {{TokenType::Register, TokenType::Register}}},
-    {INSTR_FMUL, {{TokenType::Register, TokenType::Register}}},
-    {INSTR_FDIV, {{TokenType::Register, TokenType::Register}}},
-    {INSTR_CMP, {{TokenType::Register, TokenType::Register}}},
-    {INSTR_CMPI, {{TokenType::Register, TokenType::Register}}},
+    {INSTR_FADD, {TWO_REGISTER_PATTERN, THREE_REGISTER_PATTERN}},
+    {INSTR_FSUB, {TWO_REGISTER_PATTERN, THREE_REGISTER_PATTERN}},
+    {INSTR_FMUL, {TWO_REGISTER_PATTERN, THREE_REGISTER_PATTERN}},
+    {INSTR_FDIV, {TWO_REGISTER_PATTERN, THREE_REGISTER_PATTERN}},
+    {INSTR_CMP, {TWO_REGISTER_PATTERN, IMMEDIATE_PATTERNS}},
+    {INSTR_CMPI, {TWO_REGISTER_PATTERN, IMMEDIATE_PATTERNS}},
     {INSTR_CMPF, {{TokenType::Register, TokenType::Register}}},
+    {INSTR_ADD64, {THREE_REGISTER_PATTERN}},
+    {INSTR_SUB64, {THREE_REGISTER_PATTERN}},
+    {INSTR_MUL64, {THREE_REGISTER_PATTERN}},
+    {INSTR_DIV64, {THREE_REGISTER_PATTERN}},
+    {INSTR_IDIV64, {THREE_REGISTER_PATTERN}},
+    {INSTR_CMP64, {TWO_REGISTER_PATTERN}},
+    {INSTR_CMPI64, {TWO_REGISTER_PATTERN}},
+    {INSTR_DADD, {THREE_REGISTER_PATTERN}},
+    {INSTR_DSUB, {THREE_REGISTER_PATTERN}},
+    {INSTR_DMUL, {THREE_REGISTER_PATTERN}},
+    {INSTR_DDIV, {THREE_REGISTER_PATTERN}},
+    {INSTR_DCMP, {TWO_REGISTER_PATTERN}},
+    {INSTR_FTOD, {TWO_REGISTER_PATTERN}},
+    {INSTR_DTOF, {TWO_REGISTER_PATTERN}},
+    {INSTR_FMIN, {THREE_REGISTER_PATTERN}},
+    {INSTR_FMAX, {THREE_REGISTER_PATTERN}},
+    {INSTR_FFMA, {THREE_REGISTER_PATTERN}},
+    {INSTR_FSQRT, {TWO_REGISTER_PATTERN}},
+    {INSTR_FABS, {TWO_REGISTER_PATTERN}},
+    {INSTR_FFLOOR, {TWO_REGISTER_PATTERN}},
+    {INSTR_FSIN, {TWO_REGISTER_PATTERN}},
+    {INSTR_FCOS, {TWO_REGISTER_PATTERN}},
     {INSTR_PUSH, {{TokenType::Register}}},
     {INSTR_POP, {{TokenType::Register}}},
     {INSTR_CALL, {{TokenType::Unknown}}},
     {INSTR_RET, {}},
     {INSTR_SYSCALL, {{TokenType::IntLiteral}, {TokenType::HexLiteral}}},
+    {INSTR_TAILCALL, {{TokenType::Unknown}}},
+    {INSTR_ENTER, {{TokenType::IntLiteral}, {TokenType::HexLiteral}}},
+    {INSTR_LEAVE, {}},
+    {INSTR_VLOAD, {{TokenType::VectorRegister, TokenType::Register}}},
+    {INSTR_VLOADA, {{TokenType::VectorRegister, TokenType::Register}}},
+    {INSTR_VSTORE, {{TokenType::VectorRegister, TokenType::Register}}},
+    {INSTR_VSTOREA, {{TokenType::VectorRegister, TokenType::Register}}},
+    {INSTR_VSPLAT, {{TokenType::VectorRegister, TokenType::Register}}},
+    {INSTR_VCOPY, {{TokenType::VectorRegister, TokenType::VectorRegister}}},
+    {INSTR_VEXTRACT, {{TokenType::Register, TokenType::VectorRegister, TokenType::IntLiteral}}},
+    {INSTR_VINSERT, {{TokenType::VectorRegister, TokenType::Register, TokenType::IntLiteral}}},
+    {INSTR_VSHUF, {{TokenType::VectorRegister, TokenType::VectorRegister, TokenType::IntLiteral},
+        {TokenType::VectorRegister, TokenType::VectorRegister, TokenType::HexLiteral}}},
+    {INSTR_VADD, {{TokenType::VectorRegister, TokenType::VectorRegister}}},
+    {INSTR_VSUB, {{TokenType::VectorRegister, TokenType::VectorRegister}}},
+    {INSTR_VMUL, {{TokenType::VectorRegister, TokenType::VectorRegister}}},
+    {INSTR_VMIN, {{TokenType::VectorRegister, TokenType::VectorRegister}}},
+    {INSTR_VMAX, {{TokenType::VectorRegister, TokenType::VectorRegister}}},
+    {INSTR_VCMPEQ, {{TokenType::VectorRegister, TokenType::VectorRegister}}},
+    {INSTR_VCMPGT, {{TokenType::VectorRegister, TokenType::VectorRegister}}},
+    {INSTR_VAND, {{TokenType::VectorRegister, TokenType::VectorRegister}}},
+    {INSTR_VOR, {{TokenType::VectorRegister, TokenType::VectorRegister}}},
+    {INSTR_VXOR, {{TokenType::VectorRegister, TokenType::VectorRegister}}},
+    {INSTR_VFADD, {{TokenType::VectorRegister, TokenType::VectorRegister}}},
+    {INSTR_VFSUB, {{TokenType::VectorRegister, TokenType::VectorRegister}}},
+    {INSTR_VFMUL, {{TokenType::VectorRegister, TokenType::VectorRegister}}},
+    {INSTR_VFMIN, {{TokenType::VectorRegister, TokenType::VectorRegister}}},
+    {INSTR_VFMAX, {{TokenType::VectorRegister, TokenType::VectorRegister}}},
+    {INSTR_VFCMPEQ, {{TokenType::VectorRegister, TokenType::VectorRegister}}},
+    {INSTR_VFCMPLT, {{TokenType::VectorRegister, TokenType::VectorRegister}}},
     {INSTR_STOP, {}},
     {INSTR_JMP, {{TokenType::Unknown}}},
     {INSTR_JMPZ, {{TokenType::Unknown}}},
     {INSTR_JMPS, {{TokenType::Unknown}}},
     {INSTR_JMPC, {{TokenType::Unknown}}},
+    {INSTR_BEQ, {{TokenType::Register, TokenType::Register, TokenType::Unknown}}},
+    {INSTR_BNE, {{TokenType::Register, TokenType::Register, TokenType::Unknown}}},
+    {INSTR_BLT, {{TokenType::Register, TokenType::Register, TokenType::Unknown}}},
+    {INSTR_BGE, {{TokenType::Register, TokenType::Register, TokenType::Unknown}}},
+    {INSTR_BLTI, {{TokenType::Register, TokenType::Register, TokenType::Unknown}}},
+    {INSTR_BGEI, {{TokenType::Register, TokenType::Register, TokenType::Unknown}}},
+    {INSTR_BEQF, {{TokenType::Register, TokenType::Register, TokenType::Unknown}}},
+    {INSTR_BNEF, {{TokenType::Register, TokenType::Register, TokenType::Unknown}}},
+    {INSTR_BLTF, {{TokenType::Register, TokenType::Register, TokenType::Unknown}}},
+    {INSTR_BGEF, {{TokenType::Register, TokenType::Register, TokenType::Unknown}}},
 };
 
+#undef IMMEDIATE_PATTERNS
+#undef TWO_REGISTER_PATTERN
+#undef THREE_REGISTER_PATTERN
+
 bool instruction_token_has_valid_pattern(const std::vector<Token>& tokens, int index)
 {
     const Token& token = tokens.at(index);
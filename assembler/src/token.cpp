@@ -24,6 +24,17 @@ bool is_token_register(const std::string& token, uint8_t& reg_id)
     return false;
 }
 
+bool is_token_vector_register(const std::string& token, uint8_t& reg_id)
+{
+    if (auto iter = vector_reg_name_map.find(token); iter != vector_reg_name_map.end())
+    {
+        reg_id = iter->second;
+        return true;
+    }
+
+    return false;
+}
+
 bool is_token_instruction(const std::string& token, uint8_t& instruction)
 {
     if (auto iter = instruction_name_map.find(token); iter != instruction_name_map.end())
@@ -107,9 +118,10 @@ bool is_token_float_literal(const std::string& token, float& value)
     if (token.length() < 1) return false;
 
     bool negative = false;
-    bool found_decimal;
-    float decimal_value = 0;
-    value = 0;
+    bool found_decimal = false;
+    double whole_value = 0;
+    double decimal_value = 0;
+    double decimal_scale = 0.1;
     for (int i = 0; i < token.length(); i++)
     {
         char c = token[i];
@@ -135,11 +147,12 @@ bool is_token_float_literal(const std::string& token, float& value)
         {
             if (found_decimal)
             {
-                decimal_value = decimal_value / 10.0f + (c - '0') / 10.0f;
+                decimal_value += (c - '0') * decimal_scale;
+                decimal_scale /= 10.0;
             }
             else
             {
-                value = value * 10 + (c - '0');
+                whole_value = whole_value * 10 + (c - '0');
             }
         }
         else if (i != token.length() - 1 || c != 'f')
@@ -148,7 +161,7 @@ bool is_token_float_literal(const std::string& token, float& value)
         }
     }
 
-    value += decimal_value;
+    value = whole_value + decimal_value;
 
     if (negative)
     {
@@ -163,11 +176,108 @@ bool is_token_data_directive(const std::string& token)
     return token == "[data]";
 }
 
+bool is_token_bss_directive(const std::string& token)
+{
+    return token == "[bss]";
+}
+
 bool is_token_program_directive(const std::string& token)
 {
     return token == "[program]";
 }
 
+static bool _add_memory_operand_term(const std::string& term, bool negative, MemoryOperand& memory)
+{
+    if (term.empty()) return false;
+
+    uint8_t reg_id;
+    uint32_t value;
+
+    // reg*scale or scale*reg
+    if (size_t star = term.find('*'); star != std::string::npos)
+    {
+        std::string reg_text = term.substr(0, star);
+        std::string scale_text = term.substr(star + 1);
+        if (!is_token_register(reg_text, reg_id)) std::swap(reg_text, scale_text);
+
+        if (negative || memory.index_reg_id != MEMORY_OPERAND_NO_REG) return false;
+        if (!is_token_register(reg_text, reg_id) || !is_token_int_literal(scale_text, value)) return false;
+        if (value != 1 && value != 2 && value != 4 && value != 8) return false;
+
+        memory.index_reg_id = reg_id;
+        memory.scale = value;
+        return true;
+    }
+
+    // First plain register is the base, a second one is an index with scale 1
+    if (is_token_register(term, reg_id))
+    {
+        if (negative) return false;
+
+        if (memory.base_reg_id == MEMORY_OPERAND_NO_REG)
+        {
+            memory.base_reg_id = reg_id;
+        }
+        else if (memory.index_reg_id == MEMORY_OPERAND_NO_REG)
+        {
+            memory.index_reg_id = reg_id;
+            memory.scale = 1;
+        }
+        else
+        {
+            return false;
+        }
+
+        return true;
+    }
+
+    if (is_token_int_literal(term, value) || is_token_hex_literal(term, value))
+    {
+        memory.disp += negative ? -value : value;
+        return true;
+    }
+
+    if (negative || !memory.disp_symbol.empty()) return false;
+
+    memory.disp_symbol = term;
+    return true;
+}
+
+bool is_token_memory_operand(const std::string& token, MemoryOperand& memory)
+{
+    if (token.length() < 3 || token.front() != '[' || token.back() != ']') return false;
+
+    memory.base_reg_id = MEMORY_OPERAND_NO_REG;
+    memory.index_reg_id = MEMORY_OPERAND_NO_REG;
+    memory.scale = 1;
+    memory.disp = 0;
+    memory.disp_symbol.clear();
+
+    // Terms separated by + or -, spaces were already dropped when parsing
+    size_t term_start = 1;
+    bool negative = false;
+    for (size_t i = 1; i < token.length(); i++)
+    {
+        char c = token[i];
+        if (c != '+' && c != '-' && c != ']') continue;
+
+        // Leading minus on the first term, [-4 + bx]
+        if (c == '-' && i == 1)
+        {
+            negative = true;
+            term_start = i + 1;
+            continue;
+        }
+
+        if (!_add_memory_operand_term(token.substr(term_start, i - term_start), negative, memory)) return false;
+
+        negative = c == '-';
+        term_start = i + 1;
+    }
+
+    return true;
+}
+
 Token create_token(const std::string& text, int line)
 {
     Token token;
@@ -188,6 +298,13 @@ Token create_token(const std::string& text, int line)
         return token;
     }
 
+    if (is_token_vector_register(text, token.reg_id))
+    {
+        token.type = TokenType::VectorRegister;
+        std::cout << "VECTOR REGISTER (" << static_cast<int>(token.reg_id) << ") TOKEN: " << text << "\n";
+        return token;
+    }
+
     if (is_token_instruction(text, token.instruction))
     {
         token.type = TokenType::Instruction;
@@ -223,6 +340,13 @@ Token create_token(const std::string& text, int line)
         return token;
     }
 
+    if (is_token_bss_directive(text))
+    {
+        token.type = TokenType::BssDirective;
+        std::cout << "BSS DIRECTIVE TOKEN\n";
+        return token;
+    }
+
     if (is_token_program_directive(text))
     {
         token.type = TokenType::ProgramDirective;
@@ -230,6 +354,14 @@ Token create_token(const std::string& text, int line)
         return token;
     }
 
+    if (is_token_memory_operand(text, token.memory))
+    {
+        token.type = TokenType::MemoryOperand;
+        token.text = text;
+        std::cout << "MEMORY OPERAND TOKEN: " << text << "\n";
+        return token;
+    }
+
     token.type = TokenType::Unknown;
     token.text = text;
     std::cout << "UNKNOWN TYPE TOKEN: " << text << "\n";
@@ -85,6 +85,15 @@ void print_expression(ExpressionNode* node, int depth = 0)
     }
 }
 
+const char* operator_instruction(const std::string& op)
+{
+    if (op == "+") return "add     ";
+    if (op == "-") return "sub     ";
+    if (op == "*") return "mul     ";
+    if (op == "/") return "div     ";
+    return "";
+}
+
 void print_assembly_from_expression(ExpressionNode* node, int depth = 0)
 {
     if (!node->is_operator)
@@ -94,30 +103,31 @@ void print_assembly_from_expression(ExpressionNode* node, int depth = 0)
         return;
     }
 
-    print_assembly_from_expression(node->right.get(), depth + 1);
-    print_assembly_from_expression(node->left.get(), depth + 1);
-
-    std::cout << "  pop     ax\n";
-    std::cout << "  pop     bx\n";
-    
-    if (node->value == "+")
-    {
-        std::cout << "  add     ";
-    }
-    else if (node->value == "-")
+    // A literal right operand is assembled as an immediate, no need to go through the stack
+    if (!node->right->is_operator)
     {
-        std::cout << "  sub     ";
-    }
-    else if (node->value == "*")
-    {
-        std::cout << "  mul     ";
+        if (node->left->is_operator)
+        {
+            print_assembly_from_expression(node->left.get(), depth + 1);
+            std::cout << "  pop     ax\n";
+        }
+        else
+        {
+            std::cout << "  loadc   ax    " << node->left->value << "\n";
+        }
+
+        std::cout << "  " << operator_instruction(node->value) << "ax    " << node->right->value << "\n";
     }
-    else if (node->value == "/")
+    else
     {
-        std::cout << "  div     ";
+        print_assembly_from_expression(node->right.get(), depth + 1);
+        print_assembly_from_expression(node->left.get(), depth + 1);
+
+        std::cout << "  pop     ax\n";
+        std::cout << "  pop     bx\n";
+        std::cout << "  " << operator_instruction(node->value) << "ax    bx\n";
     }
 
-    std::cout << "ax    bx\n";
     if (depth > 0)
     {
         std::cout << "  push    ax\n";
@@ -0,0 +1,96 @@
+[data]
+    counter     0
+    cas_counter 0
+
+[program]
+
+; Contention microbenchmark, 4 threads hammer one shared word with 1000000 increments each,
+; first with xadd and then with a cas retry loop. Both counters should print 4000000.
+
+.xadd_worker
+    loadc       cx      0               ; iterations done
+    loadc       dx      counter
+.xadd_loop
+    loadc       ax      1
+    xadd        ax      dx              ; counter += 1
+    loadc       ax      1
+    add         cx      ax
+    copy        ax      cx
+    cmp         cx      bx
+    jmps        xadd_loop
+    ret
+
+.cas_worker
+    push        bx                      ; [bp + 8] iteration count
+    loadc       ax      0
+    push        ax                      ; [bp + 12] iterations done
+.cas_next
+    loadc       cx      cas_counter
+    load        ax      cx              ; expected value
+.cas_retry
+    copy        ax      bx
+    loadc       dx      1
+    add         bx      dx
+    copy        ax      dx              ; dx = expected + 1
+    copy        bx      ax
+    cas         ax      dx      cx      ; ax = value seen, zero flag set if it was stored
+    jmpz        cas_done
+    jmp         cas_retry
+.cas_done
+    loads       ax      12
+    loadc       dx      1
+    add         ax      dx
+    stores      ax      12
+    loads       bx      8
+    cmp         ax      bx
+    jmps        cas_next
+    ret
+
+; Runs worker (bx) on 4 threads and waits for all of them
+.run_workers
+    push        bx                      ; [bp + 8] worker
+    loads       bx      8
+    loadc       cx      1000000
+    loadc       dx      0
+    syscall     0x30                    ; thread_spawn
+    push        ax                      ; [bp + 12] thread ids
+    loads       bx      8
+    loadc       cx      1000000
+    loadc       dx      0
+    syscall     0x30
+    push        ax
+    loads       bx      8
+    loadc       cx      1000000
+    loadc       dx      0
+    syscall     0x30
+    push        ax
+    loads       bx      8
+    loadc       cx      1000000
+    loadc       dx      0
+    syscall     0x30
+    push        ax
+    loads       bx      12
+    syscall     0x31                    ; thread_join
+    loads       bx      16
+    syscall     0x31
+    loads       bx      20
+    syscall     0x31
+    loads       bx      24
+    syscall     0x31
+    ret
+
+.main
+    loadc       bx      xadd_worker
+    call        run_workers
+    loadc       bx      counter
+    load        ax      bx
+    loadc       bx      0
+    syscall     0x41                    ; print reg 0 (ax)
+
+    loadc       bx      cas_worker
+    call        run_workers
+    loadc       bx      cas_counter
+    load        ax      bx
+    loadc       bx      0
+    syscall     0x41
+    stop
\ No newline at end of file
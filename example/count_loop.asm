@@ -0,0 +1,15 @@
+[program]
+
+.main
+    loadc       cx      0
+    loadc       dx      100000000       ; iteration count
+    loadc       bx      1
+.main_loop
+    add         cx      bx
+    copy        ax      cx
+    cmp         cx      dx
+    jmps        main_loop
+
+    loadc       bx      2
+    syscall     0x41                    ; print reg 2 (cx)
+    stop
\ No newline at end of file
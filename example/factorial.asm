@@ -6,41 +6,29 @@
 
 .factorial
     loadc       ax      1
-    cmp         bx      ax
+    cmp         bx      1
     jmpz        factorial_end
     push        bx
-    sub         bx      ax
-    copy        ax      bx
+    sub         bx      bx      ax
     call        factorial               ; recursive call
     pop         bx
-    mul         ax      bx
+    mul         ax      ax      bx
 .factorial_end
     ret
 
 .main
     loadc       cx      0
+    loadc       dx      1
 .main_loop0
-    copy        cx      ax
-    loadc       bx      4               ; increment ptr by 4
-    mul         ax      bx
-    
-    loadc       bx      nums
-    add         ax      bx              ; get nums ptr
-    load        bx      ax
+    load        bx      [nums + cx*4]
 
     call        factorial
     
     loadc       bx      0
     syscall     0x41                    ; print reg 0 (ax)
 
-    loadc       ax      1
-    add         cx      ax
-    copy        ax      cx
+    add         cx      cx      dx
 
-    loadc       ax      num_count
-    load        ax      ax
-    cmp         cx      ax
-    
-    jmpz        main_end
-    jmp         main_loop0
+    load        ax      [num_count]
+    bne         cx      ax      main_loop0
 .main_end
\ No newline at end of file
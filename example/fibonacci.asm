@@ -0,0 +1,33 @@
+[program]
+
+.fibonacci
+    loadc       ax      2
+    cmp         bx      ax
+    jmps        fibonacci_base          ; n < 2
+    push        bx
+    loadc       ax      1
+    sub         bx      ax
+    copy        ax      bx
+    call        fibonacci               ; fib(n - 1)
+    pop         bx
+    push        ax
+    push        bx
+    loadc       ax      2
+    sub         bx      ax
+    copy        ax      bx
+    call        fibonacci               ; fib(n - 2)
+    pop         bx
+    pop         cx
+    add         ax      cx
+    ret
+.fibonacci_base
+    copy        bx      ax
+    ret
+
+.main
+    loadc       bx      32
+    call        fibonacci
+
+    loadc       bx      0
+    syscall     0x41                    ; print reg 0 (ax)
+    stop
\ No newline at end of file
@@ -0,0 +1,54 @@
+[program]
+
+; A thread's stack is a heap block with a guard page either side. Freeing a pointer into the guard page, or a free
+; list link corrupted to point at it, is reported and ignored instead of faulting the VM inside malloc/free.
+; Prints 7 (the thread's result) and then 1 (malloc still works), also under --batch-count.
+
+.worker
+    loadc       ax      7
+    ret
+
+.main
+    loadc       bx      8
+    syscall     0x20                    ; malloc, first block of the heap
+    copy        ax      r12
+
+    loadc       bx      worker
+    loadc       cx      0
+    loadc       dx      0
+    syscall     0x30                    ; thread_spawn, its stack block is carved right after ours
+    copy        ax      r13
+
+    ; Lower guard page starts at the first page boundary past the stack block's payload (r12 + 16)
+    copy        r12     cx
+    add         cx      4111
+    and         ax      0xFFFFF000
+    copy        ax      r14
+
+    add         ax      8
+    copy        ax      bx
+    syscall     0x21                    ; free of a pointer into the guard page
+
+    copy        r12     bx
+    syscall     0x21                    ; free our block, its payload now holds the free list link
+    store       r14     r12             ; corrupt the link to point at the guard page
+    loadc       bx      8
+    syscall     0x20                    ; gets our block back
+    loadc       bx      8
+    syscall     0x20                    ; follows the corrupted link, rejected and carved fresh instead
+    copy        ax      r15
+
+    copy        r13     bx
+    syscall     0x31                    ; thread_join
+    loadc       bx      0
+    syscall     0x41
+
+    loadc       ax      0
+    loadc       cx      0
+    bne         r15     cx      malloc_ok
+    stop
+.malloc_ok
+    loadc       ax      1
+    loadc       bx      0
+    syscall     0x41
+    stop
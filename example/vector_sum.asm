@@ -0,0 +1,76 @@
+[data]
+    array       0
+
+[program]
+
+; Sums 1000000 ints one at a time and then 4 at a time with vector registers,
+; both print 1783293664 (the sum of 0 to 999999 wrapped to 32 bits)
+
+.main
+    loadc       bx      4000000
+    syscall     0x20                    ; malloc
+    loadc       bx      array
+    store       ax      bx
+
+    ; fill with 0, 1, 2, ... using vector stores
+    copy        ax      cx
+    loadc       bx      4000000
+    add         cx      bx
+    copy        ax      dx              ; end of array
+    loadc       ax      1
+    vinsert     v0      ax      1
+    loadc       ax      2
+    vinsert     v0      ax      2
+    loadc       ax      3
+    vinsert     v0      ax      3
+    loadc       ax      4
+    vsplat      v1      ax
+    loadc       bx      16
+.fill_loop
+    vstore      v0      cx
+    vadd        v0      v1
+    add         cx      bx
+    copy        ax      cx
+    cmp         cx      dx
+    jmps        fill_loop
+
+    ; scalar sum in bx
+    loadc       cx      array
+    load        cx      cx
+    loadc       bx      0
+.scalar_loop
+    load        ax      cx
+    add         ax      bx
+    copy        ax      bx
+    loadc       ax      4
+    add         cx      ax
+    copy        ax      cx
+    cmp         cx      dx
+    jmps        scalar_loop
+
+    copy        bx      ax
+    loadc       bx      0
+    syscall     0x41                    ; print reg 0 (ax)
+
+    ; vector sum in v2, 4 lanes at a time
+    loadc       cx      array
+    load        cx      cx
+    vxor        v2      v2
+.vector_loop
+    vload       v3      cx
+    vadd        v2      v3
+    loadc       ax      16
+    add         cx      ax
+    copy        ax      cx
+    cmp         cx      dx
+    jmps        vector_loop
+
+    ; add the lanes together
+    vshuf       v3      v2      0x4E    ; swap halves
+    vadd        v2      v3
+    vshuf       v3      v2      0xB1    ; swap neighbouring lanes
+    vadd        v2      v3
+    vextract    ax      v2      0
+    loadc       bx      0
+    syscall     0x41
+    stop
\ No newline at end of file
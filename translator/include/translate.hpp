@@ -0,0 +1,17 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <stdint.h>
+
+#include "decode.hpp"
+#include "executable.hpp"
+
+// Translates a .vmex executable into a C++ translation unit that runs on the VM's translated program runtime
+bool translate_file(const std::string& filepath, const std::string& out_filepath);
+
+bool _emit_program(std::ostream& out, const std::string& source_name, const Executable& executable,
+    const DecodedProgram& decoded);
+
+bool _emit_instruction(std::ostream& out, const DecodedProgram& decoded, uint32_t index);
\ No newline at end of file
@@ -0,0 +1,29 @@
+#include <iostream>
+#include <string>
+
+#include "translate.hpp"
+
+int main(int argv, char** argc)
+{
+    if (argv < 2)
+    {
+        std::cout << "Usage: translator program.vmex [out.cpp]\n";
+        return 1;
+    }
+
+    std::string filepath = argc[1];
+    std::string out_filepath;
+
+    if (argv >= 3)
+    {
+        out_filepath = argc[2];
+    }
+    else
+    {
+        out_filepath = filepath.substr(0, filepath.find_last_of('.')) + ".cpp";
+    }
+
+    if (!translate_file(filepath, out_filepath)) return 1;
+
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,596 @@
+#include <iostream>
+#include <fstream>
+#include <set>
+
+#include "translate.hpp"
+
+#include "ISA.hpp"
+#include "syscall.hpp"
+#include "bytes.hpp"
+
+static const char* _register_name(uint8_t reg_id)
+{
+    static const char* names[REGISTER_COUNT] = {
+        "ax", "bx", "cx", "dx", "r4", "r5", "r6", "r7", "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15",
+        "fax", "fbx", "fcx", "f3", "f4", "f5", "f6", "f7", "f8", "f9", "f10", "f11", "f12", "f13", "f14", "f15"
+    };
+    return names[reg_id];
+}
+
+static const char* _vector_register_name(uint8_t reg_id)
+{
+    static const char* names[VECTOR_REGISTER_COUNT] = {"v0", "v1", "v2", "v3", "v4", "v5", "v6", "v7"};
+    return names[reg_id];
+}
+
+// Name of the simd.hpp function for a lane by lane vector operation, or nullptr
+static const char* _vector_operation(uint8_t opcode)
+{
+    switch (opcode)
+    {
+        case INSTR_VADD: return "vector_add_i32";
+        case INSTR_VSUB: return "vector_sub_i32";
+        case INSTR_VMUL: return "vector_mul_i32";
+        case INSTR_VMIN: return "vector_min_i32";
+        case INSTR_VMAX: return "vector_max_i32";
+        case INSTR_VCMPEQ: return "vector_cmpeq_i32";
+        case INSTR_VCMPGT: return "vector_cmpgt_i32";
+        case INSTR_VAND: return "vector_and";
+        case INSTR_VOR: return "vector_or";
+        case INSTR_VXOR: return "vector_xor";
+        case INSTR_VFADD: return "vector_add_f32";
+        case INSTR_VFSUB: return "vector_sub_f32";
+        case INSTR_VFMUL: return "vector_mul_f32";
+        case INSTR_VFMIN: return "vector_min_f32";
+        case INSTR_VFMAX: return "vector_max_f32";
+        case INSTR_VFCMPEQ: return "vector_cmpeq_f32";
+        case INSTR_VFCMPLT: return "vector_cmplt_f32";
+    }
+
+    return nullptr;
+}
+
+static bool _is_code_index(const DecodedProgram& decoded, uint32_t addr)
+{
+    return addr < decoded.addr_to_index.size() - 1 && decoded.index_from_addr(addr) != decoded.instructions.size() - 1;
+}
+
+static void _emit_goto(std::ostream& out, const DecodedProgram& decoded, uint32_t index)
+{
+    if (index == decoded.instructions.size() - 1)
+    {
+        out << "goto stop;";
+        return;
+    }
+
+    out << "goto addr_" << decoded.instructions[index].addr << ";";
+}
+
+// uint32_t expression for a loadx/storex address, wraps at 32 bits like the interpreter
+static std::string _memory_operand_addr(const DecodedInstruction& instr)
+{
+    std::string addr = "(uint32_t)(" + std::to_string(instr.imm) + "u";
+    if (instr.reg_b_id != MEMORY_OPERAND_NO_REG)
+    {
+        addr += std::string(" + ") + _register_name(instr.reg_b_id) + ".u";
+    }
+    if (instr.reg_c_id != MEMORY_OPERAND_NO_REG)
+    {
+        addr += std::string(" + (") + _register_name(instr.reg_c_id) + ".u << " + std::to_string(instr.target) + ")";
+    }
+    return addr + ")";
+}
+
+// PAIR()/SET_PAIR() arguments for the register pair starting at reg_id, the 64 bit value's type first
+static std::string _pair_operands(const char* type, uint8_t reg_id)
+{
+    return std::string(type) + ", " + _register_name(reg_id) + ", " + _register_name(reg_id + 1);
+}
+
+static void _emit_branch(std::ostream& out, const DecodedProgram& decoded, const DecodedInstruction& instr,
+    const char* field, const char* comparison)
+{
+    out << "if (" << _register_name(instr.reg_a_id) << "." << field << " " << comparison << " " <<
+        _register_name(instr.reg_b_id) << "." << field << ") { POLL_EVENTS_TICK(); ";
+    _emit_goto(out, decoded, instr.target);
+    out << " }";
+}
+
+bool _emit_instruction(std::ostream& out, const DecodedProgram& decoded, uint32_t index)
+{
+    const DecodedInstruction& instr = decoded.instructions[index];
+
+    // Vector register operands are named with _vector_register_name instead
+    const char* reg_a = instr.reg_a_id < REGISTER_COUNT ? _register_name(instr.reg_a_id) : "";
+    const char* reg_b = instr.reg_b_id < REGISTER_COUNT ? _register_name(instr.reg_b_id) : "";
+    const char* reg_c = instr.reg_c_id < REGISTER_COUNT ? _register_name(instr.reg_c_id) : "";
+
+    out << "    ";
+
+    if (const char* operation = _vector_operation(instr.opcode))
+    {
+        out << operation << "(" << _vector_register_name(instr.reg_a_id) << ", " << _vector_register_name(instr.reg_b_id) << ");\n";
+        return true;
+    }
+
+    switch (instr.opcode)
+    {
+        case INSTR_LOAD:
+            out << reg_a << ".u = load_int(&memory[" << reg_b << ".u]);";
+            break;
+        case INSTR_LOADS:
+            out << reg_a << ".u = load_int(&memory[base_ptr + " << instr.imm << "u]);";
+            break;
+        case INSTR_LOADC:
+            out << reg_a << ".u = " << instr.imm << "u;";
+            break;
+        case INSTR_LOADX:
+            out << reg_a << ".u = load_int(&memory[" << _memory_operand_addr(instr) << "]);";
+            break;
+        case INSTR_STOREX:
+            out << "write_int(&memory[" << _memory_operand_addr(instr) << "], " << reg_a << ".u);";
+            break;
+        case INSTR_LOADB:
+        case INSTR_LOADBI:
+        case INSTR_LOADH:
+        case INSTR_LOADHI:
+        case INSTR_LOADBX:
+        case INSTR_LOADBIX:
+        case INSTR_LOADHX:
+        case INSTR_LOADHIX:
+        {
+            std::string addr = instr.opcode >= INSTR_LOADBX ? _memory_operand_addr(instr) : std::string(reg_b) + ".u";
+            switch (instr.opcode)
+            {
+                case INSTR_LOADB: case INSTR_LOADBX: out << reg_a << ".u = (uint32_t)memory[" << addr << "];"; break;
+                case INSTR_LOADBI: case INSTR_LOADBIX: out << reg_a << ".u = (uint32_t)(int8_t)memory[" << addr << "];"; break;
+                case INSTR_LOADH: case INSTR_LOADHX: out << reg_a << ".u = (uint32_t)load_half(&memory[" << addr << "]);"; break;
+                default: out << reg_a << ".u = (uint32_t)(int16_t)load_half(&memory[" << addr << "]);"; break;
+            }
+            break;
+        }
+        case INSTR_STOREB:
+        case INSTR_STOREBX:
+        {
+            std::string addr = instr.opcode == INSTR_STOREBX ? _memory_operand_addr(instr) : std::string(reg_b) + ".u";
+            out << "memory[" << addr << "] = (uint8_t)" << reg_a << ".u;";
+            break;
+        }
+        case INSTR_STOREH:
+        case INSTR_STOREHX:
+        {
+            std::string addr = instr.opcode == INSTR_STOREHX ? _memory_operand_addr(instr) : std::string(reg_b) + ".u";
+            out << "write_half(&memory[" << addr << "], (uint16_t)" << reg_a << ".u);";
+            break;
+        }
+        case INSTR_STORE:
+            out << "write_int(&memory[" << reg_b << ".u], " << reg_a << ".u);";
+            break;
+        case INSTR_STORES:
+            out << "write_int(&memory[base_ptr + " << instr.imm << "u], " << reg_a << ".u);";
+            break;
+        case INSTR_XADD:
+        case INSTR_XCHG:
+        {
+            const char* operation = instr.opcode == INSTR_XADD ? "fetch_add" : "exchange";
+            out << "CHECK_ALIGNED(atomic_aligned(" << reg_b << ".u), " << reg_b << ".u, \"atomic\", " << instr.addr << "u); " <<
+                reg_a << ".u = atomic_int(&memory[" << reg_b << ".u])." << operation << "(" << reg_a << ".u);";
+            break;
+        }
+        case INSTR_CAS:
+        {
+            out << "{ CHECK_ALIGNED(atomic_aligned(" << reg_c << ".u), " << reg_c << ".u, \"atomic\", " << instr.addr << "u); " <<
+                "uint32_t expected = " << reg_a << ".u; atomic_int(&memory[" << reg_c << ".u]).compare_exchange_strong(" << reg_a << ".u, " << reg_b << ".u); " <<
+                "COMPARE(" << reg_a << ".u, expected); }";
+            break;
+        }
+        case INSTR_FENCE:
+            out << "std::atomic_thread_fence(std::memory_order_seq_cst);";
+            break;
+        case INSTR_COPY:
+        {
+            bool src_float = instr.reg_a_id >= REGISTER_FLOAT_START;
+            bool dest_float = instr.reg_b_id >= REGISTER_FLOAT_START;
+            if (!src_float && dest_float)
+            {
+                out << reg_b << ".f = (float)" << reg_a << ".u;";
+            }
+            else if (src_float && !dest_float)
+            {
+                out << reg_b << ".u = (uint32_t)" << reg_a << ".f;";
+            }
+            else
+            {
+                out << reg_b << " = " << reg_a << ";";
+            }
+            break;
+        }
+        case INSTR_ADD: out << "ax.u = " << reg_a << ".u + " << reg_b << ".u;"; break;
+        case INSTR_SUB: out << "ax.u = " << reg_a << ".u - " << reg_b << ".u;"; break;
+        case INSTR_MUL: out << "ax.u = " << reg_a << ".u * " << reg_b << ".u;"; break;
+        case INSTR_DIV: out << "ax.u = " << reg_a << ".u / " << reg_b << ".u;"; break;
+        case INSTR_IDIV: out << "ax.i = " << reg_a << ".i / " << reg_b << ".i;"; break;
+        case INSTR_SHL: out << "ax.u = " << reg_a << ".u << " << reg_b << ".u;"; break;
+        case INSTR_SHR: out << "ax.u = " << reg_a << ".u >> " << reg_b << ".u;"; break;
+        case INSTR_AND: out << "ax.u = " << reg_a << ".u & " << reg_b << ".u;"; break;
+        case INSTR_OR: out << "ax.u = " << reg_a << ".u | " << reg_b << ".u;"; break;
+        case INSTR_XOR: out << "ax.u = " << reg_a << ".u ^ " << reg_b << ".u;"; break;
+        case INSTR_NOT: out << "ax.u = " << reg_a << ".u;"; break; // Same as the interpreter
+        case INSTR_ADD_IMM: out << "ax.u = " << reg_a << ".u + " << instr.imm << "u;"; break;
+        case INSTR_SUB_IMM: out << "ax.u = " << reg_a << ".u - " << instr.imm << "u;"; break;
+        case INSTR_MUL_IMM: out << "ax.u = " << reg_a << ".u * " << instr.imm << "u;"; break;
+        case INSTR_DIV_IMM: out << "ax.u = " << reg_a << ".u / " << instr.imm << "u;"; break;
+        case INSTR_IDIV_IMM: out << "ax.i = " << reg_a << ".i / (int32_t)" << instr.imm << "u;"; break;
+        // Count masked like x86 (and the interpreter and JIT on it), a literal 32 or more would not compile cleanly
+        case INSTR_SHL_IMM: out << "ax.u = " << reg_a << ".u << " << (instr.imm & 31) << ";"; break;
+        case INSTR_SHR_IMM: out << "ax.u = " << reg_a << ".u >> " << (instr.imm & 31) << ";"; break;
+        case INSTR_AND_IMM: out << "ax.u = " << reg_a << ".u & " << instr.imm << "u;"; break;
+        case INSTR_OR_IMM: out << "ax.u = " << reg_a << ".u | " << instr.imm << "u;"; break;
+        case INSTR_XOR_IMM: out << "ax.u = " << reg_a << ".u ^ " << instr.imm << "u;"; break;
+        case INSTR_FADD: out << "fax.f = " << reg_a << ".f + " << reg_b << ".f;"; break;
+        case INSTR_FSUB: out << "fax.f = " << reg_a << ".f - " << reg_b << ".f;"; break;
+        case INSTR_FMUL: out << "fax.f = " << reg_a << ".f * " << reg_b << ".f;"; break;
+        case INSTR_FDIV: out << "fax.f = " << reg_a << ".f / " << reg_b << ".f;"; break;
+        case INSTR_ADD3: out << reg_a << ".u = " << reg_b << ".u + " << reg_c << ".u;"; break;
+        case INSTR_SUB3: out << reg_a << ".u = " << reg_b << ".u - " << reg_c << ".u;"; break;
+        case INSTR_MUL3: out << reg_a << ".u = " << reg_b << ".u * " << reg_c << ".u;"; break;
+        case INSTR_DIV3: out << reg_a << ".u = " << reg_b << ".u / " << reg_c << ".u;"; break;
+        case INSTR_IDIV3: out << reg_a << ".i = " << reg_b << ".i / " << reg_c << ".i;"; break;
+        case INSTR_SHL3: out << reg_a << ".u = " << reg_b << ".u << " << reg_c << ".u;"; break;
+        case INSTR_SHR3: out << reg_a << ".u = " << reg_b << ".u >> " << reg_c << ".u;"; break;
+        case INSTR_AND3: out << reg_a << ".u = " << reg_b << ".u & " << reg_c << ".u;"; break;
+        case INSTR_OR3: out << reg_a << ".u = " << reg_b << ".u | " << reg_c << ".u;"; break;
+        case INSTR_XOR3: out << reg_a << ".u = " << reg_b << ".u ^ " << reg_c << ".u;"; break;
+        case INSTR_FADD3: out << reg_a << ".f = " << reg_b << ".f + " << reg_c << ".f;"; break;
+        case INSTR_FSUB3: out << reg_a << ".f = " << reg_b << ".f - " << reg_c << ".f;"; break;
+        case INSTR_FMUL3: out << reg_a << ".f = " << reg_b << ".f * " << reg_c << ".f;"; break;
+        case INSTR_FDIV3: out << reg_a << ".f = " << reg_b << ".f / " << reg_c << ".f;"; break;
+        case INSTR_CMP: out << "COMPARE(" << reg_a << ".u, " << reg_b << ".u);"; break;
+        case INSTR_CMPI: out << "COMPARE(" << reg_a << ".i, " << reg_b << ".i);"; break;
+        case INSTR_CMPF: out << "COMPARE(" << reg_a << ".f, " << reg_b << ".f);"; break;
+        case INSTR_CMP_IMM: out << "COMPARE(" << reg_a << ".u, " << instr.imm << "u);"; break;
+        case INSTR_ADD64:
+        case INSTR_SUB64:
+        case INSTR_MUL64:
+        case INSTR_DIV64:
+        case INSTR_IDIV64:
+        case INSTR_DADD:
+        case INSTR_DSUB:
+        case INSTR_DMUL:
+        case INSTR_DDIV:
+        {
+            const char* type = "uint64_t";
+            if (instr.opcode == INSTR_IDIV64) type = "int64_t";
+            if (instr.opcode >= INSTR_DADD && instr.opcode <= INSTR_DDIV) type = "double";
+
+            const char* operation = "+";
+            switch (instr.opcode)
+            {
+                case INSTR_SUB64: case INSTR_DSUB: operation = "-"; break;
+                case INSTR_MUL64: case INSTR_DMUL: operation = "*"; break;
+                case INSTR_DIV64: case INSTR_IDIV64: case INSTR_DDIV: operation = "/"; break;
+            }
+
+            out << "SET_PAIR(" << _pair_operands(type, instr.reg_a_id) << ", PAIR(" << _pair_operands(type, instr.reg_b_id) <<
+                ") " << operation << " PAIR(" << _pair_operands(type, instr.reg_c_id) << "));";
+            break;
+        }
+        case INSTR_CMP64:
+            out << "COMPARE(PAIR(" << _pair_operands("uint64_t", instr.reg_a_id) << "), PAIR(" <<
+                _pair_operands("uint64_t", instr.reg_b_id) << "));";
+            break;
+        case INSTR_CMPI64:
+            out << "COMPARE(PAIR(" << _pair_operands("int64_t", instr.reg_a_id) << "), PAIR(" <<
+                _pair_operands("int64_t", instr.reg_b_id) << "));";
+            break;
+        case INSTR_DCMP:
+            out << "COMPARE(PAIR(" << _pair_operands("double", instr.reg_a_id) << "), PAIR(" <<
+                _pair_operands("double", instr.reg_b_id) << "));";
+            break;
+        case INSTR_FMIN: out << reg_a << ".f = " << reg_b << ".f < " << reg_c << ".f ? " << reg_b << ".f : " << reg_c << ".f;"; break;
+        case INSTR_FMAX: out << reg_a << ".f = " << reg_b << ".f > " << reg_c << ".f ? " << reg_b << ".f : " << reg_c << ".f;"; break;
+        case INSTR_FFMA: out << reg_a << ".f = std::fma(" << reg_b << ".f, " << reg_c << ".f, " << reg_a << ".f);"; break;
+        case INSTR_FSQRT: out << reg_a << ".f = std::sqrt(" << reg_b << ".f);"; break;
+        case INSTR_FABS: out << reg_a << ".f = std::fabs(" << reg_b << ".f);"; break;
+        case INSTR_FFLOOR: out << reg_a << ".f = std::floor(" << reg_b << ".f);"; break;
+        case INSTR_FSIN: out << reg_a << ".f = std::sin(" << reg_b << ".f);"; break;
+        case INSTR_FCOS: out << reg_a << ".f = std::cos(" << reg_b << ".f);"; break;
+        case INSTR_FTOD: out << "SET_PAIR(" << _pair_operands("double", instr.reg_a_id) << ", " << reg_b << ".f);"; break;
+        case INSTR_DTOF: out << reg_a << ".f = (float)PAIR(" << _pair_operands("double", instr.reg_b_id) << ");"; break;
+        case INSTR_CMPI_IMM: out << "COMPARE(" << reg_a << ".i, (int32_t)" << instr.imm << "u);"; break;
+        case INSTR_PUSH:
+            out << "write_int(&memory[stack_ptr], " << reg_a << ".u); stack_ptr += 4;";
+            break;
+        case INSTR_POP:
+            out << "stack_ptr -= 4; " << reg_a << ".u = load_int(&memory[stack_ptr]);";
+            break;
+        case INSTR_CALL:
+        {
+            // Return address is pushed as a byte address, same stack layout as the interpreter
+            out << "write_int(&memory[stack_ptr], " << decoded.instructions[index + 1].addr << "u); " <<
+                "write_int(&memory[stack_ptr + 4], base_ptr); stack_ptr += 8; base_ptr = stack_ptr - 8; POLL_EVENTS_TICK(); ";
+            _emit_goto(out, decoded, instr.target);
+            break;
+        }
+        case INSTR_RET:
+            out << "stack_ptr = base_ptr; return_addr = load_int(&memory[stack_ptr]); " <<
+                "base_ptr = load_int(&memory[stack_ptr + 4]); POLL_EVENTS_TICK(); goto return_dispatch;";
+            break;
+        case INSTR_TAILCALL:
+            out << "stack_ptr = base_ptr + 8; POLL_EVENTS_TICK(); ";
+            _emit_goto(out, decoded, instr.target);
+            break;
+        case INSTR_ENTER: out << "stack_ptr += " << instr.imm << "u;"; break;
+        case INSTR_LEAVE: out << "stack_ptr = base_ptr + 8;"; break;
+        case INSTR_SYSCALL:
+            out << "SYSCALL(" << (int)(uint8_t)instr.imm << ");";
+            break;
+        case INSTR_VLOAD:
+        case INSTR_VLOADA:
+        {
+            if (instr.opcode == INSTR_VLOADA)
+            {
+                out << "CHECK_ALIGNED(vector_aligned(" << reg_b << ".u), " << reg_b << ".u, \"vector\", " << instr.addr << "u); ";
+            }
+            out << "vector_load(" << _vector_register_name(instr.reg_a_id) << ", &memory[" << reg_b << ".u]);";
+            break;
+        }
+        case INSTR_VSTORE:
+        case INSTR_VSTOREA:
+        {
+            if (instr.opcode == INSTR_VSTOREA)
+            {
+                out << "CHECK_ALIGNED(vector_aligned(" << reg_b << ".u), " << reg_b << ".u, \"vector\", " << instr.addr << "u); ";
+            }
+            out << "vector_store(&memory[" << reg_b << ".u], " << _vector_register_name(instr.reg_a_id) << ");";
+            break;
+        }
+        case INSTR_VCOPY:
+            out << _vector_register_name(instr.reg_b_id) << " = " << _vector_register_name(instr.reg_a_id) << ";";
+            break;
+        case INSTR_VSPLAT:
+            out << "vector_splat(" << _vector_register_name(instr.reg_a_id) << ", " << reg_b << ".u);";
+            break;
+        case INSTR_VEXTRACT:
+            out << reg_a << ".u = " << _vector_register_name(instr.reg_b_id) << ".u[" << instr.imm << "];";
+            break;
+        case INSTR_VINSERT:
+            out << _vector_register_name(instr.reg_a_id) << ".u[" << instr.imm << "] = " << reg_b << ".u;";
+            break;
+        case INSTR_VSHUF:
+            out << "vector_shuffle(" << _vector_register_name(instr.reg_a_id) << ", " << _vector_register_name(instr.reg_b_id) <<
+                ", " << instr.imm << "u);";
+            break;
+        case INSTR_STOP:
+            out << "goto stop;";
+            break;
+        case INSTR_JMP:
+            out << "POLL_EVENTS_TICK(); ";
+            _emit_goto(out, decoded, instr.target);
+            break;
+        case INSTR_BEQ: _emit_branch(out, decoded, instr, "u", "=="); break;
+        case INSTR_BNE: _emit_branch(out, decoded, instr, "u", "!="); break;
+        case INSTR_BLT: _emit_branch(out, decoded, instr, "u", "<"); break;
+        case INSTR_BGE: _emit_branch(out, decoded, instr, "u", ">="); break;
+        case INSTR_BLTI: _emit_branch(out, decoded, instr, "i", "<"); break;
+        case INSTR_BGEI: _emit_branch(out, decoded, instr, "i", ">="); break;
+        case INSTR_BEQF: _emit_branch(out, decoded, instr, "f", "=="); break;
+        case INSTR_BNEF: _emit_branch(out, decoded, instr, "f", "!="); break;
+        case INSTR_BLTF: _emit_branch(out, decoded, instr, "f", "<"); break;
+        case INSTR_BGEF: _emit_branch(out, decoded, instr, "f", ">="); break;
+        case INSTR_JMPZ:
+        case INSTR_JMPS:
+        case INSTR_JMPC:
+        {
+            const char* flag = instr.opcode == INSTR_JMPZ ? "flag_zero" : (instr.opcode == INSTR_JMPS ? "flag_sign" : "flag_carry");
+            out << "if (" << flag << ") { POLL_EVENTS_TICK(); ";
+            _emit_goto(out, decoded, instr.target);
+            out << " }";
+            break;
+        }
+        default:
+        {
+            std::cout << "ERROR: Cannot translate instruction (" << (int)instr.opcode << ") at addr " << instr.addr << "\n";
+            return false;
+        }
+    }
+
+    out << "\n";
+
+    return true;
+}
+
+bool _emit_program(std::ostream& out, const std::string& source_name, const Executable& executable,
+    const DecodedProgram& decoded)
+{
+    const uint32_t data_size = executable.data.size();
+
+    const std::vector<DecodedInstruction>& instructions = decoded.instructions;
+    const uint32_t end_index = instructions.size() - 1;
+
+    // Instructions that can be reached other than by falling through need a label
+    std::set<uint32_t> labels;
+    labels.insert(decoded.entry_index);
+
+    for (uint32_t i = 0; i < end_index; i++)
+    {
+        const DecodedInstruction& instr = instructions[i];
+        switch (instr.opcode)
+        {
+            case INSTR_CALL:
+                labels.insert(i + 1);
+                labels.insert(instr.target);
+                break;
+            case INSTR_TAILCALL:
+            case INSTR_JMP:
+            case INSTR_JMPZ:
+            case INSTR_JMPS:
+            case INSTR_JMPC:
+            case INSTR_BEQ:
+            case INSTR_BNE:
+            case INSTR_BLT:
+            case INSTR_BGE:
+            case INSTR_BLTI:
+            case INSTR_BGEI:
+            case INSTR_BEQF:
+            case INSTR_BNEF:
+            case INSTR_BLTF:
+            case INSTR_BGEF:
+                labels.insert(instr.target);
+                break;
+            case INSTR_LOADC:
+                // Address of a code label, may be pushed and returned to
+                if (_is_code_index(decoded, instr.imm)) labels.insert(decoded.index_from_addr(instr.imm));
+                break;
+        }
+    }
+
+    labels.erase(end_index);
+
+    out << "// Translated from \"" << source_name << "\", do not edit\n";
+    out << "#include <cmath>\n\n";
+    out << "#include \"translated.hpp\"\n";
+    out << "#include \"bytes.hpp\"\n";
+    out << "#include \"atomic.hpp\"\n";
+    out << "#include \"simd.hpp\"\n\n";
+    out << "#if !VM_HEADLESS\n#include <SDL.h>\n#endif\n\n";
+
+    out << "static const uint8_t program_data[] = {";
+    for (uint32_t i = 0; i < data_size; i++)
+    {
+        if (i % 16 == 0) out << "\n    ";
+        out << (int)executable.data[i] << ",";
+    }
+    if (data_size == 0) out << "0";
+    out << "\n};\n\n";
+
+    out << "#define COMPARE(a, b) do { flag_zero = (a) == (b); flag_sign = !flag_zero && !((a) > (b)); flag_carry = 0; } while (0)\n";
+    out << "#define PAIR(type, lo, hi) std::bit_cast<type>((lo).u | (uint64_t)(hi).u << 32)\n";
+    out << "#define SET_PAIR(type, lo, hi, value) do { uint64_t pair_bits = std::bit_cast<uint64_t>((type)(value)); " <<
+        "(lo).u = (uint32_t)pair_bits; (hi).u = (uint32_t)(pair_bits >> 32); } while (0)\n";
+    out << "#define POLL_EVENTS_TICK() do { if (--poll_countdown == 0) { context.poll_countdown = 0; " <<
+        "TranslatedRuntime::poll_events_tick(context); poll_countdown = context.poll_countdown; } } while (0)\n";
+    out << "#define SYNC_TO_CONTEXT() do { ";
+    for (int i = 0; i < REGISTER_COUNT; i++) out << "context.registers[" << i << "] = " << _register_name(i) << "; ";
+    out << "context.stack_ptr = stack_ptr; context.base_ptr = base_ptr; context.poll_countdown = poll_countdown; " <<
+        "context.flag_zero = flag_zero; context.flag_sign = flag_sign; context.flag_carry = flag_carry; } while (0)\n";
+    out << "#define SYNC_FROM_CONTEXT() do { ";
+    for (int i = 0; i < REGISTER_COUNT; i++) out << _register_name(i) << " = context.registers[" << i << "]; ";
+    out << "stack_ptr = context.stack_ptr; base_ptr = context.base_ptr; poll_countdown = context.poll_countdown; " <<
+        "flag_zero = context.flag_zero; flag_sign = context.flag_sign; flag_carry = context.flag_carry; } while (0)\n";
+    out << "#define CHECK_ALIGNED(is_aligned, addr, kind, ip) do { if (!(is_aligned)) { " <<
+        "TranslatedRuntime::misaligned_access(kind, addr, ip); goto stop; } } while (0)\n";
+    out << "#define SYSCALL(id) do { SYNC_TO_CONTEXT(); TranslatedRuntime::syscall(context, id); SYNC_FROM_CONTEXT(); } while (0)\n\n";
+
+    out << "static void program_entry(TranslatedContext& context)\n{\n";
+    out << "    uint8_t* memory = context.memory;\n";
+    out << "    Register ";
+    for (int i = 0; i < REGISTER_COUNT; i++) out << (i ? ", " : "") << _register_name(i);
+    out << ";\n";
+    out << "    VectorRegister v0 = {}, v1 = {}, v2 = {}, v3 = {}, v4 = {}, v5 = {}, v6 = {}, v7 = {};\n";
+    out << "    uint32_t stack_ptr, base_ptr, poll_countdown;\n";
+    out << "    bool flag_zero, flag_sign, flag_carry;\n";
+    out << "    uint32_t return_addr = 0;\n\n";
+    out << "    SYNC_FROM_CONTEXT();\n";
+    out << "    if (context.entry_addr != " << instructions[decoded.entry_index].addr << "u) " <<
+        "{ return_addr = context.entry_addr; goto return_dispatch; }\n";
+    out << "    ";
+    _emit_goto(out, decoded, decoded.entry_index);
+    out << "\n\n";
+
+    for (uint32_t i = 0; i < end_index; i++)
+    {
+        if (labels.contains(i))
+        {
+            out << "addr_" << instructions[i].addr << ":\n";
+        }
+
+        if (!_emit_instruction(out, decoded, i)) return false;
+    }
+
+    // Return addresses (and spawned thread entries) are byte addresses, anything that is not a known label stops
+    // like the interpreter would
+    out << "    goto stop;\n\n";
+    out << "return_dispatch:\n";
+    out << "    switch (return_addr)\n    {\n";
+    for (uint32_t index : labels)
+    {
+        out << "        case " << instructions[index].addr << ": goto addr_" << instructions[index].addr << ";\n";
+    }
+    out << "        default: goto stop;\n";
+    out << "    }\n\n";
+
+    out << "stop:\n";
+    out << "    SYNC_TO_CONTEXT();\n";
+    out << "    (void)memory;\n";
+    out << "    (void)return_addr;\n";
+    out << "}\n\n";
+
+    out << "int main(int argc, char** argv)\n{\n";
+    out << "    VirtualMachine virtual_machine;\n\n";
+    out << "    TranslatedProgram program = {program_data, " << data_size << "u, " << executable.entry_addr <<
+        "u, program_entry, " << executable.isa_version << "u, " << executable.static_size() << "u};\n";
+    out << "    return TranslatedRuntime::run(virtual_machine, program) ? 0 : 1;\n";
+    out << "}\n";
+
+    return true;
+}
+
+bool translate_file(const std::string& filepath, const std::string& out_filepath)
+{
+    std::ifstream file(filepath, std::ios::binary);
+
+    if (!file.is_open())
+    {
+        std::cout << "ERROR: Could not open \"" << filepath << "\"\n";
+        return false;
+    }
+
+    std::vector<uint8_t> program((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    Executable executable;
+    if (!read_executable(program, executable))
+    {
+        return false;
+    }
+
+    uint32_t binary_isa_ver = executable.isa_version;
+    uint32_t binary_syscall_ver = executable.syscall_version;
+
+    if (binary_isa_ver < ISA_version_min || binary_isa_ver > ISA_version)
+    {
+        std::cout << "ERROR: Executable has unsupported ISA version\n Executable ISA: " << binary_isa_ver <<
+            "\n Translator ISA: " << ISA_version_min << " - " << ISA_version << "\n";
+        return false;
+    }
+
+    if (binary_syscall_ver != SYSCALL_version)
+    {
+        std::cout << "WARNING: Executable has different syscall version to translator\n Executable SYSCALL: " <<
+            binary_syscall_ver << "\n Translator SYSCALL: " << SYSCALL_version << "\n";
+    }
+
+    DecodedProgram decoded;
+    if (!decode_program(executable.code, binary_isa_ver, executable.code_start, executable.entry_addr, decoded))
+    {
+        std::cout << "ERROR: Could not decode program\n";
+        return false;
+    }
+
+    std::ofstream out_file(out_filepath);
+    if (!out_file.is_open())
+    {
+        std::cout << "ERROR: Could not open \"" << out_filepath << "\" for writing\n";
+        return false;
+    }
+
+    if (!_emit_program(out_file, filepath, executable, decoded))
+    {
+        std::cout << "ERROR: Could not translate program\n";
+        return false;
+    }
+
+    std::cout << "Translated file \"" << out_filepath << "\"\n";
+
+    return true;
+}
\ No newline at end of file
@@ -1,6 +1,9 @@
 #pragma once
 
-#define ISA_version 1
+#define ISA_version 2
+
+// Oldest executable version still loaded, version 1 had 4 int and 3 float registers
+#define ISA_version_min 1
 
 #define INSTR_LOAD 0x00
 #define INSTR_LOAD_STR "load"
@@ -11,12 +14,56 @@
 #define INSTR_LOADC 0x02
 #define INSTR_LOADC_STR "loadc"
 
+// load/store and their byte/halfword variants with a [base + index*scale + disp] operand, picked by the assembler.
+// Encoded as reg, base reg, index reg, scale (1/2/4/8), disp (4 bytes), a left out register is MEMORY_OPERAND_NO_REG
+#define INSTR_LOADX 0x03
+#define INSTR_STOREX 0x16
+#define INSTR_LOADBX 0x08
+#define INSTR_LOADBIX 0x09
+#define INSTR_LOADHX 0x0A
+#define INSTR_LOADHIX 0x0B
+#define INSTR_STOREBX 0x19
+#define INSTR_STOREHX 0x1A
+
+#define MEMORY_OPERAND_NO_REG 0xFF
+
+// Byte and halfword memory access, loads zero extend (i suffix sign extends) and stores write the low bits
+#define INSTR_LOADB 0x04
+#define INSTR_LOADB_STR "loadb"
+
+#define INSTR_LOADBI 0x05
+#define INSTR_LOADBI_STR "loadbi"
+
+#define INSTR_LOADH 0x06
+#define INSTR_LOADH_STR "loadh"
+
+#define INSTR_LOADHI 0x07
+#define INSTR_LOADHI_STR "loadhi"
+
+#define INSTR_STOREB 0x17
+#define INSTR_STOREB_STR "storeb"
+
+#define INSTR_STOREH 0x18
+#define INSTR_STOREH_STR "storeh"
+
 #define INSTR_STORE 0x10
 #define INSTR_STORE_STR "store"
 
 #define INSTR_STORES 0x11
 #define INSTR_STORES_STR "stores"
 
+#define INSTR_XADD 0x12
+#define INSTR_XADD_STR "xadd"
+
+#define INSTR_XCHG 0x13
+#define INSTR_XCHG_STR "xchg"
+
+#define INSTR_CAS 0x14
+#define INSTR_CAS_STR "cas"
+
+#define INSTR_FENCE 0x15
+#define INSTR_FENCE_STR "fence"
+
 #define INSTR_COPY 0x20
 #define INSTR_COPY_STR "copy"
 
@@ -53,6 +100,38 @@
 #define INSTR_NOT 0x3D
 #define INSTR_NOT_STR "not"
 
+// Immediate forms of the int operations above and the compares below, same result registers and flags.
+// No names of their own, the assembler picks them when the second operand is a literal or label.
+#define INSTR_ADD_IMM 0xB0
+#define INSTR_SUB_IMM 0xB1
+#define INSTR_MUL_IMM 0xB2
+#define INSTR_DIV_IMM 0xB3
+#define INSTR_IDIV_IMM 0xB7
+#define INSTR_SHL_IMM 0xB8
+#define INSTR_SHR_IMM 0xB9
+#define INSTR_AND_IMM 0xBA
+#define INSTR_OR_IMM 0xBB
+#define INSTR_XOR_IMM 0xBC
+#define INSTR_CMP_IMM 0x53
+#define INSTR_CMPI_IMM 0x54
+
+// Three register forms of the int and float operations, first register receives the result of the other two.
+// Also picked by the assembler, from the number of register operands.
+#define INSTR_ADD3 0xE0
+#define INSTR_SUB3 0xE1
+#define INSTR_MUL3 0xE2
+#define INSTR_DIV3 0xE3
+#define INSTR_IDIV3 0xE7
+#define INSTR_SHL3 0xE8
+#define INSTR_SHR3 0xE9
+#define INSTR_AND3 0xEA
+#define INSTR_OR3 0xEB
+#define INSTR_XOR3 0xEC
+#define INSTR_FADD3 0xF0
+#define INSTR_FSUB3 0xF1
+#define INSTR_FMUL3 0xF2
+#define INSTR_FDIV3 0xF3
+
 #define INSTR_FADD 0x40
 #define INSTR_FADD_STR "fadd"
 
@@ -65,6 +144,77 @@
 #define INSTR_FDIV 0x43
 #define INSTR_FDIV_STR "fdiv"
 
+// 64 bit int and double operations on register pairs, named by the even register which holds the low half.
+// Arithmetic writes the first pair, compares set flags like cmp/cmpi/cmpf.
+#define INSTR_ADD64 0x24
+#define INSTR_ADD64_STR "add64"
+
+#define INSTR_SUB64 0x25
+#define INSTR_SUB64_STR "sub64"
+
+#define INSTR_MUL64 0x26
+#define INSTR_MUL64_STR "mul64"
+
+#define INSTR_DIV64 0x27
+#define INSTR_DIV64_STR "div64"
+
+#define INSTR_IDIV64 0x28
+#define INSTR_IDIV64_STR "idiv64"
+
+#define INSTR_CMP64 0x55
+#define INSTR_CMP64_STR "cmp64"
+
+#define INSTR_CMPI64 0x56
+#define INSTR_CMPI64_STR "cmpi64"
+
+#define INSTR_DADD 0x44
+#define INSTR_DADD_STR "dadd"
+
+#define INSTR_DSUB 0x45
+#define INSTR_DSUB_STR "dsub"
+
+#define INSTR_DMUL 0x46
+#define INSTR_DMUL_STR "dmul"
+
+#define INSTR_DDIV 0x47
+#define INSTR_DDIV_STR "ddiv"
+
+#define INSTR_DCMP 0x57
+#define INSTR_DCMP_STR "dcmp"
+
+// Float register <-> double pair conversions
+#define INSTR_FTOD 0x48
+#define INSTR_FTOD_STR "ftod"
+
+#define INSTR_DTOF 0x49
+#define INSTR_DTOF_STR "dtof"
+
+// Float math, first register receives the result. ffma accumulates (first += second * third, rounded once),
+// fmin/fmax return the second operand if either is NaN like minss/maxss
+#define INSTR_FMIN 0xF4
+#define INSTR_FMIN_STR "fmin"
+
+#define INSTR_FMAX 0xF5
+#define INSTR_FMAX_STR "fmax"
+
+#define INSTR_FFMA 0xF6
+#define INSTR_FFMA_STR "ffma"
+
+#define INSTR_FSQRT 0x4A
+#define INSTR_FSQRT_STR "fsqrt"
+
+#define INSTR_FABS 0x4B
+#define INSTR_FABS_STR "fabs"
+
+#define INSTR_FFLOOR 0x4C
+#define INSTR_FFLOOR_STR "ffloor"
+
+#define INSTR_FSIN 0x4D
+#define INSTR_FSIN_STR "fsin"
+
+#define INSTR_FCOS 0x4E
+#define INSTR_FCOS_STR "fcos"
+
 #define INSTR_CMP 0x50
 #define INSTR_CMP_STR "cmp"
 
@@ -89,6 +239,96 @@
 #define INSTR_SYSCALL 0x64
 #define INSTR_SYSCALL_STR "syscall"
 
+// Jumps like call but keeps the current frame record and drops everything above it, the callee returns straight to
+// the caller of the current function. The assembler turns "call X" followed by "ret" into it
+#define INSTR_TAILCALL 0x65
+#define INSTR_TAILCALL_STR "tailcall"
+
+// enter N reserves N bytes of locals above the frame record (bp + 8 onwards), leave drops the locals again
+#define INSTR_ENTER 0x66
+#define INSTR_ENTER_STR "enter"
+
+#define INSTR_LEAVE 0x67
+#define INSTR_LEAVE_STR "leave"
+
+#define INSTR_VLOAD 0x80
+#define INSTR_VLOAD_STR "vload"
+
+#define INSTR_VLOADA 0x81
+#define INSTR_VLOADA_STR "vloada"
+
+#define INSTR_VSTORE 0x82
+#define INSTR_VSTORE_STR "vstore"
+
+#define INSTR_VSTOREA 0x83
+#define INSTR_VSTOREA_STR "vstorea"
+
+#define INSTR_VCOPY 0x84
+#define INSTR_VCOPY_STR "vcopy"
+
+#define INSTR_VSPLAT 0x85
+#define INSTR_VSPLAT_STR "vsplat"
+
+#define INSTR_VEXTRACT 0x86
+#define INSTR_VEXTRACT_STR "vextract"
+
+#define INSTR_VINSERT 0x87
+#define INSTR_VINSERT_STR "vinsert"
+
+#define INSTR_VSHUF 0x88
+#define INSTR_VSHUF_STR "vshuf"
+
+#define INSTR_VADD 0x90
+#define INSTR_VADD_STR "vadd"
+
+#define INSTR_VSUB 0x91
+#define INSTR_VSUB_STR "vsub"
+
+#define INSTR_VMUL 0x92
+#define INSTR_VMUL_STR "vmul"
+
+#define INSTR_VMIN 0x93
+#define INSTR_VMIN_STR "vmin"
+
+#define INSTR_VMAX 0x94
+#define INSTR_VMAX_STR "vmax"
+
+#define INSTR_VCMPEQ 0x95
+#define INSTR_VCMPEQ_STR "vcmpeq"
+
+#define INSTR_VCMPGT 0x96
+#define INSTR_VCMPGT_STR "vcmpgt"
+
+#define INSTR_VAND 0x98
+#define INSTR_VAND_STR "vand"
+
+#define INSTR_VOR 0x99
+#define INSTR_VOR_STR "vor"
+
+#define INSTR_VXOR 0x9A
+#define INSTR_VXOR_STR "vxor"
+
+#define INSTR_VFADD 0xA0
+#define INSTR_VFADD_STR "vfadd"
+
+#define INSTR_VFSUB 0xA1
+#define INSTR_VFSUB_STR "vfsub"
+
+#define INSTR_VFMUL 0xA2
+#define INSTR_VFMUL_STR "vfmul"
+
+#define INSTR_VFMIN 0xA3
+#define INSTR_VFMIN_STR "vfmin"
+
+#define INSTR_VFMAX 0xA4
+#define INSTR_VFMAX_STR "vfmax"
+
+#define INSTR_VFCMPEQ 0xA5
+#define INSTR_VFCMPEQ_STR "vfcmpeq"
+
+#define INSTR_VFCMPLT 0xA6
+#define INSTR_VFCMPLT_STR "vfcmplt"
+
 #define INSTR_STOP 0xFF
 #define INSTR_STOP_STR "stop"
 
@@ -102,4 +342,36 @@
 #define INSTR_JMPS_STR "jmps"
 
 #define INSTR_JMPC 0x73
-#define INSTR_JMPC_STR "jmpc"
\ No newline at end of file
+#define INSTR_JMPC_STR "jmpc"
+
+// Compare two registers and branch, flags are left untouched
+
+#define INSTR_BEQ 0x74
+#define INSTR_BEQ_STR "beq"
+
+#define INSTR_BNE 0x75
+#define INSTR_BNE_STR "bne"
+
+#define INSTR_BLT 0x76
+#define INSTR_BLT_STR "blt"
+
+#define INSTR_BGE 0x77
+#define INSTR_BGE_STR "bge"
+
+#define INSTR_BLTI 0x78
+#define INSTR_BLTI_STR "blti"
+
+#define INSTR_BGEI 0x79
+#define INSTR_BGEI_STR "bgei"
+
+#define INSTR_BEQF 0x7A
+#define INSTR_BEQF_STR "beqf"
+
+#define INSTR_BNEF 0x7B
+#define INSTR_BNEF_STR "bnef"
+
+#define INSTR_BLTF 0x7C
+#define INSTR_BLTF_STR "bltf"
+
+#define INSTR_BGEF 0x7D
+#define INSTR_BGEF_STR "bgef"
\ No newline at end of file
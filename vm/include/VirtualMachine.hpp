@@ -2,56 +2,284 @@
 
 #include <string>
 #include <vector>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <functional>
+#include <bit>
 
-#include <SDL.h>
+#include "decode.hpp"
+#include "executable.hpp"
+#include "ISA.hpp"
+#include "memory.hpp"
+#include "heap.hpp"
+#include "simd.hpp"
 
 #define MACHINE_STACK_SIZE 2 * 1024 * 1024
 
+// Stack given to a spawned guest thread when it does not ask for a size
+#define THREAD_STACK_SIZE 256 * 1024
+
+// Built without SDL, window syscalls behave as if no window could be created
+#ifndef VM_HEADLESS
+#define VM_HEADLESS 0
+#endif
+
+struct SDL_Window;
+struct SDL_Renderer;
+
+union Register
+{
+    uint32_t u;
+    int32_t i;
+    float f;
+};
+
 struct VirtualWindow
 {
     SDL_Window* window;
     SDL_Renderer* renderer;
 };
 
-class VirtualMachine
+enum class EventPollMode
 {
-public:
-    VirtualMachine();
+    // Poll every interval taken branches/calls/returns/syscalls
+    Branches,
 
-    bool load_program(const std::string& filepath);
+    // Poll at most once every interval microseconds
+    Microseconds,
 
-    void run();
+    // Only poll when a window syscall is made
+    WindowSyscall
+};
 
-private:
-    void reset_flags();
+struct EventPollPolicy
+{
+    EventPollMode mode = EventPollMode::Branches;
+    uint32_t interval = 1024;
+
+    // Skip polling entirely while no windows are open
+    bool only_with_windows = true;
+};
+
+struct MemoryConfig
+{
+    // Size of guest address space, only pages a program touches use real memory
+    uint32_t size = MACHINE_STACK_SIZE * 10;
 
-    void* get_register(uint8_t id);
+    // Stack starts on the page after program data and grows up, the heap starts after it.
+    // Both are separated from their neighbours by an inaccessible guard page.
+    uint32_t stack_size = MACHINE_STACK_SIZE;
+};
 
-    void dispatch_syscall(uint8_t id);
+// Registers and flags of one guest thread, everything else in the machine is shared between threads
+struct ThreadContext
+{
+    // ax..r15, fax..f15 (indexed by register id)
+    Register registers[REGISTER_COUNT] = {};
 
-    void process_instruction();
+    // v0 - v7
+    VectorRegister vectors[VECTOR_REGISTER_COUNT] = {};
 
-    uint32_t reg_a = 0;
-    uint32_t reg_b = 0;
-    uint32_t reg_c = 0;
-    uint32_t reg_d = 0;
     uint32_t reg_stack_ptr = 0;
     uint32_t reg_base_ptr = 0;
-    uint32_t reg_instruction_ptr = 0;
 
-    float reg_fa = 0;
-    float reg_fb = 0;
-    float reg_fc = 0;
+    // Index into decoded program
+    uint32_t reg_instruction_ptr = 0;
 
     bool flag_zero = 0;
     bool flag_sign = 0;
     bool flag_carry = 0;
 
-    std::vector<uint8_t> memory;
-    uint32_t heap_ptr;
+    uint32_t poll_countdown = 1;
+
+    // 0 for the main thread, which is the only one that polls window events
+    uint32_t thread_id = 0;
+
+    void reset_flags()
+    {
+        flag_zero = 0;
+        flag_sign = 0;
+        flag_carry = 0;
+    }
+
+    // 64 bit values (uint64_t, int64_t or double) live in an even/odd register pair, low half in the even register
+    template<typename T>
+    inline T pair(uint8_t reg_id) const
+    {
+        return std::bit_cast<T>(registers[reg_id].u | static_cast<uint64_t>(registers[reg_id + 1].u) << 32);
+    }
+
+    template<typename T>
+    inline void set_pair(uint8_t reg_id, T value)
+    {
+        uint64_t bits = std::bit_cast<uint64_t>(value);
+        registers[reg_id].u = static_cast<uint32_t>(bits);
+        registers[reg_id + 1].u = static_cast<uint32_t>(bits >> 32);
+    }
+
+    template<typename T>
+    inline void compare(T reg_a_value, T reg_b_value)
+    {
+        reset_flags();
+
+        if (reg_a_value == reg_b_value)
+        {
+            flag_zero = 1;
+        }
+        else
+        {
+            flag_sign = reg_a_value > reg_b_value ? 0 : 1;
+        }
+    }
+};
+
+// Runs a guest thread from entry_addr (a byte address) until it stops, returns false if it faulted.
+// The interpreter/JIT and translated programs each provide their own.
+typedef std::function<bool(ThreadContext& context, uint32_t entry_addr)> GuestThreadRunner;
+
+struct GuestThread
+{
+    ThreadContext context;
+    std::thread host_thread;
+
+    // Heap block holding the stack and its guard pages
+    uint32_t stack_block = 0;
+    uint32_t stack_start = 0;
+    uint32_t stack_end = 0;
+
+    bool joined = false;
+};
+
+// Everything loaded from an executable, never modified once built so machines running the same program can share it
+struct ProgramImage
+{
+    Executable executable;
+    DecodedProgram decoded_program;
+
+    uint32_t isa_version = ISA_version;
+    uint32_t entry_addr = 0;
+    uint32_t data_size = 0;
+
+    inline const uint8_t* data() const { return executable.data.data(); }
+};
+
+// Reads, checks and decodes an executable, returns null on failure
+std::shared_ptr<const ProgramImage> load_program_image(const std::string& filepath, bool fuse = true);
+
+class VirtualMachine
+{
+public:
+    VirtualMachine();
+    ~VirtualMachine();
+
+    bool load_program(const std::string& filepath);
+
+    // Shares an already loaded program, nothing is copied
+    void set_program(std::shared_ptr<const ProgramImage> image);
+
+    // Input is copied to the bottom of the stack before the program starts, with ax = job id, bx = input address
+    // and cx = input length (bx and cx are 0 without input)
+    void set_input(uint32_t job_id, const std::string& input);
+
+    // Returns false if the program could not start or was stopped by a memory fault
+    bool run();
+
+    // Print load and start up information (on by default)
+    void set_print_info(bool enabled);
+
+    void set_event_poll_policy(const EventPollPolicy& policy);
+
+    bool set_memory_config(const MemoryConfig& config);
+
+    // Print malloc/free statistics once the program stops
+    void set_heap_stats_enabled(bool enabled);
+
+    // Run hot basic blocks as native code, blocks are compiled once entered hot_threshold times
+    void enable_jit(uint32_t hot_threshold = 1);
+
+    // Replace common instruction pairs with super-instructions when loading (on by default)
+    void set_fusion_enabled(bool enabled);
+
+private:
+    void dispatch_syscall(ThreadContext& context, uint8_t id);
+
+    // Checked once per bulk memory syscall rather than per byte
+    bool check_memory_range(uint32_t addr, uint32_t size, const char* syscall_name);
+
+    void poll_events();
+
+    // Called from control transfers once poll_countdown reaches zero, polls according to policy
+    void poll_events_tick(ThreadContext& context);
+
+    void close_window(uint32_t window_id);
 
-    std::vector<uint8_t> program;
+    // Zeroes guest memory, copies in program data and sets up the stack
+    // Data is copied to address 0, the stack starts past static_size (data and bss)
+    bool reset_memory(const uint8_t* data, uint32_t data_size, uint32_t static_size);
+
+    // SDL video is only initialised once a program creates its first window
+    bool init_graphics();
+
+    // Runs decoded program from the context's current instruction until stop, or for one instruction if single_step
+    template<bool single_step>
+    void execute(ThreadContext& context);
+
+    void step(ThreadContext& context);
+
+    // Interpreter/JIT thread runner, also used for the main thread
+    bool run_thread(ThreadContext& context, uint32_t entry_addr);
+
+    // Returns thread id, or 0 if the thread could not be created
+    uint32_t spawn_thread(uint32_t entry_addr, uint32_t argument, uint32_t stack_size);
+
+    // Waits for the thread to stop and returns its ax, invalid or already joined threads return 0
+    uint32_t join_thread(ThreadContext& context, uint32_t thread_id);
+
+    // Anything the program left running is waited for before the machine is reset
+    void join_all_threads();
+
+    ThreadContext main_thread;
+
+    GuestMemory memory;
+    MemoryConfig memory_config;
+    uint32_t heap_ptr = 0;
+
+    GuestHeap heap{memory};
+    std::mutex heap_mutex;
+    bool heap_stats_enabled = false;
+
+    // Spawned threads by id - 1, ids are not reused within a run
+    std::vector<std::unique_ptr<GuestThread>> threads;
+    std::mutex thread_mutex;
+    GuestThreadRunner thread_runner;
+
+    std::shared_ptr<const ProgramImage> image;
+
+    // Register ids passed to syscalls are numbered by this version, see register_id_from_isa
+    uint32_t program_isa_version = ISA_version;
+
+    uint32_t job_id = 0;
+    std::string input;
+
+    bool print_info = true;
 
     std::vector<VirtualWindow> windows;
+    uint32_t open_window_count = 0;
+    bool graphics_initialised = false;
+
+    EventPollPolicy event_poll_policy;
+    std::chrono::steady_clock::time_point last_poll_time;
+
+    bool jit_enabled = false;
+    uint32_t jit_hot_threshold = 1;
+
+    bool fusion_enabled = true;
+
+    uint64_t instruction_count = 0;
+
+    friend class Jit;
+    friend class TranslatedRuntime;
 
 };
\ No newline at end of file
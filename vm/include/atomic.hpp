@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <bit>
+
+// Atomic instructions work on guest words in place, which only matches load_int/write_int on little endian hosts
+static_assert(std::endian::native == std::endian::little, "Guest atomics need a little endian host");
+
+// Atomic instructions need 4 byte aligned addresses, like the host instructions they map to
+inline bool atomic_aligned(uint32_t addr)
+{
+    return (addr & 3) == 0;
+}
+
+inline std::atomic_ref<uint32_t> atomic_int(uint8_t* bytes)
+{
+    return std::atomic_ref<uint32_t>(*reinterpret_cast<uint32_t*>(bytes));
+}
\ No newline at end of file
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <functional>
+
+#include "VirtualMachine.hpp"
+
+struct BatchStats
+{
+    uint64_t job_count = 0;
+    uint64_t failed_count = 0;
+    uint32_t thread_count = 0;
+    double seconds = 0.0;
+
+    // Wall clock time of every job in microseconds, sorted
+    std::vector<double> latencies;
+};
+
+// Applied to each worker's machine before its first job, returning false stops that worker
+typedef std::function<bool(VirtualMachine&)> BatchMachineSetup;
+
+// Runs one program once per input on a pool of threads. Every worker owns a machine (registers, memory, heap, JIT)
+// but all of them share the same read-only program image, jobs are handed out through a single atomic counter.
+class BatchRunner
+{
+public:
+    BatchRunner(std::shared_ptr<const ProgramImage> image, BatchMachineSetup setup);
+
+    // thread_count of 0 uses one thread per core
+    BatchStats run(const std::vector<std::string>& inputs, uint32_t thread_count = 0);
+
+    static void print_stats(const BatchStats& stats);
+
+private:
+    void worker(std::vector<double>& latencies);
+
+    std::shared_ptr<const ProgramImage> image;
+    BatchMachineSetup setup;
+
+    const std::vector<std::string>* inputs = nullptr;
+
+    std::atomic<uint64_t> next_job{0};
+    std::atomic<uint64_t> failed_count{0};
+};
\ No newline at end of file
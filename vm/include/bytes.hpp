@@ -22,4 +22,15 @@ inline void write_int(uint8_t* bytes, uint32_t value)
         bytes++;
         value = value >> 8;
     }
+}
+
+inline uint16_t load_half(uint8_t* bytes)
+{
+    return static_cast<uint16_t>(bytes[0] | (bytes[1] << 8));
+}
+
+inline void write_half(uint8_t* bytes, uint16_t value)
+{
+    bytes[0] = static_cast<uint8_t>(value & 0xFF);
+    bytes[1] = static_cast<uint8_t>(value >> 8);
 }
\ No newline at end of file
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+// 16 int registers followed by 16 float registers
+#define REGISTER_COUNT 32
+#define REGISTER_FLOAT_START 16
+
+// Version 1 executables only had ax..dx and fax..fcx, numbered 0 - 6
+#define ISA_V1_REGISTER_COUNT 7
+#define ISA_V1_REGISTER_FLOAT_START 4
+
+// 128 bit registers, a separate bank named by vector instructions only
+#define VECTOR_REGISTER_COUNT 8
+#define VECTOR_LANE_COUNT 4
+
+#define REG_ID_A 0
+#define REG_ID_B 1
+#define REG_ID_C 2
+#define REG_ID_D 3
+#define REG_ID_FA 16
+#define REG_ID_FB 17
+#define REG_ID_FC 18
+
+// VM internal super-instructions (0xC0 - 0xDF, never emitted by the assembler).
+// Each replaces the first instruction of a pair and executes both, the second is left in place so
+// jumps into the middle of a pair still work.
+#define FUSED_LOADC_ADD 0xC0
+#define FUSED_LOADC_SUB 0xC1
+#define FUSED_LOADC_MUL 0xC2
+#define FUSED_LOADC_SHL 0xC3
+#define FUSED_LOADC_SHR 0xC4
+#define FUSED_LOADC_AND 0xC5
+#define FUSED_LOADC_OR 0xC6
+#define FUSED_LOADC_XOR 0xC7
+#define FUSED_LOADC_LOAD 0xC8
+#define FUSED_LOADC_PUSH 0xC9
+#define FUSED_PUSH_POP 0xCA
+#define FUSED_POP_POP 0xCB
+#define FUSED_CMP_JMPZ 0xD0
+#define FUSED_CMP_JMPS 0xD1
+#define FUSED_CMPI_JMPZ 0xD2
+#define FUSED_CMPI_JMPS 0xD3
+#define FUSED_CMPF_JMPZ 0xD4
+#define FUSED_CMPF_JMPS 0xD5
+#define FUSED_CMP_IMM_JMPZ 0xD6
+#define FUSED_CMP_IMM_JMPS 0xD7
+#define FUSED_CMPI_IMM_JMPZ 0xD8
+#define FUSED_CMPI_IMM_JMPS 0xD9
+
+// Fixed width instruction, built once at load time so the interpreter never touches operand bytes
+struct alignas(16) DecodedInstruction
+{
+    uint8_t opcode;
+    uint8_t reg_a_id;
+    uint8_t reg_b_id;
+    uint8_t reg_c_id;
+
+    // Immediate value / stack offset / syscall id / vector lane or shuffle selector
+    uint32_t imm;
+
+    // Decoded index of jump/call target / index shift of a memory operand
+    uint32_t target;
+
+    // Byte address of instruction in executable
+    uint32_t addr;
+};
+
+struct DecodedProgram
+{
+    // Always terminated by a stop instruction placed at the end of the executable
+    std::vector<DecodedInstruction> instructions;
+
+    // Byte address -> decoded index, addresses not on an instruction boundary map to the terminating stop
+    std::vector<uint32_t> addr_to_index;
+
+    uint32_t entry_index = 0;
+
+    inline uint32_t index_from_addr(uint32_t addr) const
+    {
+        if (addr >= addr_to_index.size()) return addr_to_index.back();
+        return addr_to_index[addr];
+    }
+};
+
+// Maps a register id as numbered by an executable of the given ISA version to the current register file,
+// returns REGISTER_COUNT for ids that version did not have
+inline uint32_t register_id_from_isa(uint32_t isa_version, uint32_t reg_id)
+{
+    if (isa_version != 1) return reg_id;
+    if (reg_id >= ISA_V1_REGISTER_COUNT) return REGISTER_COUNT;
+    if (reg_id >= ISA_V1_REGISTER_FLOAT_START) return reg_id - ISA_V1_REGISTER_FLOAT_START + REGISTER_FLOAT_START;
+    return reg_id;
+}
+
+// Returns encoded size of instruction in bytes, or 0 if opcode is unknown
+uint32_t instruction_encoded_size(uint8_t opcode);
+
+// Replaces common instruction pairs with super-instructions
+void fuse_instructions(DecodedProgram& program);
+
+// Returns the original first instruction of a super-instruction (or the instruction itself)
+DecodedInstruction unfuse_instruction(const DecodedInstruction& instr);
+
+// Register operands are renumbered from the executable's ISA version, see register_id_from_isa
+bool decode_program(const std::vector<uint8_t>& program, uint32_t isa_version, uint32_t code_start, uint32_t entry_addr,
+    DecodedProgram& decoded_out);
\ No newline at end of file
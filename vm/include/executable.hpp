@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <utility>
+
+// Version 1 executables are a 16 byte header (ISA version, syscall version, entry addr, data size) followed by data
+// and code in one blob, code is addressed by file offset
+#define BYTECODE_HEADER_SIZE 16
+
+// Version 2 executables start with a header and a table of sections:
+//   magic (4) | format version (4) | ISA version (4) | syscall version (4) | entry addr (4) | section count (4) | 0 (8)
+//   per section: type (4) | file offset (4) | size (4) | addr (4)
+// Code and data bytes start on a page boundary in the file, so they can be mapped straight from it.
+// Code addresses are the code section's addr plus the offset into it, data sits at guest address 0 and the zero
+// filled bss at its section's addr. Sections of unknown type are skipped.
+#define EXECUTABLE_MAGIC 0x58454D56
+#define EXECUTABLE_FORMAT_VERSION 2
+#define EXECUTABLE_HEADER_SIZE 32
+#define EXECUTABLE_SECTION_ENTRY_SIZE 16
+#define EXECUTABLE_SECTION_ALIGN 4096
+
+// Code starts past 0, so the zero return address of a thread's outermost frame never names an instruction
+#define EXECUTABLE_CODE_ADDR 16
+
+#define SECTION_CODE 1
+#define SECTION_DATA 2
+#define SECTION_BSS 3
+// addr (4) | kind (1) | name length (1) | name, per label or data name
+#define SECTION_SYMBOLS 4
+// code addr (4) | source line (4), per instruction, written by "assembler -g"
+#define SECTION_DEBUG_LINES 5
+
+#define SYMBOL_CODE 0
+#define SYMBOL_DATA 1
+
+struct ExecutableSymbol
+{
+    std::string name;
+    uint32_t addr;
+    uint8_t kind;
+};
+
+struct Executable
+{
+    uint32_t format_version = EXECUTABLE_FORMAT_VERSION;
+    uint32_t isa_version = 0;
+    uint32_t syscall_version = 0;
+    uint32_t entry_addr = 0;
+
+    // Instructions are decoded from code_start to the end, instruction addresses index into code
+    std::vector<uint8_t> code;
+    uint32_t code_start = 0;
+
+    // Copied to guest address 0, bss_size zero filled bytes follow at bss_addr
+    std::vector<uint8_t> data;
+    uint32_t bss_addr = 0;
+    uint32_t bss_size = 0;
+
+    std::vector<ExecutableSymbol> symbols;
+
+    // Code address and source line, sorted by address
+    std::vector<std::pair<uint32_t, uint32_t>> debug_lines;
+
+    // Guest bytes taken by data and bss, the stack is placed after them
+    inline uint32_t static_size() const { return bss_size ? bss_addr + bss_size : data.size(); }
+
+    // "label+offset, line n" for a code address, parts without symbols or debug lines are left out
+    std::string describe_code_addr(uint32_t addr) const;
+};
+
+// Splits a version 1 or 2 file into its sections, ISA and syscall versions are left to the caller to check
+bool read_executable(const std::vector<uint8_t>& file, Executable& out);
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <utility>
+
+#include "memory.hpp"
+
+// Blocks with payloads up to this size come from segregated free lists and are never coalesced
+#define HEAP_SMALL_MAX 256
+#define HEAP_SMALL_CLASSES (HEAP_SMALL_MAX / 8)
+
+#define HEAP_LARGE_BINS 32
+
+struct HeapStats
+{
+    uint64_t alloc_count = 0;
+    uint64_t free_count = 0;
+    uint64_t failed_count = 0;
+
+    // Block bytes (including headers) currently allocated, and the most ever allocated at once
+    uint64_t bytes_in_use = 0;
+    uint64_t bytes_peak = 0;
+
+    // Bytes sitting in free lists, the rest of the heap is either in use or untouched
+    uint64_t bytes_free = 0;
+};
+
+// Allocator for the malloc/free syscalls, lives entirely inside guest memory between heap_start and heap_end.
+// Every block has an 8 byte header (size + flags, size of the block before it), free blocks keep their list
+// links in the payload. Both malloc and free are O(1) apart from first fit within a single large bin.
+// Headers and links can be overwritten by the guest, so every block reached through them is checked to lie inside the
+// heap and clear of guard pages before it is touched. A corrupted heap makes malloc fail and free leak rather than
+// fault on the host, where the fault would leave the caller's heap lock held.
+class GuestHeap
+{
+public:
+    GuestHeap(GuestMemory& memory);
+
+    void reset(uint32_t heap_start, uint32_t heap_end);
+
+    // Returns guest address of payload, or 0 if the heap is exhausted
+    uint32_t allocate(uint32_t size);
+
+    // Invalid pointers are reported and ignored, 0 is a no-op
+    void free(uint32_t addr);
+
+    // Guard pages inside an allocated block (thread stacks), protected in guest memory and never read by the heap.
+    // The block holding them can't be freed until they are unprotected again
+    void protect(uint32_t addr, uint32_t size);
+    void unprotect(uint32_t addr, uint32_t size);
+
+    const HeapStats& get_stats() const { return stats; }
+
+    void print_stats() const;
+
+private:
+    uint32_t allocate_small(uint32_t class_index);
+    uint32_t allocate_large(uint32_t block_size);
+
+    // Takes block_size bytes from the untouched top of the heap, returns block address or 0
+    uint32_t carve(uint32_t block_size, uint32_t flags);
+
+    void large_insert(uint32_t block, uint32_t block_size);
+    bool large_unlink(uint32_t block);
+
+    // Block starts inside the carved part of the heap with a readable header, and its size does not run past heap_top
+    bool valid_block(uint32_t block) const;
+
+    // As valid_block, and the whole block is clear of guard pages so it can be split and merged
+    bool valid_free_block(uint32_t block) const;
+
+    // [addr, addr + size) overlaps a guard page
+    bool guarded(uint32_t addr, uint32_t size) const;
+    void report_corruption(uint32_t block) const;
+
+    inline uint32_t read(uint32_t addr) const;
+    inline void write(uint32_t addr, uint32_t value);
+
+    void mark_used(uint32_t block_size);
+
+    GuestMemory& memory;
+
+    uint32_t heap_start = 0;
+    uint32_t heap_end = 0;
+
+    // Everything from heap_top to heap_end has never been handed out
+    uint32_t heap_top = 0;
+    uint32_t top_prev_size = 0;
+
+    uint32_t small_free[HEAP_SMALL_CLASSES] = {};
+
+    uint32_t large_bins[HEAP_LARGE_BINS] = {};
+    uint32_t large_bin_mask = 0;
+
+    // Address and size of each protected range
+    std::vector<std::pair<uint32_t, uint32_t>> guard_ranges;
+
+    HeapStats stats;
+};
\ No newline at end of file
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <unordered_map>
+
+#include "decode.hpp"
+
+class VirtualMachine;
+struct ThreadContext;
+union VectorRegister;
+
+// Guest state while running native code, layout is referenced by generated code through offsetof
+struct JitState
+{
+    uint32_t registers[REGISTER_COUNT];
+    uint32_t stack_ptr;
+    uint32_t base_ptr;
+    uint32_t poll_countdown;
+
+    uint8_t flag_zero;
+    uint8_t flag_sign;
+    uint8_t flag_carry;
+
+    // Highest valid index into addr_to_index, return addresses beyond it are clamped
+    uint32_t addr_last;
+
+    uint8_t* memory;
+    void** block_table;
+    const uint32_t* addr_to_index;
+
+    // The thread's vector registers, used in place rather than copied in and out
+    VectorRegister* vectors;
+};
+
+// Baseline template JIT for x86-64 Linux, translates basic blocks of the decoded program to native code.
+// Guest registers live in host registers inside compiled code, blocks are chained with direct jumps and
+// syscalls (or anything without a template) fall back to single stepping the interpreter.
+class Jit
+{
+public:
+    Jit(VirtualMachine& vm, ThreadContext& context, uint32_t hot_threshold);
+    ~Jit();
+
+    static bool is_supported();
+
+    // Runs the loaded program from the thread's current instruction until stop
+    void execute();
+
+    // Decoded index of the instruction whose native code contains pc, or UINT32_MAX
+    uint32_t guest_index_from_host_pc(uintptr_t pc) const;
+
+private:
+    typedef uint32_t (*EntryFunction)(JitState* state, const void* code);
+
+    bool is_translatable(uint8_t opcode) const;
+
+    // Returns native code for block starting at ip, or nullptr if the code buffer is full
+    void* compile_block(uint32_t ip);
+
+    void emit_trampolines();
+
+    // mprotect for the pages holding [start, end) of the code buffer, false if the host refused (e.g. no PROT_EXEC)
+    bool protect_code(const uint8_t* start, const uint8_t* end, int prot);
+
+    // Drops all compiled code and stops compiling, the interpreter runs everything from then on
+    void disable_code_buffer();
+
+    void save_state();
+    void load_state();
+
+    VirtualMachine& vm;
+    ThreadContext& context;
+    uint32_t hot_threshold;
+
+    uint8_t* code_buffer = nullptr;
+    size_t code_buffer_size = 0;
+    size_t code_buffer_top = 0;
+    bool code_buffer_full = false;
+
+    EntryFunction entry = nullptr;
+    uint8_t* common_exit = nullptr;
+
+    JitState state = {};
+
+    std::vector<void*> block_table;
+    std::vector<uint32_t> block_counts;
+
+    // Exit sites waiting to be patched into direct jumps once their target block is compiled.
+    // Pages up to the one holding code_buffer_top are executable, the rest of the buffer is writable
+    std::unordered_map<uint32_t, std::vector<uint8_t*>> pending_chains;
+
+    // (code buffer offset, decoded index) for every translated instruction, in emission order
+    std::vector<std::pair<uint32_t, uint32_t>> host_pc_map;
+};
\ No newline at end of file
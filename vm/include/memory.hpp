@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The whole 32 bit guest address space (plus room for a 16 byte vector access at the last address) is reserved up front,
+// so guest addresses never need a bounds check. Anything outside the committed region faults.
+#if (defined(__unix__) || defined(__APPLE__)) && UINTPTR_MAX > 0xFFFFFFFF
+#define GUEST_MEMORY_GUARDED 1
+#else
+#define GUEST_MEMORY_GUARDED 0
+#endif
+
+// Guest address space backed by an anonymous mapping, pages are only zero filled (and resident) once touched
+class GuestMemory
+{
+public:
+    GuestMemory() = default;
+    ~GuestMemory();
+
+    GuestMemory(const GuestMemory&) = delete;
+    GuestMemory& operator=(const GuestMemory&) = delete;
+
+    // Replaces any existing mapping, the first size bytes are usable and start zeroed
+    bool allocate(size_t size);
+
+    void release();
+
+    // Zeroes all memory by giving pages back to the OS rather than writing to them, also removes guard pages
+    void reset();
+
+    // Makes the pages covering [addr, addr + size) inaccessible, addr and size must be page aligned
+    void protect(uint32_t addr, uint32_t size);
+
+    // Makes protected pages readable and writable again
+    void unprotect(uint32_t addr, uint32_t size);
+
+    static uint32_t page_size();
+
+    // True if ptr is anywhere in the reservation, including the inaccessible part
+    inline bool contains(const void* ptr) const
+    {
+        return ptr >= base && ptr < base + reserved_size;
+    }
+
+    inline uint8_t* data() { return base; }
+    inline const uint8_t* data() const { return base; }
+    inline size_t size() const { return mapped_size; }
+
+    inline uint8_t& operator[](size_t addr) { return base[addr]; }
+    inline const uint8_t& operator[](size_t addr) const { return base[addr]; }
+
+private:
+    uint8_t* base = nullptr;
+    size_t mapped_size = 0;
+    size_t reserved_size = 0;
+};
\ No newline at end of file
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <bit>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define VECTOR_SSE2 1
+#include <emmintrin.h>
+#else
+#define VECTOR_SSE2 0
+#endif
+
+#if defined(__SSE4_1__)
+#define VECTOR_SSE41 1
+#include <smmintrin.h>
+#else
+#define VECTOR_SSE41 0
+#endif
+
+// Vector lanes are loaded straight from guest memory, which only matches load_int/write_int on little endian hosts
+static_assert(std::endian::native == std::endian::little, "Guest vectors need a little endian host");
+
+// 4 x 32 bit lanes, lane 0 at the lowest address when loaded from memory
+union alignas(16) VectorRegister
+{
+    uint32_t u[4];
+    int32_t i[4];
+    float f[4];
+};
+
+// Aligned vector loads and stores need 16 byte aligned addresses
+inline bool vector_aligned(uint32_t addr)
+{
+    return (addr & 15) == 0;
+}
+
+inline void vector_load(VectorRegister& dst, const uint8_t* bytes)
+{
+    memcpy(&dst, bytes, sizeof(VectorRegister));
+}
+
+inline void vector_store(uint8_t* bytes, const VectorRegister& src)
+{
+    memcpy(bytes, &src, sizeof(VectorRegister));
+}
+
+inline void vector_splat(VectorRegister& dst, uint32_t bits)
+{
+    for (int lane = 0; lane < 4; lane++) dst.u[lane] = bits;
+}
+
+// Lane n of dst is lane (selector >> 2n) & 3 of src, same selector layout as pshufd
+inline void vector_shuffle(VectorRegister& dst, const VectorRegister& src, uint32_t selector)
+{
+    VectorRegister result;
+    for (int lane = 0; lane < 4; lane++) result.u[lane] = src.u[(selector >> (lane * 2)) & 3];
+    dst = result;
+}
+
+#if VECTOR_SSE2
+inline __m128i _vector_int(const VectorRegister& v) { return _mm_load_si128(reinterpret_cast<const __m128i*>(&v)); }
+inline __m128 _vector_float(const VectorRegister& v) { return _mm_load_ps(v.f); }
+inline void _vector_set(VectorRegister& v, __m128i value) { _mm_store_si128(reinterpret_cast<__m128i*>(&v), value); }
+inline void _vector_set(VectorRegister& v, __m128 value) { _mm_store_ps(v.f, value); }
+#endif
+
+// vector_<name>(a, b) does a = a op b lane by lane, with SSE when the host compiler targets it and plain loops
+// otherwise. Both give identical results, including for NaN in min/max/compare (minps/maxps return b unless a wins).
+#define VECTOR_OP_LANES(name, lane_expr) \
+    inline void vector_##name(VectorRegister& a, const VectorRegister& b) { for (int lane = 0; lane < 4; lane++) { lane_expr; } }
+
+#if VECTOR_SSE2
+#define VECTOR_OP(name, sse_expr, lane_expr) \
+    inline void vector_##name(VectorRegister& a, const VectorRegister& b) { _vector_set(a, sse_expr); }
+#else
+#define VECTOR_OP(name, sse_expr, lane_expr) VECTOR_OP_LANES(name, lane_expr)
+#endif
+
+// pmulld/pminsd/pmaxsd are SSE4.1
+#if VECTOR_SSE41
+#define VECTOR_OP_SSE41(name, sse_expr, lane_expr) VECTOR_OP(name, sse_expr, lane_expr)
+#else
+#define VECTOR_OP_SSE41(name, sse_expr, lane_expr) VECTOR_OP_LANES(name, lane_expr)
+#endif
+
+#define VECTOR_MASK(condition) ((condition) ? 0xFFFFFFFFu : 0u)
+
+VECTOR_OP(add_i32, _mm_add_epi32(_vector_int(a), _vector_int(b)), a.u[lane] += b.u[lane])
+VECTOR_OP(sub_i32, _mm_sub_epi32(_vector_int(a), _vector_int(b)), a.u[lane] -= b.u[lane])
+VECTOR_OP_SSE41(mul_i32, _mm_mullo_epi32(_vector_int(a), _vector_int(b)), a.u[lane] *= b.u[lane])
+VECTOR_OP_SSE41(min_i32, _mm_min_epi32(_vector_int(a), _vector_int(b)), a.i[lane] = std::min(a.i[lane], b.i[lane]))
+VECTOR_OP_SSE41(max_i32, _mm_max_epi32(_vector_int(a), _vector_int(b)), a.i[lane] = std::max(a.i[lane], b.i[lane]))
+VECTOR_OP(cmpeq_i32, _mm_cmpeq_epi32(_vector_int(a), _vector_int(b)), a.u[lane] = VECTOR_MASK(a.u[lane] == b.u[lane]))
+VECTOR_OP(cmpgt_i32, _mm_cmpgt_epi32(_vector_int(a), _vector_int(b)), a.u[lane] = VECTOR_MASK(a.i[lane] > b.i[lane]))
+VECTOR_OP(and, _mm_and_si128(_vector_int(a), _vector_int(b)), a.u[lane] &= b.u[lane])
+VECTOR_OP(or, _mm_or_si128(_vector_int(a), _vector_int(b)), a.u[lane] |= b.u[lane])
+VECTOR_OP(xor, _mm_xor_si128(_vector_int(a), _vector_int(b)), a.u[lane] ^= b.u[lane])
+
+VECTOR_OP(add_f32, _mm_add_ps(_vector_float(a), _vector_float(b)), a.f[lane] += b.f[lane])
+VECTOR_OP(sub_f32, _mm_sub_ps(_vector_float(a), _vector_float(b)), a.f[lane] -= b.f[lane])
+VECTOR_OP(mul_f32, _mm_mul_ps(_vector_float(a), _vector_float(b)), a.f[lane] *= b.f[lane])
+VECTOR_OP(min_f32, _mm_min_ps(_vector_float(a), _vector_float(b)), a.f[lane] = a.f[lane] < b.f[lane] ? a.f[lane] : b.f[lane])
+VECTOR_OP(max_f32, _mm_max_ps(_vector_float(a), _vector_float(b)), a.f[lane] = a.f[lane] > b.f[lane] ? a.f[lane] : b.f[lane])
+VECTOR_OP(cmpeq_f32, _mm_cmpeq_ps(_vector_float(a), _vector_float(b)), a.u[lane] = VECTOR_MASK(a.f[lane] == b.f[lane]))
+VECTOR_OP(cmplt_f32, _mm_cmplt_ps(_vector_float(a), _vector_float(b)), a.u[lane] = VECTOR_MASK(a.f[lane] < b.f[lane]))
+
+#undef VECTOR_MASK
+#undef VECTOR_OP_SSE41
+#undef VECTOR_OP
+#undef VECTOR_OP_LANES
\ No newline at end of file
@@ -1,6 +1,6 @@
 #pragma once
 
-#define SYSCALL_version 2
+#define SYSCALL_version 5
 
 #define SYSCALL_ID_WAIT 0x10
 
@@ -8,6 +8,12 @@
 #define SYSCALL_ID_FREE 0x21
 #define SYSCALL_ID_MEMSET 0x22
 #define SYSCALL_ID_MEMCPY 0x23
+#define SYSCALL_ID_MEMMOVE 0x24
+#define SYSCALL_ID_MEMCMP 0x25
+#define SYSCALL_ID_MEMCHR 0x26
+
+#define SYSCALL_ID_THREAD_SPAWN 0x30
+#define SYSCALL_ID_THREAD_JOIN 0x31
 
 #define SYSCALL_ID_PRINTF 0x40
 #define SYSCALL_ID_PRINTREG 0x41
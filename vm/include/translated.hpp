@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "VirtualMachine.hpp"
+
+// Guest state handed to programs produced by the translator, only synced with the thread's context around syscalls and polls
+struct TranslatedContext
+{
+    Register registers[REGISTER_COUNT];
+    uint32_t stack_ptr;
+    uint32_t base_ptr;
+    uint32_t poll_countdown;
+
+    bool flag_zero;
+    bool flag_sign;
+    bool flag_carry;
+
+    // Byte address the thread starts at, the program's entry for the main thread
+    uint32_t entry_addr;
+
+    uint8_t* memory;
+    VirtualMachine* vm;
+    ThreadContext* thread;
+};
+
+// Emitted by the translator, returns once the guest program stops
+typedef void (*TranslatedEntryFunction)(TranslatedContext& context);
+
+struct TranslatedProgram
+{
+    const uint8_t* data;
+    uint32_t data_size;
+    uint32_t entry_addr;
+    TranslatedEntryFunction entry;
+
+    // ISA version of the translated executable, register ids passed to syscalls are numbered by it
+    uint32_t isa_version;
+
+    // Guest bytes taken by data and zero filled bss
+    uint32_t static_size;
+};
+
+// Runtime for ahead-of-time translated programs, memory, syscalls and windows are provided by the VM
+class TranslatedRuntime
+{
+public:
+    // False if the main thread faulted or the program did not fit in guest memory
+    static bool run(VirtualMachine& vm, const TranslatedProgram& program);
+
+    static void syscall(TranslatedContext& context, uint8_t id);
+
+    static void poll_events_tick(TranslatedContext& context);
+
+    // Reports a misaligned atomic or vector access, the generated code then stops the thread
+    static void misaligned_access(const char* kind, uint32_t addr, uint32_t instr_addr);
+
+private:
+    // Used for the main thread and every thread the program spawns
+    static bool run_thread(VirtualMachine& vm, const TranslatedProgram& program, ThreadContext& thread, uint32_t entry_addr);
+
+    static void sync_to_thread(const TranslatedContext& context);
+    static void sync_from_thread(TranslatedContext& context);
+};
\ No newline at end of file
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "memory.hpp"
+
+#if GUEST_MEMORY_GUARDED
+#include <setjmp.h>
+#endif
+
+// Host fault on guest memory, turned into a guest trap instead of crashing the process
+struct GuestTrap
+{
+    #if GUEST_MEMORY_GUARDED
+    sigjmp_buf env;
+    #endif
+
+    const GuestMemory* memory = nullptr;
+
+    // Filled in by the signal handler before jumping back
+    uint32_t fault_addr = 0;
+    uintptr_t fault_pc = 0;
+};
+
+// Makes trap the target for guest memory faults on the calling thread
+void trap_enter(GuestTrap& trap);
+void trap_leave();
+
+// Runs function, returns false if it was cut short by a fault on trap.memory
+template<typename Function>
+bool run_trapped(GuestTrap& trap, Function function)
+{
+    #if GUEST_MEMORY_GUARDED
+    trap_enter(trap);
+
+    // Frames between here and the fault are abandoned, so they must not own anything
+    if (sigsetjmp(trap.env, 1) != 0)
+    {
+        trap_leave();
+        return false;
+    }
+
+    function();
+
+    trap_leave();
+    #else
+    function();
+    #endif
+
+    return true;
+}
\ No newline at end of file
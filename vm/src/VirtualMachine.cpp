@@ -1,50 +1,293 @@
 #include <iostream>
 #include <fstream>
 #include <thread>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <cmath>
 
 #include "VirtualMachine.hpp"
 
+#if !VM_HEADLESS
+#include <SDL.h>
+#endif
+
 #include "ISA.hpp"
 #include "syscall.hpp"
 #include "bytes.hpp"
+#include "decode.hpp"
+#include "jit.hpp"
+#include "trap.hpp"
+#include "atomic.hpp"
 
 #define PRINT_DEBUG 0
+#define PRINT_STATS 0
+
+// Labels-as-values lets every handler jump straight to the next one, otherwise fall back to a switch
+#ifndef THREADED_DISPATCH
+#if defined(__GNUC__) || defined(__clang__)
+#define THREADED_DISPATCH 1
+#else
+#define THREADED_DISPATCH 0
+#endif
+#endif
+
+#define INSTR_HANDLERS(X) \
+    X(INSTR_LOAD) X(INSTR_LOADS) X(INSTR_LOADC) X(INSTR_STORE) X(INSTR_STORES) X(INSTR_COPY) \
+    X(INSTR_LOADX) X(INSTR_STOREX) \
+    X(INSTR_LOADB) X(INSTR_LOADBI) X(INSTR_LOADH) X(INSTR_LOADHI) X(INSTR_STOREB) X(INSTR_STOREH) \
+    X(INSTR_LOADBX) X(INSTR_LOADBIX) X(INSTR_LOADHX) X(INSTR_LOADHIX) X(INSTR_STOREBX) X(INSTR_STOREHX) \
+    X(INSTR_XADD) X(INSTR_XCHG) X(INSTR_CAS) X(INSTR_FENCE) \
+    X(INSTR_ADD) X(INSTR_SUB) X(INSTR_MUL) X(INSTR_DIV) X(INSTR_IDIV) X(INSTR_SHL) X(INSTR_SHR) \
+    X(INSTR_AND) X(INSTR_OR) X(INSTR_XOR) X(INSTR_NOT) \
+    X(INSTR_ADD_IMM) X(INSTR_SUB_IMM) X(INSTR_MUL_IMM) X(INSTR_DIV_IMM) X(INSTR_IDIV_IMM) X(INSTR_SHL_IMM) X(INSTR_SHR_IMM) \
+    X(INSTR_AND_IMM) X(INSTR_OR_IMM) X(INSTR_XOR_IMM) \
+    X(INSTR_FADD) X(INSTR_FSUB) X(INSTR_FMUL) X(INSTR_FDIV) \
+    X(INSTR_ADD3) X(INSTR_SUB3) X(INSTR_MUL3) X(INSTR_DIV3) X(INSTR_IDIV3) X(INSTR_SHL3) X(INSTR_SHR3) \
+    X(INSTR_AND3) X(INSTR_OR3) X(INSTR_XOR3) X(INSTR_FADD3) X(INSTR_FSUB3) X(INSTR_FMUL3) X(INSTR_FDIV3) \
+    X(INSTR_ADD64) X(INSTR_SUB64) X(INSTR_MUL64) X(INSTR_DIV64) X(INSTR_IDIV64) X(INSTR_CMP64) X(INSTR_CMPI64) \
+    X(INSTR_DADD) X(INSTR_DSUB) X(INSTR_DMUL) X(INSTR_DDIV) X(INSTR_DCMP) X(INSTR_FTOD) X(INSTR_DTOF) \
+    X(INSTR_FMIN) X(INSTR_FMAX) X(INSTR_FFMA) X(INSTR_FSQRT) X(INSTR_FABS) X(INSTR_FFLOOR) X(INSTR_FSIN) X(INSTR_FCOS) \
+    X(INSTR_CMP) X(INSTR_CMPI) X(INSTR_CMPF) X(INSTR_CMP_IMM) X(INSTR_CMPI_IMM) \
+    X(INSTR_PUSH) X(INSTR_POP) X(INSTR_CALL) X(INSTR_RET) X(INSTR_SYSCALL) X(INSTR_STOP) \
+    X(INSTR_TAILCALL) X(INSTR_ENTER) X(INSTR_LEAVE) \
+    X(INSTR_JMP) X(INSTR_JMPZ) X(INSTR_JMPS) X(INSTR_JMPC) \
+    X(INSTR_BEQ) X(INSTR_BNE) X(INSTR_BLT) X(INSTR_BGE) X(INSTR_BLTI) X(INSTR_BGEI) \
+    X(INSTR_BEQF) X(INSTR_BNEF) X(INSTR_BLTF) X(INSTR_BGEF) \
+    X(INSTR_VLOAD) X(INSTR_VLOADA) X(INSTR_VSTORE) X(INSTR_VSTOREA) \
+    X(INSTR_VCOPY) X(INSTR_VSPLAT) X(INSTR_VEXTRACT) X(INSTR_VINSERT) X(INSTR_VSHUF) \
+    X(INSTR_VADD) X(INSTR_VSUB) X(INSTR_VMUL) X(INSTR_VMIN) X(INSTR_VMAX) X(INSTR_VCMPEQ) X(INSTR_VCMPGT) \
+    X(INSTR_VAND) X(INSTR_VOR) X(INSTR_VXOR) \
+    X(INSTR_VFADD) X(INSTR_VFSUB) X(INSTR_VFMUL) X(INSTR_VFMIN) X(INSTR_VFMAX) X(INSTR_VFCMPEQ) X(INSTR_VFCMPLT) \
+    X(FUSED_LOADC_ADD) X(FUSED_LOADC_SUB) X(FUSED_LOADC_MUL) X(FUSED_LOADC_SHL) X(FUSED_LOADC_SHR) \
+    X(FUSED_LOADC_AND) X(FUSED_LOADC_OR) X(FUSED_LOADC_XOR) \
+    X(FUSED_LOADC_LOAD) X(FUSED_LOADC_PUSH) X(FUSED_PUSH_POP) X(FUSED_POP_POP) \
+    X(FUSED_CMP_JMPZ) X(FUSED_CMP_JMPS) X(FUSED_CMPI_JMPZ) X(FUSED_CMPI_JMPS) X(FUSED_CMPF_JMPZ) X(FUSED_CMPF_JMPS) \
+    X(FUSED_CMP_IMM_JMPZ) X(FUSED_CMP_IMM_JMPS) X(FUSED_CMPI_IMM_JMPZ) X(FUSED_CMPI_IMM_JMPS)
+
+// Handlers that touch guest memory record ip first, so a fault can be reported against the right instruction
+#define SYNC_IP() context.reg_instruction_ptr = ip
+
+// A misaligned atomic or aligned vector access stops the thread, ip is moved to the terminating stop so the JIT does not retry it
+#define CHECK_ALIGNED(is_aligned, addr, kind) if (!(is_aligned)) { \
+    std::cout << "ERROR: Misaligned " kind " access at addr " << (addr) << " (IP: " << instr->addr << ")\n"; \
+    context.reg_instruction_ptr = decoded_program.instructions.size() - 1; \
+    return; }
+
+// Lane by lane vector operation on two vector registers, result in the first
+#define VECTOR_OP_HANDLER(name, operation) HANDLER(INSTR_##name) \
+        { \
+            operation(context.vectors[instr->reg_a_id], context.vectors[instr->reg_b_id]); \
+            ip++; \
+            VECTOR_OP_DEBUG(INSTR_##name##_STR); \
+            NEXT(); \
+        }
+
+#if PRINT_DEBUG
+#define VECTOR_OP_DEBUG(name) std::cout << "INSTRUCTION: " << name << " vreg " << (int)instr->reg_a_id << " and vreg " << \
+    (int)instr->reg_b_id << "\n"
+#else
+#define VECTOR_OP_DEBUG(name)
+#endif
+
+// [base + index*scale + disp] of a decoded loadx/storex, wraps at 32 bits like every other guest address
+#define MEMORY_OPERAND_ADDR() (instr->imm + \
+    (instr->reg_b_id != MEMORY_OPERAND_NO_REG ? context.registers[instr->reg_b_id].u : 0) + \
+    (instr->reg_c_id != MEMORY_OPERAND_NO_REG ? context.registers[instr->reg_c_id].u << instr->target : 0))
+
+// Byte/halfword access at addr_expr, loads are zero or sign extended by the type of value_expr
+#define NARROW_LOAD_HANDLER(name, addr_expr, value_expr) HANDLER(INSTR_##name) \
+        { \
+            SYNC_IP(); \
+            uint32_t addr = addr_expr; \
+            context.registers[instr->reg_a_id].u = static_cast<uint32_t>(value_expr); \
+            ip++; \
+            NARROW_MEMORY_DEBUG(INSTR_##name); \
+            NEXT(); \
+        }
+
+#define NARROW_STORE_HANDLER(name, addr_expr, store) HANDLER(INSTR_##name) \
+        { \
+            SYNC_IP(); \
+            uint32_t addr = addr_expr; \
+            store; \
+            ip++; \
+            NARROW_MEMORY_DEBUG(INSTR_##name); \
+            NEXT(); \
+        }
+
+#define REGISTER_ADDR() context.registers[instr->reg_b_id].u
+
+#if PRINT_DEBUG
+#define NARROW_MEMORY_DEBUG(opcode) std::cout << "INSTRUCTION: " << (int)opcode << " reg " << (int)instr->reg_a_id << \
+    " addr " << addr << " (" << context.registers[instr->reg_a_id].u << ")\n"
+#else
+#define NARROW_MEMORY_DEBUG(opcode)
+#endif
+
+// 64 bit operation on the register pairs named by the second and third operands, result in the first pair
+#define PAIR_OP_HANDLER(name, type, operation) HANDLER(INSTR_##name) \
+        { \
+            context.set_pair<type>(instr->reg_a_id, context.pair<type>(instr->reg_b_id) operation context.pair<type>(instr->reg_c_id)); \
+            ip++; \
+            PAIR_DEBUG(INSTR_##name##_STR); \
+            NEXT(); \
+        }
+
+#define PAIR_COMPARE_HANDLER(name, type) HANDLER(INSTR_##name) \
+        { \
+            context.compare<type>(context.pair<type>(instr->reg_a_id), context.pair<type>(instr->reg_b_id)); \
+            ip++; \
+            PAIR_DEBUG(INSTR_##name##_STR); \
+            NEXT(); \
+        }
+
+#if PRINT_DEBUG
+#define PAIR_DEBUG(name) std::cout << "INSTRUCTION: " << name << " reg " << (int)instr->reg_a_id << " reg " << \
+    (int)instr->reg_b_id << "\n"
+#else
+#define PAIR_DEBUG(name)
+#endif
+
+// Float math on the second (and third) register, result in the first
+#define FLOAT_MATH_HANDLER(name, result) HANDLER(INSTR_##name) \
+        { \
+            const float b = context.registers[instr->reg_b_id].f; \
+            context.registers[instr->reg_a_id].f = result; \
+            ip++; \
+            FLOAT_MATH_DEBUG(INSTR_##name##_STR); \
+            NEXT(); \
+        }
+
+#define FLOAT_MATH3_HANDLER(name, result) HANDLER(INSTR_##name) \
+        { \
+            const float b = context.registers[instr->reg_b_id].f; \
+            const float c = context.registers[instr->reg_c_id].f; \
+            context.registers[instr->reg_a_id].f = result; \
+            ip++; \
+            FLOAT_MATH_DEBUG(INSTR_##name##_STR); \
+            NEXT(); \
+        }
+
+#if PRINT_DEBUG
+#define FLOAT_MATH_DEBUG(name) std::cout << "INSTRUCTION: " << name << " reg " << (int)instr->reg_a_id << " (" << \
+    context.registers[instr->reg_a_id].f << ")\n"
+#else
+#define FLOAT_MATH_DEBUG(name)
+#endif
+
+// Branches to target if the comparison of the two registers holds, otherwise falls through
+#define BRANCH_HANDLER(name, field, comparison) HANDLER(INSTR_##name) \
+        { \
+            if (!(context.registers[instr->reg_a_id].field comparison context.registers[instr->reg_b_id].field)) \
+            { \
+                ip++; \
+                NEXT(); \
+            } \
+            ip = instr->target; \
+            POLL_EVENTS_TICK(); \
+            BRANCH_DEBUG(INSTR_##name##_STR); \
+            NEXT(); \
+        }
+
+#if PRINT_DEBUG
+#define BRANCH_DEBUG(name) std::cout << "INSTRUCTION: " << name << " to addr " << instr->imm << "\n"
+#else
+#define BRANCH_DEBUG(name)
+#endif
+
+// Checks for window events every so often, only ever called on control transfers so straight code stays cheap
+#define POLL_EVENTS_TICK() if (--context.poll_countdown == 0) poll_events_tick(context)
+
+#if PRINT_STATS
+#define COUNT_INSTRUCTION() instruction_count++
+#else
+#define COUNT_INSTRUCTION()
+#endif
+
+// In single step mode every handler returns to the caller instead of continuing (used by the JIT fallback)
+#if THREADED_DISPATCH
+#define HANDLER(instruction) handler_##instruction:
+#define HANDLER_INVALID handler_invalid:
+#define DISPATCH() do { instr = &instructions[ip]; COUNT_INSTRUCTION(); goto *dispatch_table[instr->opcode]; } while (0)
+#define NEXT() if constexpr (single_step) { context.reg_instruction_ptr = ip; return; } else DISPATCH()
+#else
+#define HANDLER(instruction) case instruction:
+#define HANDLER_INVALID default:
+#define NEXT() if constexpr (single_step) { context.reg_instruction_ptr = ip; return; } else continue
+#endif
 
 VirtualMachine::VirtualMachine()
 {
-    memory.resize(MACHINE_STACK_SIZE * 10, 0);
+    memory.allocate(memory_config.size);
 }
 
-bool VirtualMachine::load_program(const std::string& filepath)
+VirtualMachine::~VirtualMachine()
+{
+    #if !VM_HEADLESS
+    if (!graphics_initialised) return;
+
+    for (uint32_t i = 0; i < windows.size(); i++)
+    {
+        close_window(i);
+    }
+
+    SDL_QuitSubSystem(SDL_INIT_VIDEO);
+    #endif
+}
+
+bool VirtualMachine::init_graphics()
+{
+    #if VM_HEADLESS
+    return false;
+    #else
+    if (graphics_initialised) return true;
+
+    // Reference counted by SDL, so several machines can share the video subsystem
+    if (SDL_InitSubSystem(SDL_INIT_VIDEO) != 0)
+    {
+        std::cout << "ERROR: Could not initialise SDL video (" << SDL_GetError() << ")\n";
+        return false;
+    }
+
+    graphics_initialised = true;
+    return true;
+    #endif
+}
+
+std::shared_ptr<const ProgramImage> load_program_image(const std::string& filepath, bool fuse)
 {
     std::ifstream file(filepath, std::ios::binary);
     
     if (!file.is_open())
     {
-        return false;
+        return nullptr;
     }
 
     file.seekg(0, std::ios::end);
     size_t length = file.tellg();
     file.seekg(0, std::ios::beg);
 
-    program.resize(length);
+    std::vector<uint8_t> program(length);
     file.read((char*)program.data(), length);
 
     std::cout << "Loaded program of " << length << " bytes\n";
-    return true;
-}
 
-void VirtualMachine::run()
-{
-    uint32_t binary_isa_ver = load_int(&program[0]);
-    uint32_t binary_syscall_ver = load_int(&program[4]);
+    std::shared_ptr<ProgramImage> image = std::make_shared<ProgramImage>();
+    Executable& executable = image->executable;
+    if (!read_executable(program, executable))
+    {
+        return nullptr;
+    }
 
-    if (binary_isa_ver != ISA_version)
+    uint32_t binary_isa_ver = executable.isa_version;
+    uint32_t binary_syscall_ver = executable.syscall_version;
+
+    if (binary_isa_ver < ISA_version_min || binary_isa_ver > ISA_version)
     {
-        std::cout << "ERROR: Executable has different ISA version to runtime\n Executable ISA: " << binary_isa_ver <<
-            "\n Runtime ISA: " << ISA_version << "\n";
-        return;
+        std::cout << "ERROR: Executable has unsupported ISA version\n Executable ISA: " << binary_isa_ver <<
+            "\n Runtime ISA: " << ISA_version_min << " - " << ISA_version << "\n";
+        return nullptr;
     }
 
     if (binary_syscall_ver != SYSCALL_version)
@@ -53,719 +296,2153 @@ void VirtualMachine::run()
             binary_syscall_ver << "\n Runtime SYSCALL: " << SYSCALL_version << "\n";
     }
 
-    reg_instruction_ptr = load_int(&program[8]);
-    std::fill(memory.begin(), memory.end(), 0);
-    
-    uint32_t program_data_size = load_int(&program[12]);
-    
+    image->isa_version = binary_isa_ver;
+    image->entry_addr = executable.entry_addr;
+    image->data_size = executable.data.size();
+
+    // Translate code section once, interpreter runs over decoded instructions only
+    if (!decode_program(executable.code, image->isa_version, executable.code_start, image->entry_addr, image->decoded_program))
+    {
+        std::cout << "ERROR: Could not decode program\n";
+        return nullptr;
+    }
+
+    if (fuse)
+    {
+        fuse_instructions(image->decoded_program);
+    }
+
+    return image;
+}
+
+bool VirtualMachine::load_program(const std::string& filepath)
+{
+    std::shared_ptr<const ProgramImage> loaded = load_program_image(filepath, fusion_enabled);
+    if (!loaded)
+    {
+        return false;
+    }
+
+    set_program(std::move(loaded));
+    return true;
+}
+
+void VirtualMachine::set_program(std::shared_ptr<const ProgramImage> image)
+{
+    program_isa_version = image ? image->isa_version : ISA_version;
+    this->image = std::move(image);
+}
+
+void VirtualMachine::set_input(uint32_t job_id, const std::string& input)
+{
+    this->job_id = job_id;
+    this->input = input;
+}
+
+void VirtualMachine::set_print_info(bool enabled)
+{
+    print_info = enabled;
+}
+
+bool VirtualMachine::run()
+{
+    if (!image || image->decoded_program.instructions.empty())
+    {
+        std::cout << "ERROR: No program loaded\n";
+        return false;
+    }
+
+    // Nothing carries over from a previous run of the same machine
+    main_thread = ThreadContext();
+
+    if (!reset_memory(image->data(), image->data_size, image->executable.static_size()))
+    {
+        return false;
+    }
+
+    main_thread.registers[REG_ID_A].u = job_id;
+
+    if (!input.empty())
+    {
+        uint32_t input_size = input.size() + 1;
+        if (input_size > memory_config.stack_size)
+        {
+            std::cout << "ERROR: Input of " << input.size() << " bytes does not fit on the stack\n";
+            return false;
+        }
+
+        memcpy(&memory[main_thread.reg_stack_ptr], input.c_str(), input_size);
+
+        main_thread.registers[REG_ID_B].u = main_thread.reg_stack_ptr;
+        main_thread.registers[REG_ID_C].u = input.size();
+        main_thread.reg_stack_ptr += (input_size + 3) & ~3u;
+        main_thread.reg_base_ptr = main_thread.reg_stack_ptr;
+    }
+
+    if (print_info)
+    {
+        std::cout << "Data size: " << image->data_size << "   IP: " << image->entry_addr << "\n";
+    }
+
+    last_poll_time = std::chrono::steady_clock::now();
+
+    #if PRINT_STATS
+    instruction_count = 0;
+    auto start_time = std::chrono::steady_clock::now();
+    #endif
+
+    thread_runner = [this](ThreadContext& context, uint32_t entry_addr)
+    {
+        return run_thread(context, entry_addr);
+    };
+
+    bool completed = run_thread(main_thread, image->entry_addr);
+    join_all_threads();
+
+    #if PRINT_STATS
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    std::cout << "Executed " << instruction_count << " instructions in " << seconds << "s (" <<
+        instruction_count / seconds / 1000000.0 << " MIPS)\n";
+    #endif
+
+    if (heap_stats_enabled)
+    {
+        heap.print_stats();
+    }
+
+    return completed;
+}
+
+bool VirtualMachine::run_thread(ThreadContext& context, uint32_t entry_addr)
+{
+    const DecodedProgram& decoded_program = image->decoded_program;
+
+    context.reg_instruction_ptr = decoded_program.index_from_addr(entry_addr);
+
+    // Each thread compiles its own code, only the decoded program is shared
+    std::unique_ptr<Jit> jit;
+    if (jit_enabled && Jit::is_supported())
+    {
+        jit = std::make_unique<Jit>(*this, context, jit_hot_threshold);
+    }
+    else if (jit_enabled && context.thread_id == 0)
+    {
+        std::cout << "WARNING: JIT is not supported on this platform, using interpreter\n";
+    }
+
+    GuestTrap trap;
+    trap.memory = &memory;
+
+    bool completed = run_trapped(trap, [&]()
+    {
+        if (jit)
+        {
+            jit->execute();
+        }
+        else
+        {
+            execute<false>(context);
+        }
+    });
+
+    if (!completed)
+    {
+        // Faults in compiled code are mapped back through the JIT, anything else was interpreted
+        uint32_t fault_index = jit ? jit->guest_index_from_host_pc(trap.fault_pc) : UINT32_MAX;
+        if (fault_index == UINT32_MAX) fault_index = context.reg_instruction_ptr;
+        if (fault_index >= decoded_program.instructions.size()) fault_index = decoded_program.instructions.size() - 1;
+
+        // Named by the nearest label (and source line) when the executable has symbols
+        uint32_t fault_ip = decoded_program.instructions[fault_index].addr;
+        std::string where = image->executable.describe_code_addr(fault_ip);
+        std::cout << "ERROR: Guest memory fault at addr " << trap.fault_addr << " (IP: " << fault_ip <<
+            (where.empty() ? "" : " in " + where) << ", thread " << context.thread_id << ")\n";
+    }
+
+    return completed;
+}
+
+uint32_t VirtualMachine::spawn_thread(uint32_t entry_addr, uint32_t argument, uint32_t stack_size)
+{
+    if (image && image->decoded_program.index_from_addr(entry_addr) == image->decoded_program.instructions.size() - 1)
+    {
+        std::cout << "ERROR: thread_spawn entry addr " << entry_addr << " is not an instruction\n";
+        return 0;
+    }
+
+    // Stack is carved from the heap with a guard page either side, like the main stack
+    const uint32_t page = GuestMemory::page_size();
+    if (stack_size == 0) stack_size = THREAD_STACK_SIZE;
+    if (stack_size > UINT32_MAX - 4 * page) return 0;
+    stack_size = (stack_size + page - 1) / page * page;
+
+    std::unique_ptr<GuestThread> thread = std::make_unique<GuestThread>();
+
+    {
+        std::lock_guard<std::mutex> lock(heap_mutex);
+        thread->stack_block = heap.allocate(stack_size + 3 * page);
+
+        if (thread->stack_block == 0)
+        {
+            std::cout << "ERROR: Not enough heap for a " << stack_size << " byte thread stack\n";
+            return 0;
+        }
+
+        // Registered with the heap so malloc and free never read the guard pages while holding the lock
+        thread->stack_start = (thread->stack_block + page - 1) / page * page + page;
+        thread->stack_end = thread->stack_start + stack_size;
+        heap.protect(thread->stack_start - page, page);
+        heap.protect(thread->stack_end, page);
+    }
+
+    // Entry starts as if it had been called, with a frame holding return address 0 (the header, never an
+    // instruction) so a ret from the entry function stops the thread
+    write_int(&memory[thread->stack_start], 0);
+    write_int(&memory[thread->stack_start + 4], 0);
+
+    ThreadContext& context = thread->context;
+    context.reg_stack_ptr = thread->stack_start + 8;
+    context.reg_base_ptr = thread->stack_start;
+    context.poll_countdown = UINT32_MAX;
+    context.registers[REG_ID_B].u = argument;
+
+    std::lock_guard<std::mutex> lock(thread_mutex);
+
+    threads.push_back(std::move(thread));
+    GuestThread& spawned = *threads.back();
+
+    context.thread_id = threads.size();
+    context.registers[REG_ID_A].u = context.thread_id;
+
+    spawned.host_thread = std::thread([this, &spawned, entry_addr]()
+    {
+        thread_runner(spawned.context, entry_addr);
+    });
+
+    return spawned.context.thread_id;
+}
+
+uint32_t VirtualMachine::join_thread(ThreadContext& context, uint32_t thread_id)
+{
+    GuestThread* thread = nullptr;
+
+    {
+        std::lock_guard<std::mutex> lock(thread_mutex);
+
+        if (thread_id == 0 || thread_id > threads.size() || threads[thread_id - 1]->joined || thread_id == context.thread_id)
+        {
+            std::cout << "WARNING: thread_join of invalid, already joined or current thread " << thread_id << "\n";
+            return 0;
+        }
+
+        // Claimed under the lock so two threads can never join the same one
+        thread = threads[thread_id - 1].get();
+        thread->joined = true;
+    }
+
+    thread->host_thread.join();
+
+    {
+        const uint32_t page = GuestMemory::page_size();
+
+        std::lock_guard<std::mutex> lock(heap_mutex);
+        heap.unprotect(thread->stack_start - page, page);
+        heap.unprotect(thread->stack_end, page);
+        heap.free(thread->stack_block);
+    }
+
+    return thread->context.registers[REG_ID_A].u;
+}
+
+void VirtualMachine::join_all_threads()
+{
+    for (uint32_t thread_id = 1; ; thread_id++)
+    {
+        GuestThread* thread = nullptr;
+
+        {
+            std::lock_guard<std::mutex> lock(thread_mutex);
+            if (thread_id > threads.size()) break;
+            thread = threads[thread_id - 1].get();
+        }
+
+        // Stacks do not need freeing, the heap is reset with the rest of memory
+        if (thread->host_thread.joinable())
+        {
+            thread->host_thread.join();
+        }
+    }
+
+    threads.clear();
+}
+
+bool VirtualMachine::set_memory_config(const MemoryConfig& config)
+{
+    memory_config = config;
+    return memory.allocate(memory_config.size);
+}
+
+bool VirtualMachine::reset_memory(const uint8_t* data, uint32_t data_size, uint32_t static_size)
+{
+    if (!memory.data())
+    {
+        std::cout << "ERROR: No guest memory\n";
+        return false;
+    }
+
+    // data | guard | stack | guard | heap, the stack grows up into the guard page above it
+    const uint64_t page = GuestMemory::page_size();
+    uint64_t stack_start = (static_cast<uint64_t>(static_size) + page - 1) / page * page + page;
+    uint64_t stack_end = (stack_start + memory_config.stack_size + page - 1) / page * page;
+    uint64_t heap_start = stack_end + page;
+
+    if (heap_start > memory.size())
+    {
+        std::cout << "ERROR: Program data and stack (" << static_size << " + " << memory_config.stack_size <<
+            " bytes) do not fit in guest memory (" << memory.size() << " bytes)\n";
+        return false;
+    }
+
+    memory.reset();
+
     // Load program data
-    memcpy(&memory[0], &program[16], program_data_size);
-    
-    reg_base_ptr = program_data_size;
-    reg_stack_ptr = program_data_size;
+    memcpy(&memory[0], data, data_size);
+
+    memory.protect(stack_start - page, page);
+    memory.protect(stack_end, page);
+
+    main_thread.reg_base_ptr = stack_start;
+    main_thread.reg_stack_ptr = stack_start;
+    heap_ptr = heap_start;
+    heap.reset(heap_ptr, memory.size());
+
+    return true;
+}
+
+void VirtualMachine::set_heap_stats_enabled(bool enabled)
+{
+    heap_stats_enabled = enabled;
+}
+
+void VirtualMachine::set_fusion_enabled(bool enabled)
+{
+    fusion_enabled = enabled;
+}
+
+void VirtualMachine::enable_jit(uint32_t hot_threshold)
+{
+    jit_enabled = true;
+    jit_hot_threshold = hot_threshold > 0 ? hot_threshold : 1;
+}
+
+void VirtualMachine::set_event_poll_policy(const EventPollPolicy& policy)
+{
+    event_poll_policy = policy;
+    if (event_poll_policy.interval == 0)
+    {
+        event_poll_policy.interval = 1;
+    }
+}
 
-    std::cout << "Data size: " << program_data_size << "   IP: " << reg_instruction_ptr << "\n";
+void VirtualMachine::poll_events()
+{
+    #if !VM_HEADLESS
+    if (!graphics_initialised) return;
 
-    while (reg_instruction_ptr < program.size())
+    SDL_Event event;
+    while (SDL_PollEvent(&event))
     {
-        SDL_Event event;
-        while (SDL_PollEvent(&event))
+        if (event.type == SDL_WINDOWEVENT)
         {
-            if (event.type == SDL_WINDOWEVENT)
+            if (event.window.event == SDL_WINDOWEVENT_CLOSE)
             {
-                if (event.window.event == SDL_WINDOWEVENT_CLOSE)
+                // Find closed window
+                for (int i = 0; i < windows.size(); i++)
                 {
-                    // Find closed window
-                    for (int i = 0; i < windows.size(); i++)
+                    if (windows[i].window && SDL_GetWindowID(windows[i].window) == event.window.windowID)
                     {
-                        if (SDL_GetWindowID(windows[i].window) == event.window.windowID)
-                        {
-                            SDL_DestroyRenderer(windows[i].renderer);
-                            SDL_DestroyWindow(windows[i].window);
-                            windows[i].renderer = nullptr;
-                            windows[i].window = nullptr;
-                            break;
-                        }
+                        close_window(i);
+                        break;
                     }
                 }
             }
         }
+    }
+    #endif
+}
+
+void VirtualMachine::poll_events_tick(ThreadContext& context)
+{
+    // Window events belong to the main thread, other threads only ever reset their countdown
+    if (context.thread_id != 0)
+    {
+        context.poll_countdown = UINT32_MAX;
+        return;
+    }
+
+    switch (event_poll_policy.mode)
+    {
+        case EventPollMode::Branches:
+        {
+            context.poll_countdown = event_poll_policy.interval;
+            if (event_poll_policy.only_with_windows && open_window_count == 0) return;
+
+            poll_events();
+            break;
+        }
+        case EventPollMode::Microseconds:
+        {
+            // Reading the clock on every branch would cost more than polling, so only check it periodically
+            context.poll_countdown = 1024;
+            if (event_poll_policy.only_with_windows && open_window_count == 0) return;
 
-        process_instruction();
+            auto now = std::chrono::steady_clock::now();
+            if (now - last_poll_time < std::chrono::microseconds(event_poll_policy.interval)) return;
+
+            last_poll_time = now;
+            poll_events();
+            break;
+        }
+        case EventPollMode::WindowSyscall:
+        {
+            // Polled from dispatch_syscall instead
+            context.poll_countdown = UINT32_MAX;
+            break;
+        }
     }
 }
 
-void VirtualMachine::reset_flags()
+void VirtualMachine::close_window(uint32_t window_id)
 {
-    flag_zero = 0;
-    flag_sign = 0;
-    flag_carry = 0;
+    if (window_id >= windows.size() || !windows[window_id].window) return;
+
+    #if !VM_HEADLESS
+    SDL_DestroyRenderer(windows[window_id].renderer);
+    SDL_DestroyWindow(windows[window_id].window);
+    #endif
+    windows[window_id].renderer = nullptr;
+    windows[window_id].window = nullptr;
+    open_window_count--;
 }
 
-void* VirtualMachine::get_register(uint8_t id)
+bool VirtualMachine::check_memory_range(uint32_t addr, uint32_t size, const char* syscall_name)
 {
-    switch (id)
-    {
-        case 0: return &reg_a;
-        case 1: return &reg_b;
-        case 2: return &reg_c;
-        case 3: return &reg_d;
-        case 4: return &reg_fa;
-        case 5: return &reg_fb;
-        case 6: return &reg_fc;
-    }
+    if ((uint64_t)addr + size <= memory.size()) return true;
 
-    return nullptr;
+    std::cout << "ERROR: " << syscall_name << " of " << size << " bytes at addr " << addr << " is outside guest memory\n";
+    return false;
 }
 
-void VirtualMachine::dispatch_syscall(uint8_t id)
+void VirtualMachine::dispatch_syscall(ThreadContext& context, uint8_t id)
 {
+    // SDL is not thread safe, windows belong to the main thread
+    if (id >= SYSCALL_ID_WINDOW_CREATE && context.thread_id != 0)
+    {
+        std::cout << "ERROR: Window syscall " << (int)id << " from thread " << context.thread_id << " ignored\n";
+        return;
+    }
+
+    if (event_poll_policy.mode == EventPollMode::WindowSyscall && id >= SYSCALL_ID_WINDOW_CREATE)
+    {
+        poll_events();
+    }
+
     switch (id)
     {
         case SYSCALL_ID_WAIT:
         {
-            std::this_thread::sleep_for(std::chrono::milliseconds(reg_b));
+            std::this_thread::sleep_for(std::chrono::milliseconds(context.registers[REG_ID_B].u));
+            break;
+        }
+        case SYSCALL_ID_MALLOC:
+        {
+            std::lock_guard<std::mutex> lock(heap_mutex);
+            context.registers[REG_ID_A].u = heap.allocate(context.registers[REG_ID_B].u);
+            break;
+        }
+        case SYSCALL_ID_FREE:
+        {
+            std::lock_guard<std::mutex> lock(heap_mutex);
+            heap.free(context.registers[REG_ID_B].u);
+            break;
+        }
+        case SYSCALL_ID_THREAD_SPAWN:
+        {
+            context.registers[REG_ID_A].u = spawn_thread(context.registers[REG_ID_B].u, context.registers[REG_ID_C].u,
+                context.registers[REG_ID_D].u);
+            break;
+        }
+        case SYSCALL_ID_THREAD_JOIN:
+        {
+            context.registers[REG_ID_A].u = join_thread(context, context.registers[REG_ID_B].u);
+            break;
+        }
+        case SYSCALL_ID_MEMSET:
+        {
+            uint32_t addr = context.registers[REG_ID_B].u;
+            uint32_t size = context.registers[REG_ID_C].u;
+            if (!check_memory_range(addr, size, "memset")) break;
+
+            memset(&memory[addr], context.registers[REG_ID_D].u & 0xFF, size);
             break;
         }
-        case SYSCALL_ID_PRINTREG:
+        case SYSCALL_ID_MEMCPY:
+        case SYSCALL_ID_MEMMOVE:
+        {
+            uint32_t dest = context.registers[REG_ID_B].u;
+            uint32_t src = context.registers[REG_ID_C].u;
+            uint32_t size = context.registers[REG_ID_D].u;
+            const char* name = id == SYSCALL_ID_MEMCPY ? "memcpy" : "memmove";
+            if (!check_memory_range(dest, size, name) || !check_memory_range(src, size, name)) break;
+
+            // Overlapping memcpy is undefined on the host, so both go through memmove (same speed for disjoint regions)
+            memmove(&memory[dest], &memory[src], size);
+            break;
+        }
+        case SYSCALL_ID_MEMCMP:
+        {
+            uint32_t addr_a = context.registers[REG_ID_B].u;
+            uint32_t addr_b = context.registers[REG_ID_C].u;
+            uint32_t size = context.registers[REG_ID_D].u;
+            if (!check_memory_range(addr_a, size, "memcmp") || !check_memory_range(addr_b, size, "memcmp")) break;
+
+            int result = memcmp(&memory[addr_a], &memory[addr_b], size);
+            context.registers[REG_ID_A].i = result < 0 ? -1 : (result > 0 ? 1 : 0);
+            break;
+        }
+        case SYSCALL_ID_MEMCHR:
+        {
+            uint32_t addr = context.registers[REG_ID_B].u;
+            uint32_t size = context.registers[REG_ID_C].u;
+
+            // Data starts at address 0, so 0 is a valid match and not found needs its own value
+            context.registers[REG_ID_A].u = UINT32_MAX;
+            if (!check_memory_range(addr, size, "memchr")) break;
+
+            const uint8_t* found = static_cast<const uint8_t*>(memchr(&memory[addr], context.registers[REG_ID_D].u & 0xFF, size));
+            if (found)
+            {
+                context.registers[REG_ID_A].u = found - memory.data();
+            }
+            break;
+        }
+        case SYSCALL_ID_PRINTREG:
+        {
+            uint32_t reg_id = register_id_from_isa(program_isa_version, context.registers[REG_ID_B].u);
+            if (reg_id < REGISTER_FLOAT_START)
+            {
+                printf("%d\n", context.registers[reg_id].u);
+            }
+            else if (reg_id < REGISTER_COUNT)
+            {
+                printf("%f\n", context.registers[reg_id].f);
+            }
+            break;
+        }
+        case SYSCALL_ID_PRINTF:
+        {
+            // Find the terminator first so a bad pointer faults before stdout is locked
+            uint32_t addr = context.registers[REG_ID_B].u;
+            if (addr >= memory.size() || !memchr(&memory[addr], 0, memory.size() - addr))
+            {
+                std::cout << "ERROR: printf string at addr " << addr << " is not terminated in guest memory\n";
+                break;
+            }
+
+            printf((char*)&memory[addr]);
+            break;
+        }
+        #if !VM_HEADLESS
+        case SYSCALL_ID_WINDOW_CREATE:
+        {
+            VirtualWindow window = {};
+
+            if (init_graphics())
+            {
+                window.window = SDL_CreateWindow((char*)&memory[context.registers[REG_ID_D].u], SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+                    context.registers[REG_ID_B].u, context.registers[REG_ID_C].u, 0);
+
+                window.renderer = SDL_CreateRenderer(window.window, -1, 0);
+            }
+
+            context.registers[REG_ID_A].u = windows.size();
+            windows.push_back(window);
+
+            if (window.window)
+            {
+                open_window_count++;
+            }
+            break;
+        }
+        case SYSCALL_ID_WINDOW_CLOSE:
+        {
+            close_window(context.registers[REG_ID_B].u);
+            break;
+        }
+        case SYSCALL_ID_WINDOW_IS_VALID:
+        {
+            uint32_t window_id = context.registers[REG_ID_B].u;
+            context.registers[REG_ID_A].u = (windows.size() > window_id && windows[window_id].window) ? 1 : 0;
+            break;
+        }
+        case SYSCALL_ID_WINDOW_SET_PIXEL:
+        {
+            uint32_t window_id = context.registers[REG_ID_B].u;
+            SDL_SetRenderDrawColor(windows[window_id].renderer, memory[context.reg_stack_ptr - 12],
+                memory[context.reg_stack_ptr - 8], memory[context.reg_stack_ptr - 4], 255);
+            SDL_RenderDrawPoint(windows[window_id].renderer, context.registers[REG_ID_C].u, context.registers[REG_ID_D].u);
+            context.reg_stack_ptr -= 12;
+            break;
+        }
+        case SYSCALL_ID_WINDOW_CLEAR:
+        {
+            uint32_t window_id = context.registers[REG_ID_B].u;
+            SDL_SetRenderDrawColor(windows[window_id].renderer, context.registers[REG_ID_C].u, context.registers[REG_ID_D].u,
+                memory[context.reg_stack_ptr - 4], 255);
+            SDL_RenderClear(windows[window_id].renderer);
+            context.reg_stack_ptr -= 4;
+            break;
+        }
+        case SYSCALL_ID_WINDOW_UPDATE:
+        {
+            uint32_t window_id = context.registers[REG_ID_B].u;
+            SDL_RenderPresent(windows[window_id].renderer);
+            break;
+        }
+        case SYSCALL_ID_WINDOW_GET_MOUSE_X:
+        {
+            int mouse_x = 0;
+            if (graphics_initialised) SDL_GetMouseState(&mouse_x, NULL);
+            context.registers[REG_ID_A].u = mouse_x;
+            break;
+        }
+        case SYSCALL_ID_WINDOW_GET_MOUSE_Y:
+        {
+            int mouse_y = 0;
+            if (graphics_initialised) SDL_GetMouseState(NULL, &mouse_y);
+            context.registers[REG_ID_A].u = mouse_y;
+            break;
+        }
+        case SYSCALL_ID_WINDOW_GET_KEY_STATE:
+        {
+            context.registers[REG_ID_A].u = graphics_initialised ? SDL_GetKeyboardState(NULL)[context.registers[REG_ID_B].u] : 0;
+            break;
+        }
+        #else
+        // No windows can exist, arguments passed on the stack are still popped
+        case SYSCALL_ID_WINDOW_CREATE:
+        {
+            if (windows.empty())
+            {
+                std::cout << "WARNING: Window syscalls are not available in headless build\n";
+            }
+
+            context.registers[REG_ID_A].u = windows.size();
+            windows.push_back(VirtualWindow{});
+            break;
+        }
+        case SYSCALL_ID_WINDOW_SET_PIXEL:
+        {
+            context.reg_stack_ptr -= 12;
+            break;
+        }
+        case SYSCALL_ID_WINDOW_CLEAR:
+        {
+            context.reg_stack_ptr -= 4;
+            break;
+        }
+        case SYSCALL_ID_WINDOW_IS_VALID:
+        case SYSCALL_ID_WINDOW_GET_MOUSE_X:
+        case SYSCALL_ID_WINDOW_GET_MOUSE_Y:
+        case SYSCALL_ID_WINDOW_GET_KEY_STATE:
+        {
+            context.registers[REG_ID_A].u = 0;
+            break;
+        }
+        #endif
+    }
+}
+
+void VirtualMachine::step(ThreadContext& context)
+{
+    execute<true>(context);
+}
+
+template<bool single_step>
+void VirtualMachine::execute(ThreadContext& context)
+{
+    const DecodedProgram& decoded_program = image->decoded_program;
+    const DecodedInstruction* instructions = decoded_program.instructions.data();
+    const DecodedInstruction* instr = instructions;
+
+    uint32_t ip = context.reg_instruction_ptr;
+
+    #if THREADED_DISPATCH
+    if constexpr (single_step)
+    {
+        // Not worth building the dispatch table for one instruction
+        instr = &instructions[ip];
+        COUNT_INSTRUCTION();
+        switch (instr->opcode)
+        {
+            #define INSTR_HANDLER_JUMP(instruction) case instruction: goto handler_##instruction;
+            INSTR_HANDLERS(INSTR_HANDLER_JUMP)
+            #undef INSTR_HANDLER_JUMP
+            default: goto handler_invalid;
+        }
+    }
+
+    // Every opcode defaults to the invalid handler, so the sparse opcode space can be indexed directly
+    void* dispatch_table[256];
+    for (void*& handler : dispatch_table) handler = &&handler_invalid;
+
+    #define INSTR_HANDLER_ENTRY(instruction) dispatch_table[instruction] = &&handler_##instruction;
+    INSTR_HANDLERS(INSTR_HANDLER_ENTRY)
+    #undef INSTR_HANDLER_ENTRY
+
+    DISPATCH();
+    #else
+    while (true)
+    {
+    instr = &instructions[ip];
+    COUNT_INSTRUCTION();
+    switch (instr->opcode)
+    #endif
+    {
+        HANDLER(INSTR_LOAD)
+        {
+            SYNC_IP();
+            context.registers[instr->reg_a_id].u = load_int(&memory[context.registers[instr->reg_b_id].u]);
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: LOAD " << context.registers[instr->reg_a_id].u << " into reg " << (int)instr->reg_a_id << "\n";
+            #endif
+
+            NEXT();
+        }
+        HANDLER(INSTR_LOADS)
+        {
+            SYNC_IP();
+            context.registers[instr->reg_a_id].u = load_int(&memory[context.reg_base_ptr + instr->imm]);
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: LOADS " << context.registers[instr->reg_a_id].u << " into reg " << (int)instr->reg_a_id << "\n";
+            #endif
+
+            NEXT();
+        }
+        HANDLER(INSTR_LOADC)
+        {
+            context.registers[instr->reg_a_id].u = instr->imm;
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: LOADC " << instr->imm << " into reg " << (int)instr->reg_a_id << "\n";
+            #endif
+
+            NEXT();
+        }
+        HANDLER(INSTR_LOADX)
+        {
+            SYNC_IP();
+            uint32_t addr = MEMORY_OPERAND_ADDR();
+            context.registers[instr->reg_a_id].u = load_int(&memory[addr]);
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: LOADX " << context.registers[instr->reg_a_id].u << " from addr " << addr << "\n";
+            #endif
+
+            NEXT();
+        }
+        NARROW_LOAD_HANDLER(LOADB, REGISTER_ADDR(), memory[addr])
+        NARROW_LOAD_HANDLER(LOADBI, REGISTER_ADDR(), static_cast<int8_t>(memory[addr]))
+        NARROW_LOAD_HANDLER(LOADH, REGISTER_ADDR(), load_half(&memory[addr]))
+        NARROW_LOAD_HANDLER(LOADHI, REGISTER_ADDR(), static_cast<int16_t>(load_half(&memory[addr])))
+        NARROW_STORE_HANDLER(STOREB, REGISTER_ADDR(), memory[addr] = static_cast<uint8_t>(context.registers[instr->reg_a_id].u))
+        NARROW_STORE_HANDLER(STOREH, REGISTER_ADDR(), write_half(&memory[addr], static_cast<uint16_t>(context.registers[instr->reg_a_id].u)))
+        NARROW_LOAD_HANDLER(LOADBX, MEMORY_OPERAND_ADDR(), memory[addr])
+        NARROW_LOAD_HANDLER(LOADBIX, MEMORY_OPERAND_ADDR(), static_cast<int8_t>(memory[addr]))
+        NARROW_LOAD_HANDLER(LOADHX, MEMORY_OPERAND_ADDR(), load_half(&memory[addr]))
+        NARROW_LOAD_HANDLER(LOADHIX, MEMORY_OPERAND_ADDR(), static_cast<int16_t>(load_half(&memory[addr])))
+        NARROW_STORE_HANDLER(STOREBX, MEMORY_OPERAND_ADDR(), memory[addr] = static_cast<uint8_t>(context.registers[instr->reg_a_id].u))
+        NARROW_STORE_HANDLER(STOREHX, MEMORY_OPERAND_ADDR(), write_half(&memory[addr], static_cast<uint16_t>(context.registers[instr->reg_a_id].u)))
+        HANDLER(INSTR_STORE)
+        {
+            SYNC_IP();
+            uint32_t addr = context.registers[instr->reg_b_id].u;
+            write_int(&memory[addr], context.registers[instr->reg_a_id].u);
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: STORE " << context.registers[instr->reg_a_id].u << " in addr " << addr << "\n";
+            #endif
+
+            NEXT();
+        }
+        HANDLER(INSTR_STOREX)
+        {
+            SYNC_IP();
+            uint32_t addr = MEMORY_OPERAND_ADDR();
+            write_int(&memory[addr], context.registers[instr->reg_a_id].u);
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: STOREX " << context.registers[instr->reg_a_id].u << " in addr " << addr << "\n";
+            #endif
+
+            NEXT();
+        }
+        HANDLER(INSTR_STORES)
+        {
+            SYNC_IP();
+            uint32_t addr = context.reg_base_ptr + instr->imm;
+            write_int(&memory[addr], context.registers[instr->reg_a_id].u);
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: STORES " << context.registers[instr->reg_a_id].u << " in stack addr " << addr << "\n";
+            #endif
+
+            NEXT();
+        }
+        HANDLER(INSTR_XADD)
+        {
+            SYNC_IP();
+            uint32_t addr = context.registers[instr->reg_b_id].u;
+            CHECK_ALIGNED(atomic_aligned(addr), addr, "atomic");
+            context.registers[instr->reg_a_id].u = atomic_int(&memory[addr]).fetch_add(context.registers[instr->reg_a_id].u);
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: XADD at addr " << addr << " (old " << context.registers[instr->reg_a_id].u << ")\n";
+            #endif
+
+            NEXT();
+        }
+        HANDLER(INSTR_XCHG)
+        {
+            SYNC_IP();
+            uint32_t addr = context.registers[instr->reg_b_id].u;
+            CHECK_ALIGNED(atomic_aligned(addr), addr, "atomic");
+            context.registers[instr->reg_a_id].u = atomic_int(&memory[addr]).exchange(context.registers[instr->reg_a_id].u);
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: XCHG at addr " << addr << " (old " << context.registers[instr->reg_a_id].u << ")\n";
+            #endif
+
+            NEXT();
+        }
+        HANDLER(INSTR_CAS)
+        {
+            SYNC_IP();
+            uint32_t addr = context.registers[instr->reg_c_id].u;
+            CHECK_ALIGNED(atomic_aligned(addr), addr, "atomic");
+
+            // Expected value is replaced with what was in memory, flags are set as if the two were compared
+            // so the zero flag means the store happened
+            uint32_t expected = context.registers[instr->reg_a_id].u;
+            atomic_int(&memory[addr]).compare_exchange_strong(context.registers[instr->reg_a_id].u,
+                context.registers[instr->reg_b_id].u);
+            context.compare<uint32_t>(context.registers[instr->reg_a_id].u, expected);
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: CAS at addr " << addr << " (" << (context.flag_zero ? "swapped" : "failed") << ")\n";
+            #endif
+
+            NEXT();
+        }
+        HANDLER(INSTR_FENCE)
+        {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: FENCE\n";
+            #endif
+
+            NEXT();
+        }
+        HANDLER(INSTR_COPY)
+        {
+            uint8_t reg_src_id = instr->reg_a_id;
+            uint8_t reg_dest_id = instr->reg_b_id;
+
+            bool src_float = reg_src_id >= REGISTER_FLOAT_START;
+            bool dest_float = reg_dest_id >= REGISTER_FLOAT_START;
+
+            if (!src_float && dest_float)
+            {
+                context.registers[reg_dest_id].f = (float)context.registers[reg_src_id].u;
+            }
+            else if (src_float && !dest_float)
+            {
+                context.registers[reg_dest_id].u = (uint32_t)context.registers[reg_src_id].f;
+            }
+            else
+            {
+                context.registers[reg_dest_id] = context.registers[reg_src_id];
+            }
+
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: COPY reg " << (int)reg_src_id << " to reg " << (int)reg_dest_id << "\n";
+            #endif
+
+            NEXT();
+        }
+        HANDLER(INSTR_ADD)
+        {
+            context.registers[REG_ID_A].u = context.registers[instr->reg_a_id].u + context.registers[instr->reg_b_id].u;
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: ADD reg " << (int)instr->reg_a_id << " and reg " << (int)instr->reg_b_id << " (" << context.registers[REG_ID_A].u << ")\n";
+            #endif
+
+            NEXT();
+        }
+        HANDLER(INSTR_SUB)
+        {
+            context.registers[REG_ID_A].u = context.registers[instr->reg_a_id].u - context.registers[instr->reg_b_id].u;
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: SUB reg " << (int)instr->reg_b_id << " from reg " << (int)instr->reg_a_id << " (" << context.registers[REG_ID_A].u << ")\n";
+            #endif
+
+            NEXT();
+        }
+        HANDLER(INSTR_MUL)
+        {
+            context.registers[REG_ID_A].u = context.registers[instr->reg_a_id].u * context.registers[instr->reg_b_id].u;
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: MUL reg " << (int)instr->reg_a_id << " and reg " << (int)instr->reg_b_id << " (" << context.registers[REG_ID_A].u << ")\n";
+            #endif
+
+            NEXT();
+        }
+        HANDLER(INSTR_DIV)
+        {
+            context.registers[REG_ID_A].u = context.registers[instr->reg_a_id].u / context.registers[instr->reg_b_id].u;
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: DIV reg " << (int)instr->reg_a_id << " by reg " << (int)instr->reg_b_id << " (" << context.registers[REG_ID_A].u << ")\n";
+            #endif
+
+            NEXT();
+        }
+        HANDLER(INSTR_IDIV)
+        {
+            context.registers[REG_ID_A].i = context.registers[instr->reg_a_id].i / context.registers[instr->reg_b_id].i;
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: IDIV reg " << (int)instr->reg_a_id << " by reg " << (int)instr->reg_b_id << " (" << context.registers[REG_ID_A].i << ")\n";
+            #endif
+
+            NEXT();
+        }
+        HANDLER(INSTR_SHL)
+        {
+            context.registers[REG_ID_A].u = context.registers[instr->reg_a_id].u << context.registers[instr->reg_b_id].u;
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: SHL\n";
+            #endif
+
+            NEXT();
+        }
+        HANDLER(INSTR_SHR)
+        {
+            context.registers[REG_ID_A].u = context.registers[instr->reg_a_id].u >> context.registers[instr->reg_b_id].u;
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: SHR\n";
+            #endif
+
+            NEXT();
+        }
+        HANDLER(INSTR_AND)
+        {
+            context.registers[REG_ID_A].u = context.registers[instr->reg_a_id].u & context.registers[instr->reg_b_id].u;
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: AND reg " << (int)instr->reg_a_id << " and reg " << (int)instr->reg_b_id << " (" << context.registers[REG_ID_A].u << ")\n";
+            #endif
+
+            NEXT();
+        }
+        HANDLER(INSTR_OR)
+        {
+            context.registers[REG_ID_A].u = context.registers[instr->reg_a_id].u | context.registers[instr->reg_b_id].u;
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: OR reg " << (int)instr->reg_b_id << " from reg " << (int)instr->reg_a_id << " (" << context.registers[REG_ID_A].u << ")\n";
+            #endif
+
+            NEXT();
+        }
+        HANDLER(INSTR_XOR)
+        {
+            context.registers[REG_ID_A].u = context.registers[instr->reg_a_id].u ^ context.registers[instr->reg_b_id].u;
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: XOR reg " << (int)instr->reg_a_id << " and reg " << (int)instr->reg_b_id << " (" << context.registers[REG_ID_A].u << ")\n";
+            #endif
+
+            NEXT();
+        }
+        HANDLER(INSTR_NOT)
+        {
+            context.registers[REG_ID_A].u = context.registers[instr->reg_a_id].u;
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: NOT reg " << (int)instr->reg_a_id << " (" << context.registers[REG_ID_A].u << ")\n";
+            #endif
+
+            NEXT();
+        }
+        HANDLER(INSTR_ADD_IMM)
+        {
+            context.registers[REG_ID_A].u = context.registers[instr->reg_a_id].u + instr->imm;
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: ADD reg " << (int)instr->reg_a_id << " imm " << instr->imm << " (" << context.registers[REG_ID_A].u << ")\n";
+            #endif
+
+            NEXT();
+        }
+        HANDLER(INSTR_SUB_IMM)
+        {
+            context.registers[REG_ID_A].u = context.registers[instr->reg_a_id].u - instr->imm;
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: SUB reg " << (int)instr->reg_a_id << " imm " << instr->imm << " (" << context.registers[REG_ID_A].u << ")\n";
+            #endif
+
+            NEXT();
+        }
+        HANDLER(INSTR_MUL_IMM)
+        {
+            context.registers[REG_ID_A].u = context.registers[instr->reg_a_id].u * instr->imm;
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: MUL reg " << (int)instr->reg_a_id << " imm " << instr->imm << " (" << context.registers[REG_ID_A].u << ")\n";
+            #endif
+
+            NEXT();
+        }
+        HANDLER(INSTR_DIV_IMM)
+        {
+            context.registers[REG_ID_A].u = context.registers[instr->reg_a_id].u / instr->imm;
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: DIV reg " << (int)instr->reg_a_id << " imm " << instr->imm << " (" << context.registers[REG_ID_A].u << ")\n";
+            #endif
+
+            NEXT();
+        }
+        HANDLER(INSTR_IDIV_IMM)
+        {
+            context.registers[REG_ID_A].i = context.registers[instr->reg_a_id].i / static_cast<int32_t>(instr->imm);
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: IDIV reg " << (int)instr->reg_a_id << " imm " << instr->imm << " (" << context.registers[REG_ID_A].i << ")\n";
+            #endif
+
+            NEXT();
+        }
+        HANDLER(INSTR_SHL_IMM)
+        {
+            context.registers[REG_ID_A].u = context.registers[instr->reg_a_id].u << instr->imm;
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: SHL reg " << (int)instr->reg_a_id << " imm " << instr->imm << " (" << context.registers[REG_ID_A].u << ")\n";
+            #endif
+
+            NEXT();
+        }
+        HANDLER(INSTR_SHR_IMM)
+        {
+            context.registers[REG_ID_A].u = context.registers[instr->reg_a_id].u >> instr->imm;
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: SHR reg " << (int)instr->reg_a_id << " imm " << instr->imm << " (" << context.registers[REG_ID_A].u << ")\n";
+            #endif
+
+            NEXT();
+        }
+        HANDLER(INSTR_AND_IMM)
+        {
+            context.registers[REG_ID_A].u = context.registers[instr->reg_a_id].u & instr->imm;
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: AND reg " << (int)instr->reg_a_id << " imm " << instr->imm << " (" << context.registers[REG_ID_A].u << ")\n";
+            #endif
+
+            NEXT();
+        }
+        HANDLER(INSTR_OR_IMM)
+        {
+            context.registers[REG_ID_A].u = context.registers[instr->reg_a_id].u | instr->imm;
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: OR reg " << (int)instr->reg_a_id << " imm " << instr->imm << " (" << context.registers[REG_ID_A].u << ")\n";
+            #endif
+
+            NEXT();
+        }
+        HANDLER(INSTR_XOR_IMM)
+        {
+            context.registers[REG_ID_A].u = context.registers[instr->reg_a_id].u ^ instr->imm;
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: XOR reg " << (int)instr->reg_a_id << " imm " << instr->imm << " (" << context.registers[REG_ID_A].u << ")\n";
+            #endif
+
+            NEXT();
+        }
+        HANDLER(INSTR_FADD)
+        {
+            context.registers[REG_ID_FA].f = context.registers[instr->reg_a_id].f + context.registers[instr->reg_b_id].f;
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: FADD\n";
+            #endif
+
+            NEXT();
+        }
+        HANDLER(INSTR_FSUB)
+        {
+            context.registers[REG_ID_FA].f = context.registers[instr->reg_a_id].f - context.registers[instr->reg_b_id].f;
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: FSUB\n";
+            #endif
+
+            NEXT();
+        }
+        HANDLER(INSTR_FMUL)
+        {
+            context.registers[REG_ID_FA].f = context.registers[instr->reg_a_id].f * context.registers[instr->reg_b_id].f;
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: FMUL\n";
+            #endif
+
+            NEXT();
+        }
+        HANDLER(INSTR_FDIV)
+        {
+            context.registers[REG_ID_FA].f = context.registers[instr->reg_a_id].f / context.registers[instr->reg_b_id].f;
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: FDIV\n";
+            #endif
+
+            NEXT();
+        }
+        HANDLER(INSTR_ADD3)
+        {
+            context.registers[instr->reg_a_id].u = context.registers[instr->reg_b_id].u + context.registers[instr->reg_c_id].u;
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: ADD reg " << (int)instr->reg_b_id << " and reg " << (int)instr->reg_c_id << " to reg " << (int)instr->reg_a_id << "\n";
+            #endif
+
+            NEXT();
+        }
+        HANDLER(INSTR_SUB3)
+        {
+            context.registers[instr->reg_a_id].u = context.registers[instr->reg_b_id].u - context.registers[instr->reg_c_id].u;
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: SUB reg " << (int)instr->reg_b_id << " and reg " << (int)instr->reg_c_id << " to reg " << (int)instr->reg_a_id << "\n";
+            #endif
+
+            NEXT();
+        }
+        HANDLER(INSTR_MUL3)
+        {
+            context.registers[instr->reg_a_id].u = context.registers[instr->reg_b_id].u * context.registers[instr->reg_c_id].u;
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: MUL reg " << (int)instr->reg_b_id << " and reg " << (int)instr->reg_c_id << " to reg " << (int)instr->reg_a_id << "\n";
+            #endif
+
+            NEXT();
+        }
+        HANDLER(INSTR_DIV3)
+        {
+            context.registers[instr->reg_a_id].u = context.registers[instr->reg_b_id].u / context.registers[instr->reg_c_id].u;
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: DIV reg " << (int)instr->reg_b_id << " and reg " << (int)instr->reg_c_id << " to reg " << (int)instr->reg_a_id << "\n";
+            #endif
+
+            NEXT();
+        }
+        HANDLER(INSTR_IDIV3)
+        {
+            context.registers[instr->reg_a_id].i = context.registers[instr->reg_b_id].i / context.registers[instr->reg_c_id].i;
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: IDIV reg " << (int)instr->reg_b_id << " and reg " << (int)instr->reg_c_id << " to reg " << (int)instr->reg_a_id << "\n";
+            #endif
+
+            NEXT();
+        }
+        HANDLER(INSTR_SHL3)
+        {
+            context.registers[instr->reg_a_id].u = context.registers[instr->reg_b_id].u << context.registers[instr->reg_c_id].u;
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: SHL reg " << (int)instr->reg_b_id << " and reg " << (int)instr->reg_c_id << " to reg " << (int)instr->reg_a_id << "\n";
+            #endif
+
+            NEXT();
+        }
+        HANDLER(INSTR_SHR3)
+        {
+            context.registers[instr->reg_a_id].u = context.registers[instr->reg_b_id].u >> context.registers[instr->reg_c_id].u;
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: SHR reg " << (int)instr->reg_b_id << " and reg " << (int)instr->reg_c_id << " to reg " << (int)instr->reg_a_id << "\n";
+            #endif
+
+            NEXT();
+        }
+        HANDLER(INSTR_AND3)
+        {
+            context.registers[instr->reg_a_id].u = context.registers[instr->reg_b_id].u & context.registers[instr->reg_c_id].u;
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: AND reg " << (int)instr->reg_b_id << " and reg " << (int)instr->reg_c_id << " to reg " << (int)instr->reg_a_id << "\n";
+            #endif
+
+            NEXT();
+        }
+        HANDLER(INSTR_OR3)
+        {
+            context.registers[instr->reg_a_id].u = context.registers[instr->reg_b_id].u | context.registers[instr->reg_c_id].u;
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: OR reg " << (int)instr->reg_b_id << " and reg " << (int)instr->reg_c_id << " to reg " << (int)instr->reg_a_id << "\n";
+            #endif
+
+            NEXT();
+        }
+        HANDLER(INSTR_XOR3)
+        {
+            context.registers[instr->reg_a_id].u = context.registers[instr->reg_b_id].u ^ context.registers[instr->reg_c_id].u;
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: XOR reg " << (int)instr->reg_b_id << " and reg " << (int)instr->reg_c_id << " to reg " << (int)instr->reg_a_id << "\n";
+            #endif
+
+            NEXT();
+        }
+        HANDLER(INSTR_FADD3)
+        {
+            context.registers[instr->reg_a_id].f = context.registers[instr->reg_b_id].f + context.registers[instr->reg_c_id].f;
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: FADD reg " << (int)instr->reg_b_id << " and reg " << (int)instr->reg_c_id << " to reg " << (int)instr->reg_a_id << "\n";
+            #endif
+
+            NEXT();
+        }
+        HANDLER(INSTR_FSUB3)
+        {
+            context.registers[instr->reg_a_id].f = context.registers[instr->reg_b_id].f - context.registers[instr->reg_c_id].f;
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: FSUB reg " << (int)instr->reg_b_id << " and reg " << (int)instr->reg_c_id << " to reg " << (int)instr->reg_a_id << "\n";
+            #endif
+
+            NEXT();
+        }
+        HANDLER(INSTR_FMUL3)
+        {
+            context.registers[instr->reg_a_id].f = context.registers[instr->reg_b_id].f * context.registers[instr->reg_c_id].f;
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: FMUL reg " << (int)instr->reg_b_id << " and reg " << (int)instr->reg_c_id << " to reg " << (int)instr->reg_a_id << "\n";
+            #endif
+
+            NEXT();
+        }
+        HANDLER(INSTR_FDIV3)
+        {
+            context.registers[instr->reg_a_id].f = context.registers[instr->reg_b_id].f / context.registers[instr->reg_c_id].f;
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: FDIV reg " << (int)instr->reg_b_id << " and reg " << (int)instr->reg_c_id << " to reg " << (int)instr->reg_a_id << "\n";
+            #endif
+
+            NEXT();
+        }
+        PAIR_OP_HANDLER(ADD64, uint64_t, +)
+        PAIR_OP_HANDLER(SUB64, uint64_t, -)
+        PAIR_OP_HANDLER(MUL64, uint64_t, *)
+        PAIR_OP_HANDLER(DIV64, uint64_t, /)
+        PAIR_OP_HANDLER(IDIV64, int64_t, /)
+        PAIR_OP_HANDLER(DADD, double, +)
+        PAIR_OP_HANDLER(DSUB, double, -)
+        PAIR_OP_HANDLER(DMUL, double, *)
+        PAIR_OP_HANDLER(DDIV, double, /)
+        PAIR_COMPARE_HANDLER(CMP64, uint64_t)
+        PAIR_COMPARE_HANDLER(CMPI64, int64_t)
+        PAIR_COMPARE_HANDLER(DCMP, double)
+        HANDLER(INSTR_FTOD)
         {
-            if (reg_b <= 3)
-            {
-                printf("%d\n", *(uint32_t*)get_register(reg_b));
-            }
-            else
-            {
-                printf("%f\n", *(float*)get_register(reg_b));
-            }
-            break;
+            context.set_pair<double>(instr->reg_a_id, context.registers[instr->reg_b_id].f);
+            ip++;
+            PAIR_DEBUG(INSTR_FTOD_STR);
+            NEXT();
         }
-        case SYSCALL_ID_PRINTF:
+        HANDLER(INSTR_DTOF)
         {
-            printf((char*)&memory[reg_b]);
-            break;
+            context.registers[instr->reg_a_id].f = static_cast<float>(context.pair<double>(instr->reg_b_id));
+            ip++;
+            PAIR_DEBUG(INSTR_DTOF_STR);
+            NEXT();
         }
-        case SYSCALL_ID_WINDOW_CREATE:
+        // Same operand order and NaN handling as minss/maxss, so the JIT gives identical results
+        FLOAT_MATH3_HANDLER(FMIN, b < c ? b : c)
+        FLOAT_MATH3_HANDLER(FMAX, b > c ? b : c)
+        FLOAT_MATH3_HANDLER(FFMA, std::fma(b, c, context.registers[instr->reg_a_id].f))
+        FLOAT_MATH_HANDLER(FSQRT, std::sqrt(b))
+        FLOAT_MATH_HANDLER(FABS, std::fabs(b))
+        FLOAT_MATH_HANDLER(FFLOOR, std::floor(b))
+        FLOAT_MATH_HANDLER(FSIN, std::sin(b))
+        FLOAT_MATH_HANDLER(FCOS, std::cos(b))
+        HANDLER(INSTR_CMP)
         {
-            VirtualWindow window;
-            window.window = SDL_CreateWindow((char*)&memory[reg_d], SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
-                reg_b, reg_c, 0);
+            context.compare<uint32_t>(context.registers[instr->reg_a_id].u, context.registers[instr->reg_b_id].u);
+            ip++;
             
-            window.renderer = SDL_CreateRenderer(window.window, -1, 0);
-            
-            reg_a = windows.size();
-            windows.push_back(window);
-            break;
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: CMP " << context.registers[instr->reg_a_id].u << " to " << context.registers[instr->reg_b_id].u << " (" <<
+                context.flag_zero << " " << context.flag_sign << ")\n";
+            #endif
+
+            NEXT();
         }
-        case SYSCALL_ID_WINDOW_CLOSE:
+        HANDLER(INSTR_CMPI)
         {
-            SDL_DestroyRenderer(windows[reg_b].renderer);
-            SDL_DestroyWindow(windows[reg_b].window);
-            windows[reg_b].renderer = nullptr;
-            windows[reg_b].window = nullptr;
-            break;
+            context.compare<int32_t>(context.registers[instr->reg_a_id].i, context.registers[instr->reg_b_id].i);
+            ip++;
+            
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: CMPI\n";
+            #endif
+
+            NEXT();
         }
-        case SYSCALL_ID_WINDOW_IS_VALID:
+        HANDLER(INSTR_CMPF)
         {
-            reg_a = (windows.size() > reg_b && windows[reg_b].window) ? 1 : 0;
-            break;
+            context.compare<float>(context.registers[instr->reg_a_id].f, context.registers[instr->reg_b_id].f);
+            ip++;
+            
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: CMPF\n";
+            #endif
+
+            NEXT();
         }
-        case SYSCALL_ID_WINDOW_SET_PIXEL:
+        HANDLER(INSTR_CMP_IMM)
         {
-            SDL_SetRenderDrawColor(windows[reg_b].renderer, memory[reg_stack_ptr - 12],
-                memory[reg_stack_ptr - 8], memory[reg_stack_ptr - 4], 255);
-            SDL_RenderDrawPoint(windows[reg_b].renderer, reg_c, reg_d);
-            reg_stack_ptr -= 12;
-            break;
+            context.compare<uint32_t>(context.registers[instr->reg_a_id].u, instr->imm);
+            ip++;
+            
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: CMP " << context.registers[instr->reg_a_id].u << " to imm " << instr->imm << " (" <<
+                context.flag_zero << " " << context.flag_sign << ")\n";
+            #endif
+
+            NEXT();
         }
-        case SYSCALL_ID_WINDOW_CLEAR:
+        HANDLER(INSTR_CMPI_IMM)
         {
-            SDL_SetRenderDrawColor(windows[reg_b].renderer, reg_c, reg_d,
-                memory[reg_stack_ptr - 4], 255);
-            SDL_RenderClear(windows[reg_b].renderer);
-            reg_stack_ptr -= 4;
-            break;
+            context.compare<int32_t>(context.registers[instr->reg_a_id].i, static_cast<int32_t>(instr->imm));
+            ip++;
+            
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: CMPI imm\n";
+            #endif
+
+            NEXT();
         }
-        case SYSCALL_ID_WINDOW_UPDATE:
+        HANDLER(INSTR_PUSH)
         {
-            SDL_RenderPresent(windows[reg_b].renderer);
-            break;
+            SYNC_IP();
+            write_int(&memory[context.reg_stack_ptr], context.registers[instr->reg_a_id].u);
+            context.reg_stack_ptr += 4;
+
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: PUSH\n";
+            #endif
+
+            NEXT();
         }
-        case SYSCALL_ID_WINDOW_GET_MOUSE_X:
+        HANDLER(INSTR_POP)
         {
-            int mouse_x;
-            SDL_GetMouseState(&mouse_x, NULL);
-            reg_a = mouse_x;
-            break;
+            SYNC_IP();
+            context.reg_stack_ptr -= 4;
+            context.registers[instr->reg_a_id].u = load_int(&memory[context.reg_stack_ptr]);
+
+            ip++;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: POP value " << context.registers[instr->reg_a_id].u << " into reg " << (int)instr->reg_a_id << "\n";
+            #endif
+
+            NEXT();
         }
-        case SYSCALL_ID_WINDOW_GET_MOUSE_Y:
+        HANDLER(INSTR_CALL)
         {
-            int mouse_y;
-            SDL_GetMouseState(NULL, &mouse_y);
-            reg_a = mouse_y;
-            break;
+            SYNC_IP();
+            // Return address is pushed as a byte address to keep the stack layout independent of decoding
+            uint32_t ip_next = instructions[ip + 1].addr;
+
+            write_int(&memory[context.reg_stack_ptr], ip_next);
+            context.reg_stack_ptr += 4;
+
+            write_int(&memory[context.reg_stack_ptr], context.reg_base_ptr);
+            context.reg_stack_ptr += 4;
+
+            context.reg_base_ptr = context.reg_stack_ptr - 8;
+
+            ip = instr->target;
+
+            POLL_EVENTS_TICK();
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: CALL\n";
+            #endif
+
+            NEXT();
         }
-        case SYSCALL_ID_WINDOW_GET_KEY_STATE:
+        HANDLER(INSTR_RET)
         {
-            reg_a = SDL_GetKeyboardState(NULL)[reg_b];
-            break;
-        }
-    }
-}
+            SYNC_IP();
+            context.reg_stack_ptr = context.reg_base_ptr;
+            ip = decoded_program.index_from_addr(load_int(&memory[context.reg_stack_ptr]));
+            context.reg_base_ptr = load_int(&memory[context.reg_stack_ptr + 4]);
 
-void VirtualMachine::process_instruction()
-{
-    uint8_t instruction = program[reg_instruction_ptr];
-    switch (instruction)
-    {
-        case INSTR_LOAD:
+            POLL_EVENTS_TICK();
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: RET\n";
+            #endif
+
+            NEXT();
+        }
+        HANDLER(INSTR_TAILCALL)
         {
-            uint8_t reg_id = program[reg_instruction_ptr + 1];
-            uint8_t addr_reg_id = program[reg_instruction_ptr + 2];
-            *(uint32_t*)get_register(reg_id) = load_int(&memory[*(uint32_t*)get_register(addr_reg_id)]);
-            reg_instruction_ptr += 3;
+            // Return address and caller's bp stay where the current call put them
+            context.reg_stack_ptr = context.reg_base_ptr + 8;
+            ip = instr->target;
+
+            POLL_EVENTS_TICK();
 
             #if PRINT_DEBUG
-            std::cout << "INSTRUCTION: LOAD " << *(uint32_t*)get_register(reg_id) << " into reg " << (int)reg_id << "\n";
+            std::cout << "INSTRUCTION: TAILCALL\n";
             #endif
 
-            break;
+            NEXT();
         }
-        case INSTR_LOADS:
+        HANDLER(INSTR_ENTER)
         {
-            uint8_t reg_id = program[reg_instruction_ptr + 1];
-            int32_t offset = load_int(&program[reg_instruction_ptr + 2]);
-            *(uint32_t*)get_register(reg_id) = load_int(&memory[reg_base_ptr + offset]);
-            reg_instruction_ptr += 6;
+            context.reg_stack_ptr += instr->imm;
+            ip++;
 
             #if PRINT_DEBUG
-            std::cout << "INSTRUCTION: LOADS " << *(uint32_t*)get_register(reg_id) << " into reg " << (int)reg_id << "\n";
+            std::cout << "INSTRUCTION: ENTER " << instr->imm << "\n";
             #endif
 
-            break;
+            NEXT();
         }
-        case INSTR_LOADC:
+        HANDLER(INSTR_LEAVE)
         {
-            uint8_t reg_id = program[reg_instruction_ptr + 1];
-            uint32_t value = load_int(&program[reg_instruction_ptr + 2]);
-            *(uint32_t*)get_register(reg_id) = value;
-            reg_instruction_ptr += 6;
+            context.reg_stack_ptr = context.reg_base_ptr + 8;
+            ip++;
 
             #if PRINT_DEBUG
-            std::cout << "INSTRUCTION: LOADC " << value << " into reg " << (int)reg_id << "\n";
+            std::cout << "INSTRUCTION: LEAVE\n";
             #endif
 
-            break;
+            NEXT();
         }
-        case INSTR_STORE:
+        HANDLER(INSTR_SYSCALL)
         {
-            uint8_t reg_id = program[reg_instruction_ptr + 1];
-            uint8_t addr_reg_id = program[reg_instruction_ptr + 2];
-            uint32_t addr = *(uint32_t*)get_register(addr_reg_id);
-            write_int(&memory[addr], *(uint32_t*)get_register(reg_id));
-            reg_instruction_ptr += 3;
+            uint8_t syscall_id = instr->imm;
 
             #if PRINT_DEBUG
-            std::cout << "INSTRUCTION: STORE " << *(uint32_t*)get_register(reg_id) << " in addr " << addr << "\n";
+            std::cout << "INSTRUCTION: SYSCALL id " << (int)syscall_id << "\n";
             #endif
+            
+            context.reg_instruction_ptr = ip;
+            dispatch_syscall(context, syscall_id);
+            POLL_EVENTS_TICK();
 
-            break;
+            ip++;
+
+            NEXT();
         }
-        case INSTR_STORES:
+        HANDLER(INSTR_STOP)
         {
-            uint8_t reg_id = program[reg_instruction_ptr + 1];
-            uint32_t addr = reg_base_ptr + load_int(&program[reg_instruction_ptr + 2]);
-            write_int(&memory[addr], *(uint32_t*)get_register(reg_id));
-            reg_instruction_ptr += 6;
+            // End of program
+            context.reg_instruction_ptr = ip;
 
             #if PRINT_DEBUG
-            std::cout << "INSTRUCTION: STORES " << *(uint32_t*)get_register(reg_id) << " in stack addr " << addr << "\n";
+            std::cout << "INSTRUCTION: STOP\n";
             #endif
 
-            break;
+            return;
         }
-        case INSTR_COPY:
+        HANDLER(INSTR_JMP)
         {
-            uint8_t reg_src_id = program[reg_instruction_ptr + 1];
-            uint8_t reg_dest_id = program[reg_instruction_ptr + 2];
+            ip = instr->target;
 
-            bool casted = false;
-            if (reg_src_id <= 3)
-            {
-                if (reg_dest_id > 3)
-                {
-                    float value = (float)*(uint32_t*)get_register(reg_src_id);
-                    memcpy(get_register(reg_dest_id), &value, 4);
-                    casted = true;
-                }
-            }
-            else
-            {
-                if (reg_dest_id <= 3)
-                {
-                    uint32_t value = (uint32_t)*(float*)get_register(reg_src_id);
-                    memcpy(get_register(reg_dest_id), &value, 4);
-                    casted = true;
-                }
-            }
+            POLL_EVENTS_TICK();
 
-            if (!casted)
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: JMP to addr " << instr->imm << "\n";
+            #endif
+
+            NEXT();
+        }
+        HANDLER(INSTR_JMPZ)
+        {
+            if (!context.flag_zero)
             {
-                memcpy(get_register(reg_dest_id), get_register(reg_src_id), 4);
+                ip++;
+                NEXT();
             }
 
-            reg_instruction_ptr += 3;
+            ip = instr->target;
+
+            POLL_EVENTS_TICK();
 
             #if PRINT_DEBUG
-            std::cout << "INSTRUCTION: COPY reg " << (int)reg_src_id << " to reg " << (int)reg_dest_id << "\n";
+            std::cout << "INSTRUCTION: JMPZ to addr " << instr->imm << "\n";
             #endif
 
-            break;
+            NEXT();
         }
-        case INSTR_ADD:
+        HANDLER(INSTR_JMPS)
         {
-            uint8_t reg_a_id = program[reg_instruction_ptr + 1];
-            uint8_t reg_b_id = program[reg_instruction_ptr + 2];
-            uint32_t result = *(uint32_t*)get_register(reg_a_id) + *(uint32_t*)get_register(reg_b_id);
-            reg_a = result;
+            if (!context.flag_sign)
+            {
+                ip++;
+                NEXT();
+            }
 
-            reg_instruction_ptr += 3;
+            ip = instr->target;
+
+            POLL_EVENTS_TICK();
 
             #if PRINT_DEBUG
-            std::cout << "INSTRUCTION: ADD reg " << (int)reg_a_id << " and reg " << (int)reg_b_id << " (" << result << ")\n";
+            std::cout << "INSTRUCTION: JMPS to addr " << instr->imm << "\n";
             #endif
 
-            break;
+            NEXT();
         }
-        case INSTR_SUB:
+        HANDLER(INSTR_JMPC)
         {
-            uint8_t reg_a_id = program[reg_instruction_ptr + 1];
-            uint8_t reg_b_id = program[reg_instruction_ptr + 2];
-            uint32_t result = *(uint32_t*)get_register(reg_a_id) - *(uint32_t*)get_register(reg_b_id);
-            reg_a = result;
+            if (!context.flag_carry)
+            {
+                ip++;
+                NEXT();
+            }
 
-            reg_instruction_ptr += 3;
+            ip = instr->target;
+
+            POLL_EVENTS_TICK();
 
             #if PRINT_DEBUG
-            std::cout << "INSTRUCTION: SUB reg " << (int)reg_b_id << " from reg " << (int)reg_a_id << " (" << result << ")\n";
+            std::cout << "INSTRUCTION: JMPC to addr " << instr->imm << "\n";
             #endif
 
-            break;
+            NEXT();
         }
-        case INSTR_MUL:
+        BRANCH_HANDLER(BEQ, u, ==)
+        BRANCH_HANDLER(BNE, u, !=)
+        BRANCH_HANDLER(BLT, u, <)
+        BRANCH_HANDLER(BGE, u, >=)
+        BRANCH_HANDLER(BLTI, i, <)
+        BRANCH_HANDLER(BGEI, i, >=)
+        BRANCH_HANDLER(BEQF, f, ==)
+        BRANCH_HANDLER(BNEF, f, !=)
+        BRANCH_HANDLER(BLTF, f, <)
+        BRANCH_HANDLER(BGEF, f, >=)
+        HANDLER(INSTR_VLOAD)
         {
-            uint8_t reg_a_id = program[reg_instruction_ptr + 1];
-            uint8_t reg_b_id = program[reg_instruction_ptr + 2];
-            uint32_t result = *(uint32_t*)get_register(reg_a_id) * *(uint32_t*)get_register(reg_b_id);
-            reg_a = result;
-
-            reg_instruction_ptr += 3;
+            SYNC_IP();
+            uint32_t addr = context.registers[instr->reg_b_id].u;
+            vector_load(context.vectors[instr->reg_a_id], &memory[addr]);
+            ip++;
 
             #if PRINT_DEBUG
-            std::cout << "INSTRUCTION: MUL reg " << (int)reg_a_id << " and reg " << (int)reg_b_id << " (" << result << ")\n";
+            std::cout << "INSTRUCTION: VLOAD from addr " << addr << " into vreg " << (int)instr->reg_a_id << "\n";
             #endif
 
-            break;
+            NEXT();
         }
-        case INSTR_DIV:
+        HANDLER(INSTR_VLOADA)
         {
-            uint8_t reg_a_id = program[reg_instruction_ptr + 1];
-            uint8_t reg_b_id = program[reg_instruction_ptr + 2];
-            uint32_t result = *(uint32_t*)get_register(reg_a_id) / *(uint32_t*)get_register(reg_b_id);
-            reg_a = result;
-
-            reg_instruction_ptr += 3;
+            SYNC_IP();
+            uint32_t addr = context.registers[instr->reg_b_id].u;
+            CHECK_ALIGNED(vector_aligned(addr), addr, "vector");
+            vector_load(context.vectors[instr->reg_a_id], &memory[addr]);
+            ip++;
 
             #if PRINT_DEBUG
-            std::cout << "INSTRUCTION: DIV reg " << (int)reg_a_id << " by reg " << (int)reg_b_id << " (" << result << ")\n";
+            std::cout << "INSTRUCTION: VLOADA from addr " << addr << " into vreg " << (int)instr->reg_a_id << "\n";
             #endif
 
-            break;
+            NEXT();
         }
-        case INSTR_IDIV:
+        HANDLER(INSTR_VSTORE)
         {
-            uint8_t reg_a_id = program[reg_instruction_ptr + 1];
-            uint8_t reg_b_id = program[reg_instruction_ptr + 2];
-            int32_t result = *(int32_t*)get_register(reg_a_id) / *(int32_t*)get_register(reg_b_id);
-            memcpy(&reg_a, &result, 4);
-
-            reg_instruction_ptr += 3;
+            SYNC_IP();
+            uint32_t addr = context.registers[instr->reg_b_id].u;
+            vector_store(&memory[addr], context.vectors[instr->reg_a_id]);
+            ip++;
 
             #if PRINT_DEBUG
-            std::cout << "INSTRUCTION: IDIV reg " << (int)reg_a_id << " by reg " << (int)reg_b_id << " (" << result << ")\n";
+            std::cout << "INSTRUCTION: VSTORE vreg " << (int)instr->reg_a_id << " at addr " << addr << "\n";
             #endif
 
-            break;
+            NEXT();
         }
-        case INSTR_SHL:
+        HANDLER(INSTR_VSTOREA)
         {
-            uint8_t reg_a_id = program[reg_instruction_ptr + 1];
-            uint8_t reg_b_id = program[reg_instruction_ptr + 2];
-            uint32_t result = *(uint32_t*)get_register(reg_a_id) << *(uint32_t*)get_register(reg_b_id);
-            reg_a = result;
+            SYNC_IP();
+            uint32_t addr = context.registers[instr->reg_b_id].u;
+            CHECK_ALIGNED(vector_aligned(addr), addr, "vector");
+            vector_store(&memory[addr], context.vectors[instr->reg_a_id]);
+            ip++;
 
-            reg_instruction_ptr += 3;
-            
             #if PRINT_DEBUG
-            std::cout << "INSTRUCTION: SHL\n";
+            std::cout << "INSTRUCTION: VSTOREA vreg " << (int)instr->reg_a_id << " at addr " << addr << "\n";
             #endif
 
-            break;
+            NEXT();
         }
-        case INSTR_SHR:
+        HANDLER(INSTR_VCOPY)
         {
-            uint8_t reg_a_id = program[reg_instruction_ptr + 1];
-            uint8_t reg_b_id = program[reg_instruction_ptr + 2];
-            uint32_t result = *(uint32_t*)get_register(reg_a_id) >> *(uint32_t*)get_register(reg_b_id);
-            reg_a = result;
-
-            reg_instruction_ptr += 3;
+            // Same operand order as copy
+            context.vectors[instr->reg_b_id] = context.vectors[instr->reg_a_id];
+            ip++;
 
             #if PRINT_DEBUG
-            std::cout << "INSTRUCTION: SHR\n";
+            std::cout << "INSTRUCTION: VCOPY vreg " << (int)instr->reg_a_id << " to vreg " << (int)instr->reg_b_id << "\n";
             #endif
 
-            break;
+            NEXT();
         }
-        case INSTR_AND:
+        HANDLER(INSTR_VSPLAT)
         {
-            uint8_t reg_a_id = program[reg_instruction_ptr + 1];
-            uint8_t reg_b_id = program[reg_instruction_ptr + 2];
-            uint32_t result = *(uint32_t*)get_register(reg_a_id) & *(uint32_t*)get_register(reg_b_id);
-            reg_a = result;
-
-            reg_instruction_ptr += 3;
+            // Raw bits, so int and float registers both splat to lanes of their own type
+            vector_splat(context.vectors[instr->reg_a_id], context.registers[instr->reg_b_id].u);
+            ip++;
 
             #if PRINT_DEBUG
-            std::cout << "INSTRUCTION: AND reg " << (int)reg_a_id << " and reg " << (int)reg_b_id << " (" << result << ")\n";
+            std::cout << "INSTRUCTION: VSPLAT reg " << (int)instr->reg_b_id << " into vreg " << (int)instr->reg_a_id << "\n";
             #endif
 
-            break;
+            NEXT();
         }
-        case INSTR_OR:
+        HANDLER(INSTR_VEXTRACT)
         {
-            uint8_t reg_a_id = program[reg_instruction_ptr + 1];
-            uint8_t reg_b_id = program[reg_instruction_ptr + 2];
-            uint32_t result = *(uint32_t*)get_register(reg_a_id) | *(uint32_t*)get_register(reg_b_id);
-            reg_a = result;
-
-            reg_instruction_ptr += 3;
+            context.registers[instr->reg_a_id].u = context.vectors[instr->reg_b_id].u[instr->imm];
+            ip++;
 
             #if PRINT_DEBUG
-            std::cout << "INSTRUCTION: OR reg " << (int)reg_b_id << " from reg " << (int)reg_a_id << " (" << result << ")\n";
+            std::cout << "INSTRUCTION: VEXTRACT lane " << instr->imm << " of vreg " << (int)instr->reg_b_id << " (" <<
+                context.registers[instr->reg_a_id].u << ")\n";
             #endif
 
-            break;
+            NEXT();
         }
-        case INSTR_XOR:
+        HANDLER(INSTR_VINSERT)
         {
-            uint8_t reg_a_id = program[reg_instruction_ptr + 1];
-            uint8_t reg_b_id = program[reg_instruction_ptr + 2];
-            uint32_t result = *(uint32_t*)get_register(reg_a_id) ^ *(uint32_t*)get_register(reg_b_id);
-            reg_a = result;
-
-            reg_instruction_ptr += 3;
+            context.vectors[instr->reg_a_id].u[instr->imm] = context.registers[instr->reg_b_id].u;
+            ip++;
 
             #if PRINT_DEBUG
-            std::cout << "INSTRUCTION: XOR reg " << (int)reg_a_id << " and reg " << (int)reg_b_id << " (" << result << ")\n";
+            std::cout << "INSTRUCTION: VINSERT reg " << (int)instr->reg_b_id << " into lane " << instr->imm << " of vreg " <<
+                (int)instr->reg_a_id << "\n";
             #endif
 
-            break;
+            NEXT();
         }
-        case INSTR_NOT:
+        HANDLER(INSTR_VSHUF)
         {
-            uint8_t reg_id = program[reg_instruction_ptr + 1];
-            reg_a = *(uint32_t*)get_register(reg_id);
-
-            reg_instruction_ptr += 2;
+            vector_shuffle(context.vectors[instr->reg_a_id], context.vectors[instr->reg_b_id], instr->imm);
+            ip++;
 
             #if PRINT_DEBUG
-            std::cout << "INSTRUCTION: NOT reg " << (int)reg_id << " (" << reg_a << ")\n";
+            std::cout << "INSTRUCTION: VSHUF vreg " << (int)instr->reg_b_id << " into vreg " << (int)instr->reg_a_id << " (" <<
+                instr->imm << ")\n";
             #endif
 
-            break;
+            NEXT();
         }
-        case INSTR_FADD:
+        VECTOR_OP_HANDLER(VADD, vector_add_i32)
+        VECTOR_OP_HANDLER(VSUB, vector_sub_i32)
+        VECTOR_OP_HANDLER(VMUL, vector_mul_i32)
+        VECTOR_OP_HANDLER(VMIN, vector_min_i32)
+        VECTOR_OP_HANDLER(VMAX, vector_max_i32)
+        VECTOR_OP_HANDLER(VCMPEQ, vector_cmpeq_i32)
+        VECTOR_OP_HANDLER(VCMPGT, vector_cmpgt_i32)
+        VECTOR_OP_HANDLER(VAND, vector_and)
+        VECTOR_OP_HANDLER(VOR, vector_or)
+        VECTOR_OP_HANDLER(VXOR, vector_xor)
+        VECTOR_OP_HANDLER(VFADD, vector_add_f32)
+        VECTOR_OP_HANDLER(VFSUB, vector_sub_f32)
+        VECTOR_OP_HANDLER(VFMUL, vector_mul_f32)
+        VECTOR_OP_HANDLER(VFMIN, vector_min_f32)
+        VECTOR_OP_HANDLER(VFMAX, vector_max_f32)
+        VECTOR_OP_HANDLER(VFCMPEQ, vector_cmpeq_f32)
+        VECTOR_OP_HANDLER(VFCMPLT, vector_cmplt_f32)
+        HANDLER(FUSED_LOADC_ADD)
         {
-            uint8_t reg_a_id = program[reg_instruction_ptr + 1];
-            uint8_t reg_b_id = program[reg_instruction_ptr + 2];
-            float result = *(float*)get_register(reg_a_id) + *(float*)get_register(reg_b_id);
-            reg_fa = result;
-
-            reg_instruction_ptr += 3;
+            context.registers[instr->reg_a_id].u = instr->imm;
+            context.registers[REG_ID_A].u = context.registers[instr->reg_b_id].u + context.registers[instr->reg_c_id].u;
+            ip += 2;
 
             #if PRINT_DEBUG
-            std::cout << "INSTRUCTION: FADD\n";
+            std::cout << "INSTRUCTION: LOADC+ADD\n";
             #endif
 
-            break;
+            NEXT();
         }
-        case INSTR_FSUB:
+        HANDLER(FUSED_LOADC_SUB)
         {
-            uint8_t reg_a_id = program[reg_instruction_ptr + 1];
-            uint8_t reg_b_id = program[reg_instruction_ptr + 2];
-            float result = *(float*)get_register(reg_a_id) - *(float*)get_register(reg_b_id);
-            reg_fa = result;
+            context.registers[instr->reg_a_id].u = instr->imm;
+            context.registers[REG_ID_A].u = context.registers[instr->reg_b_id].u - context.registers[instr->reg_c_id].u;
+            ip += 2;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: LOADC+SUB\n";
+            #endif
 
-            reg_instruction_ptr += 3;
+            NEXT();
+        }
+        HANDLER(FUSED_LOADC_MUL)
+        {
+            context.registers[instr->reg_a_id].u = instr->imm;
+            context.registers[REG_ID_A].u = context.registers[instr->reg_b_id].u * context.registers[instr->reg_c_id].u;
+            ip += 2;
 
             #if PRINT_DEBUG
-            std::cout << "INSTRUCTION: FSUB\n";
+            std::cout << "INSTRUCTION: LOADC+MUL\n";
             #endif
 
-            break;
+            NEXT();
         }
-        case INSTR_FMUL:
+        HANDLER(FUSED_LOADC_SHL)
         {
-            uint8_t reg_a_id = program[reg_instruction_ptr + 1];
-            uint8_t reg_b_id = program[reg_instruction_ptr + 2];
-            float result = *(float*)get_register(reg_a_id) * *(float*)get_register(reg_b_id);
-            reg_fa = result;
+            context.registers[instr->reg_a_id].u = instr->imm;
+            context.registers[REG_ID_A].u = context.registers[instr->reg_b_id].u << context.registers[instr->reg_c_id].u;
+            ip += 2;
 
-            reg_instruction_ptr += 3;
-            
             #if PRINT_DEBUG
-            std::cout << "INSTRUCTION: FMUL\n";
+            std::cout << "INSTRUCTION: LOADC+SHL\n";
             #endif
 
-            break;
+            NEXT();
         }
-        case INSTR_FDIV:
+        HANDLER(FUSED_LOADC_SHR)
         {
-            uint8_t reg_a_id = program[reg_instruction_ptr + 1];
-            uint8_t reg_b_id = program[reg_instruction_ptr + 2];
-            float result = *(float*)get_register(reg_a_id) / *(float*)get_register(reg_b_id);
-            reg_fa = result;
+            context.registers[instr->reg_a_id].u = instr->imm;
+            context.registers[REG_ID_A].u = context.registers[instr->reg_b_id].u >> context.registers[instr->reg_c_id].u;
+            ip += 2;
+
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: LOADC+SHR\n";
+            #endif
 
-            reg_instruction_ptr += 3;
+            NEXT();
+        }
+        HANDLER(FUSED_LOADC_AND)
+        {
+            context.registers[instr->reg_a_id].u = instr->imm;
+            context.registers[REG_ID_A].u = context.registers[instr->reg_b_id].u & context.registers[instr->reg_c_id].u;
+            ip += 2;
 
             #if PRINT_DEBUG
-            std::cout << "INSTRUCTION: FDIV\n";
+            std::cout << "INSTRUCTION: LOADC+AND\n";
             #endif
 
-            break;
+            NEXT();
         }
-        case INSTR_CMP:
+        HANDLER(FUSED_LOADC_OR)
         {
-            reset_flags();
+            context.registers[instr->reg_a_id].u = instr->imm;
+            context.registers[REG_ID_A].u = context.registers[instr->reg_b_id].u | context.registers[instr->reg_c_id].u;
+            ip += 2;
 
-            uint32_t reg_a_value = *(uint32_t*)get_register(program[reg_instruction_ptr + 1]);
-            uint32_t reg_b_value = *(uint32_t*)get_register(program[reg_instruction_ptr + 2]);
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: LOADC+OR\n";
+            #endif
 
-            if (reg_a_value == reg_b_value)
-            {
-                flag_zero = 1;
-            }
-            else
-            {
-                flag_sign = reg_a_value > reg_b_value ? 0 : 1;
-            }
+            NEXT();
+        }
+        HANDLER(FUSED_LOADC_XOR)
+        {
+            context.registers[instr->reg_a_id].u = instr->imm;
+            context.registers[REG_ID_A].u = context.registers[instr->reg_b_id].u ^ context.registers[instr->reg_c_id].u;
+            ip += 2;
 
-            reg_instruction_ptr += 3;
-            
             #if PRINT_DEBUG
-            std::cout << "INSTRUCTION: CMP " << reg_a_value << " to " << reg_b_value << " (" <<
-                flag_zero << " " << flag_sign << ")\n";
+            std::cout << "INSTRUCTION: LOADC+XOR\n";
             #endif
 
-            break;
+            NEXT();
         }
-        case INSTR_CMPI:
+        HANDLER(FUSED_LOADC_LOAD)
         {
-            reset_flags();
+            // Only the second instruction of the pair touches memory
+            context.reg_instruction_ptr = ip + 1;
+            context.registers[instr->reg_a_id].u = instr->imm;
+            context.registers[instr->reg_b_id].u = load_int(&memory[context.registers[instr->reg_c_id].u]);
+            ip += 2;
 
-            int32_t reg_a_value = *(int32_t*)get_register(program[reg_instruction_ptr + 1]);
-            int32_t reg_b_value = *(int32_t*)get_register(program[reg_instruction_ptr + 2]);
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: LOADC+LOAD\n";
+            #endif
 
-            if (reg_a_value == reg_b_value)
-            {
-                flag_zero = 1;
-            }
-            else
-            {
-                flag_sign = reg_a_value > reg_b_value ? 0 : 1;
-            }
+            NEXT();
+        }
+        HANDLER(FUSED_LOADC_PUSH)
+        {
+            // Only the second instruction of the pair touches memory
+            context.reg_instruction_ptr = ip + 1;
+            context.registers[instr->reg_a_id].u = instr->imm;
+            write_int(&memory[context.reg_stack_ptr], context.registers[instr->reg_b_id].u);
+            context.reg_stack_ptr += 4;
+            ip += 2;
 
-            reg_instruction_ptr += 3;
-            
             #if PRINT_DEBUG
-            std::cout << "INSTRUCTION: CMPI\n";
+            std::cout << "INSTRUCTION: LOADC+PUSH\n";
             #endif
 
-            break;
+            NEXT();
         }
-        case INSTR_CMPF:
+        HANDLER(FUSED_PUSH_POP)
         {
-            reset_flags();
+            SYNC_IP();
+            // Value is still written so memory matches the unfused pair
+            write_int(&memory[context.reg_stack_ptr], context.registers[instr->reg_a_id].u);
+            context.registers[instr->reg_b_id].u = context.registers[instr->reg_a_id].u;
+            ip += 2;
 
-            float reg_a_value = *(float*)get_register(program[reg_instruction_ptr + 1]);
-            float reg_b_value = *(float*)get_register(program[reg_instruction_ptr + 2]);
+            #if PRINT_DEBUG
+            std::cout << "INSTRUCTION: PUSH+POP\n";
+            #endif
 
-            if (reg_a_value == reg_b_value)
-            {
-                flag_zero = 1;
-            }
-            else
-            {
-                flag_sign = reg_a_value > reg_b_value ? 0 : 1;
-            }
+            NEXT();
+        }
+        HANDLER(FUSED_POP_POP)
+        {
+            SYNC_IP();
+            context.registers[instr->reg_a_id].u = load_int(&memory[context.reg_stack_ptr - 4]);
+            context.registers[instr->reg_b_id].u = load_int(&memory[context.reg_stack_ptr - 8]);
+            context.reg_stack_ptr -= 8;
+            ip += 2;
 
-            reg_instruction_ptr += 3;
-            
             #if PRINT_DEBUG
-            std::cout << "INSTRUCTION: CMPF\n";
+            std::cout << "INSTRUCTION: POP+POP\n";
             #endif
 
-            break;
+            NEXT();
         }
-        case INSTR_PUSH:
+        HANDLER(FUSED_CMP_JMPZ)
         {
-            uint8_t reg_id = program[reg_instruction_ptr + 1];
-            write_int(&memory[reg_stack_ptr], *(uint32_t*)get_register(reg_id));
-            reg_stack_ptr += 4;
+            context.compare<uint32_t>(context.registers[instr->reg_a_id].u, context.registers[instr->reg_b_id].u);
+
+            if (!context.flag_zero)
+            {
+                ip += 2;
+                NEXT();
+            }
 
-            reg_instruction_ptr += 2;
+            ip = instr->target;
+
+            POLL_EVENTS_TICK();
 
             #if PRINT_DEBUG
-            std::cout << "INSTRUCTION: PUSH\n";
+            std::cout << "INSTRUCTION: CMP+JMPZ to addr " << instr->imm << "\n";
             #endif
 
-            break;
+            NEXT();
         }
-        case INSTR_POP:
+        HANDLER(FUSED_CMP_JMPS)
         {
-            uint8_t reg_id = program[reg_instruction_ptr + 1];
-            reg_stack_ptr -= 4;
-            *(uint32_t*)get_register(reg_id) = load_int(&memory[reg_stack_ptr]);
+            context.compare<uint32_t>(context.registers[instr->reg_a_id].u, context.registers[instr->reg_b_id].u);
+
+            if (!context.flag_sign)
+            {
+                ip += 2;
+                NEXT();
+            }
 
-            reg_instruction_ptr += 2;
+            ip = instr->target;
+
+            POLL_EVENTS_TICK();
 
             #if PRINT_DEBUG
-            std::cout << "INSTRUCTION: POP value " << *(uint32_t*)get_register(reg_id) << " into reg " << (int)reg_id << "\n";
+            std::cout << "INSTRUCTION: CMP+JMPS to addr " << instr->imm << "\n";
             #endif
 
-            break;
+            NEXT();
         }
-        case INSTR_CALL:
+        HANDLER(FUSED_CMPI_JMPZ)
         {
-            uint32_t instr = load_int(&program[reg_instruction_ptr + 1]);
-            uint32_t reg_instruction_ptr_next = reg_instruction_ptr + 5;
+            context.compare<int32_t>(context.registers[instr->reg_a_id].i, context.registers[instr->reg_b_id].i);
 
-            write_int(&memory[reg_stack_ptr], reg_instruction_ptr_next);
-            reg_stack_ptr += 4;
-
-            write_int(&memory[reg_stack_ptr], reg_base_ptr);
-            reg_stack_ptr += 4;
+            if (!context.flag_zero)
+            {
+                ip += 2;
+                NEXT();
+            }
 
-            reg_base_ptr = reg_stack_ptr - 8;
+            ip = instr->target;
 
-            reg_instruction_ptr = instr;
+            POLL_EVENTS_TICK();
 
             #if PRINT_DEBUG
-            std::cout << "INSTRUCTION: CALL\n";
+            std::cout << "INSTRUCTION: CMPI+JMPZ to addr " << instr->imm << "\n";
             #endif
 
-            break;
+            NEXT();
         }
-        case INSTR_RET:
+        HANDLER(FUSED_CMPI_JMPS)
         {
-            reg_stack_ptr = reg_base_ptr;
-            reg_instruction_ptr = load_int(&memory[reg_stack_ptr]);
-            reg_base_ptr = load_int(&memory[reg_stack_ptr + 4]);
+            context.compare<int32_t>(context.registers[instr->reg_a_id].i, context.registers[instr->reg_b_id].i);
+
+            if (!context.flag_sign)
+            {
+                ip += 2;
+                NEXT();
+            }
+
+            ip = instr->target;
+
+            POLL_EVENTS_TICK();
 
             #if PRINT_DEBUG
-            std::cout << "INSTRUCTION: RET\n";
+            std::cout << "INSTRUCTION: CMPI+JMPS to addr " << instr->imm << "\n";
             #endif
 
-            break;
+            NEXT();
         }
-        case INSTR_SYSCALL:
+        HANDLER(FUSED_CMPF_JMPZ)
         {
-            uint8_t syscall_id = program[reg_instruction_ptr + 1];
+            context.compare<float>(context.registers[instr->reg_a_id].f, context.registers[instr->reg_b_id].f);
+
+            if (!context.flag_zero)
+            {
+                ip += 2;
+                NEXT();
+            }
+
+            ip = instr->target;
+
+            POLL_EVENTS_TICK();
 
             #if PRINT_DEBUG
-            std::cout << "INSTRUCTION: SYSCALL id " << (int)syscall_id << "\n";
+            std::cout << "INSTRUCTION: CMPF+JMPZ to addr " << instr->imm << "\n";
             #endif
-            
-            dispatch_syscall(syscall_id);
-
-            reg_instruction_ptr += 5;
 
-            break;
+            NEXT();
         }
-        case INSTR_STOP:
+        HANDLER(FUSED_CMPF_JMPS)
         {
-            // End of program
-            reg_instruction_ptr = program.size();
+            context.compare<float>(context.registers[instr->reg_a_id].f, context.registers[instr->reg_b_id].f);
+
+            if (!context.flag_sign)
+            {
+                ip += 2;
+                NEXT();
+            }
+
+            ip = instr->target;
+
+            POLL_EVENTS_TICK();
 
             #if PRINT_DEBUG
-            std::cout << "INSTRUCTION: STOP\n";
+            std::cout << "INSTRUCTION: CMPF+JMPS to addr " << instr->imm << "\n";
             #endif
 
-            break;
+            NEXT();
         }
-        case INSTR_JMP:
+        HANDLER(FUSED_CMP_IMM_JMPZ)
         {
-            uint32_t addr = load_int(&program[reg_instruction_ptr + 1]);
-            reg_instruction_ptr = addr;
+            context.compare<uint32_t>(context.registers[instr->reg_a_id].u, instr->imm);
+
+            if (!context.flag_zero)
+            {
+                ip += 2;
+                NEXT();
+            }
+
+            ip = instr->target;
+
+            POLL_EVENTS_TICK();
 
             #if PRINT_DEBUG
-            std::cout << "INSTRUCTION: JMP to addr " << addr << "\n";
+            std::cout << "INSTRUCTION: CMP imm+JMPZ to index " << instr->target << "\n";
             #endif
 
-            break;
+            NEXT();
         }
-        case INSTR_JMPZ:
+        HANDLER(FUSED_CMP_IMM_JMPS)
         {
-            if (!flag_zero)
+            context.compare<uint32_t>(context.registers[instr->reg_a_id].u, instr->imm);
+
+            if (!context.flag_sign)
             {
-                reg_instruction_ptr += 5;
-                break;
+                ip += 2;
+                NEXT();
             }
 
-            uint32_t addr = load_int(&program[reg_instruction_ptr + 1]);
-            reg_instruction_ptr = addr;
+            ip = instr->target;
+
+            POLL_EVENTS_TICK();
 
             #if PRINT_DEBUG
-            std::cout << "INSTRUCTION: JMPZ to addr " << addr << "\n";
+            std::cout << "INSTRUCTION: CMP imm+JMPS to index " << instr->target << "\n";
             #endif
 
-            break;
+            NEXT();
         }
-        case INSTR_JMPS:
+        HANDLER(FUSED_CMPI_IMM_JMPZ)
         {
-            if (!flag_sign)
+            context.compare<int32_t>(context.registers[instr->reg_a_id].i, static_cast<int32_t>(instr->imm));
+
+            if (!context.flag_zero)
             {
-                reg_instruction_ptr += 5;
-                break;
+                ip += 2;
+                NEXT();
             }
 
-            uint32_t addr = load_int(&program[reg_instruction_ptr + 1]);
-            reg_instruction_ptr = addr;
+            ip = instr->target;
+
+            POLL_EVENTS_TICK();
 
             #if PRINT_DEBUG
-            std::cout << "INSTRUCTION: JMPS to addr " << addr << "\n";
+            std::cout << "INSTRUCTION: CMPI imm+JMPZ to index " << instr->target << "\n";
             #endif
 
-            break;
+            NEXT();
         }
-        case INSTR_JMPC:
+        HANDLER(FUSED_CMPI_IMM_JMPS)
         {
-            if (!flag_carry)
+            context.compare<int32_t>(context.registers[instr->reg_a_id].i, static_cast<int32_t>(instr->imm));
+
+            if (!context.flag_sign)
             {
-                reg_instruction_ptr += 5;
-                break;
+                ip += 2;
+                NEXT();
             }
 
-            uint32_t addr = load_int(&program[reg_instruction_ptr + 1]);
-            reg_instruction_ptr = addr;
+            ip = instr->target;
+
+            POLL_EVENTS_TICK();
 
             #if PRINT_DEBUG
-            std::cout << "INSTRUCTION: JMPS to addr " << addr << "\n";
+            std::cout << "INSTRUCTION: CMPI imm+JMPS to index " << instr->target << "\n";
             #endif
 
-            break;
+            NEXT();
+        }
+        HANDLER_INVALID
+        {
+            context.reg_instruction_ptr = ip;
+            std::cout << "ERROR: Invalid instruction (" << (int)instr->opcode << ") at addr " << instr->addr << "\n";
+            return;
         }
     }
+    #if !THREADED_DISPATCH
+    }
+    #endif
 }
 
+#undef NEXT
+#undef DISPATCH
+#undef HANDLER_INVALID
+#undef HANDLER
+#undef COUNT_INSTRUCTION
+#undef POLL_EVENTS_TICK
+#undef VECTOR_OP_DEBUG
+#undef VECTOR_OP_HANDLER
+#undef BRANCH_DEBUG
+#undef PAIR_DEBUG
+#undef FLOAT_MATH_DEBUG
+#undef FLOAT_MATH3_HANDLER
+#undef FLOAT_MATH_HANDLER
+#undef PAIR_COMPARE_HANDLER
+#undef PAIR_OP_HANDLER
+#undef BRANCH_HANDLER
+#undef MEMORY_OPERAND_ADDR
+#undef REGISTER_ADDR
+#undef NARROW_MEMORY_DEBUG
+#undef NARROW_STORE_HANDLER
+#undef NARROW_LOAD_HANDLER
+#undef CHECK_ALIGNED
+#undef SYNC_IP
+#undef INSTR_HANDLERS
+#undef THREADED_DISPATCH
+#undef PRINT_STATS
 #undef PRINT_DEBUG
\ No newline at end of file
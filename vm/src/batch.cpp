@@ -0,0 +1,119 @@
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+
+#include "batch.hpp"
+
+BatchRunner::BatchRunner(std::shared_ptr<const ProgramImage> image, BatchMachineSetup setup)
+    : image(std::move(image)), setup(std::move(setup))
+{
+}
+
+BatchStats BatchRunner::run(const std::vector<std::string>& inputs, uint32_t thread_count)
+{
+    this->inputs = &inputs;
+    next_job = 0;
+    failed_count = 0;
+
+    if (thread_count == 0)
+    {
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+    }
+    thread_count = std::max<uint64_t>(1, std::min<uint64_t>(thread_count, inputs.size()));
+
+    // Each worker only ever appends to its own vector, merged once everything has finished
+    std::vector<std::vector<double>> worker_latencies(thread_count);
+    std::vector<std::thread> threads;
+    threads.reserve(thread_count);
+
+    auto start_time = std::chrono::steady_clock::now();
+
+    for (uint32_t i = 0; i < thread_count; i++)
+    {
+        threads.emplace_back(&BatchRunner::worker, this, std::ref(worker_latencies[i]));
+    }
+
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+
+    BatchStats stats;
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    stats.thread_count = thread_count;
+
+    for (const std::vector<double>& latencies : worker_latencies)
+    {
+        stats.latencies.insert(stats.latencies.end(), latencies.begin(), latencies.end());
+    }
+    std::sort(stats.latencies.begin(), stats.latencies.end());
+
+    stats.job_count = stats.latencies.size();
+    stats.failed_count = failed_count + (inputs.size() - stats.job_count);
+
+    this->inputs = nullptr;
+
+    return stats;
+}
+
+void BatchRunner::worker(std::vector<double>& latencies)
+{
+    // Guest memory is reserved once here and only reset between jobs
+    VirtualMachine vm;
+    vm.set_print_info(false);
+
+    if (!setup(vm))
+    {
+        return;
+    }
+
+    vm.set_program(image);
+
+    while (true)
+    {
+        uint64_t job = next_job.fetch_add(1, std::memory_order_relaxed);
+        if (job >= inputs->size()) break;
+
+        vm.set_input(job, (*inputs)[job]);
+
+        auto start_time = std::chrono::steady_clock::now();
+        bool completed = vm.run();
+        latencies.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start_time).count());
+
+        if (!completed)
+        {
+            failed_count.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+}
+
+// Nearest rank percentile of sorted values
+static double _percentile(const std::vector<double>& sorted, double percent)
+{
+    if (sorted.empty()) return 0.0;
+
+    size_t rank = std::ceil(percent / 100.0 * sorted.size());
+    return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+}
+
+void BatchRunner::print_stats(const BatchStats& stats)
+{
+    double jobs_per_second = stats.seconds > 0.0 ? stats.job_count / stats.seconds : 0.0;
+    double max_latency = stats.latencies.empty() ? 0.0 : stats.latencies.back();
+
+    std::ios_base::fmtflags flags = std::cout.flags();
+    std::streamsize precision = std::cout.precision();
+    std::cout << std::fixed << std::setprecision(3);
+
+    std::cout << "Batch: " << stats.job_count << " jobs (" << stats.failed_count << " failed) on " <<
+        stats.thread_count << " threads in " << stats.seconds << "s, " << jobs_per_second << " jobs/s\n";
+    std::cout << "Batch: latency ms p50 " << _percentile(stats.latencies, 50) / 1000.0 << ", p90 " <<
+        _percentile(stats.latencies, 90) / 1000.0 << ", p99 " << _percentile(stats.latencies, 99) / 1000.0 <<
+        ", max " << max_latency / 1000.0 << "\n";
+
+    std::cout.flags(flags);
+    std::cout.precision(precision);
+}
\ No newline at end of file
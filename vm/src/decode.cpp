@@ -0,0 +1,639 @@
+#include <iostream>
+#include <bit>
+
+#include "decode.hpp"
+
+#include "ISA.hpp"
+#include "bytes.hpp"
+
+uint32_t instruction_encoded_size(uint8_t opcode)
+{
+    switch (opcode)
+    {
+        case INSTR_RET:
+        case INSTR_LEAVE:
+        case INSTR_STOP:
+        case INSTR_FENCE:
+            return 1;
+        case INSTR_NOT:
+        case INSTR_PUSH:
+        case INSTR_POP:
+            return 2;
+        case INSTR_LOAD:
+        case INSTR_STORE:
+        case INSTR_LOADB:
+        case INSTR_LOADBI:
+        case INSTR_LOADH:
+        case INSTR_LOADHI:
+        case INSTR_STOREB:
+        case INSTR_STOREH:
+        case INSTR_XADD:
+        case INSTR_XCHG:
+        case INSTR_COPY:
+        case INSTR_ADD:
+        case INSTR_SUB:
+        case INSTR_MUL:
+        case INSTR_DIV:
+        case INSTR_IDIV:
+        case INSTR_SHL:
+        case INSTR_SHR:
+        case INSTR_AND:
+        case INSTR_OR:
+        case INSTR_XOR:
+        case INSTR_FADD:
+        case INSTR_FSUB:
+        case INSTR_FMUL:
+        case INSTR_FDIV:
+        case INSTR_CMP:
+        case INSTR_CMPI:
+        case INSTR_CMPF:
+        case INSTR_CMP64:
+        case INSTR_CMPI64:
+        case INSTR_DCMP:
+        case INSTR_FTOD:
+        case INSTR_DTOF:
+        case INSTR_FSQRT:
+        case INSTR_FABS:
+        case INSTR_FFLOOR:
+        case INSTR_FSIN:
+        case INSTR_FCOS:
+        case INSTR_VLOAD:
+        case INSTR_VLOADA:
+        case INSTR_VSTORE:
+        case INSTR_VSTOREA:
+        case INSTR_VCOPY:
+        case INSTR_VSPLAT:
+        case INSTR_VADD:
+        case INSTR_VSUB:
+        case INSTR_VMUL:
+        case INSTR_VMIN:
+        case INSTR_VMAX:
+        case INSTR_VCMPEQ:
+        case INSTR_VCMPGT:
+        case INSTR_VAND:
+        case INSTR_VOR:
+        case INSTR_VXOR:
+        case INSTR_VFADD:
+        case INSTR_VFSUB:
+        case INSTR_VFMUL:
+        case INSTR_VFMIN:
+        case INSTR_VFMAX:
+        case INSTR_VFCMPEQ:
+        case INSTR_VFCMPLT:
+            return 3;
+        case INSTR_CAS:
+        case INSTR_ADD3:
+        case INSTR_SUB3:
+        case INSTR_MUL3:
+        case INSTR_DIV3:
+        case INSTR_IDIV3:
+        case INSTR_SHL3:
+        case INSTR_SHR3:
+        case INSTR_AND3:
+        case INSTR_OR3:
+        case INSTR_XOR3:
+        case INSTR_FADD3:
+        case INSTR_FSUB3:
+        case INSTR_FMUL3:
+        case INSTR_FDIV3:
+        case INSTR_ADD64:
+        case INSTR_SUB64:
+        case INSTR_MUL64:
+        case INSTR_DIV64:
+        case INSTR_IDIV64:
+        case INSTR_DADD:
+        case INSTR_DSUB:
+        case INSTR_DMUL:
+        case INSTR_DDIV:
+        case INSTR_FMIN:
+        case INSTR_FMAX:
+        case INSTR_FFMA:
+            return 4;
+        case INSTR_CALL:
+        case INSTR_TAILCALL:
+        case INSTR_ENTER:
+        case INSTR_SYSCALL:
+        case INSTR_JMP:
+        case INSTR_JMPZ:
+        case INSTR_JMPS:
+        case INSTR_JMPC:
+            return 5;
+        case INSTR_LOADS:
+        case INSTR_LOADC:
+        case INSTR_STORES:
+        case INSTR_ADD_IMM:
+        case INSTR_SUB_IMM:
+        case INSTR_MUL_IMM:
+        case INSTR_DIV_IMM:
+        case INSTR_IDIV_IMM:
+        case INSTR_SHL_IMM:
+        case INSTR_SHR_IMM:
+        case INSTR_AND_IMM:
+        case INSTR_OR_IMM:
+        case INSTR_XOR_IMM:
+        case INSTR_CMP_IMM:
+        case INSTR_CMPI_IMM:
+            return 6;
+        case INSTR_VEXTRACT:
+        case INSTR_VINSERT:
+        case INSTR_VSHUF:
+        case INSTR_BEQ:
+        case INSTR_BNE:
+        case INSTR_BLT:
+        case INSTR_BGE:
+        case INSTR_BLTI:
+        case INSTR_BGEI:
+        case INSTR_BEQF:
+        case INSTR_BNEF:
+        case INSTR_BLTF:
+        case INSTR_BGEF:
+            return 7;
+        case INSTR_LOADX:
+        case INSTR_STOREX:
+        case INSTR_LOADBX:
+        case INSTR_LOADBIX:
+        case INSTR_LOADHX:
+        case INSTR_LOADHIX:
+        case INSTR_STOREBX:
+        case INSTR_STOREHX:
+            return 9;
+    }
+
+    return 0;
+}
+
+static bool _instruction_has_target(uint8_t opcode)
+{
+    switch (opcode)
+    {
+        case INSTR_CALL:
+        case INSTR_TAILCALL:
+        case INSTR_JMP:
+        case INSTR_JMPZ:
+        case INSTR_JMPS:
+        case INSTR_JMPC:
+        case INSTR_BEQ:
+        case INSTR_BNE:
+        case INSTR_BLT:
+        case INSTR_BGE:
+        case INSTR_BLTI:
+        case INSTR_BGEI:
+        case INSTR_BEQF:
+        case INSTR_BNEF:
+        case INSTR_BLTF:
+        case INSTR_BGEF:
+            return true;
+    }
+
+    return false;
+}
+
+// Bit n is set if register operand n names a vector register
+static uint8_t _vector_operands(uint8_t opcode)
+{
+    switch (opcode)
+    {
+        case INSTR_VLOAD:
+        case INSTR_VLOADA:
+        case INSTR_VSTORE:
+        case INSTR_VSTOREA:
+        case INSTR_VSPLAT:
+        case INSTR_VINSERT:
+            return 0b01;
+        case INSTR_VEXTRACT:
+            return 0b10;
+        case INSTR_VCOPY:
+        case INSTR_VSHUF:
+        case INSTR_VADD:
+        case INSTR_VSUB:
+        case INSTR_VMUL:
+        case INSTR_VMIN:
+        case INSTR_VMAX:
+        case INSTR_VCMPEQ:
+        case INSTR_VCMPGT:
+        case INSTR_VAND:
+        case INSTR_VOR:
+        case INSTR_VXOR:
+        case INSTR_VFADD:
+        case INSTR_VFSUB:
+        case INSTR_VFMUL:
+        case INSTR_VFMIN:
+        case INSTR_VFMAX:
+        case INSTR_VFCMPEQ:
+        case INSTR_VFCMPLT:
+            return 0b11;
+    }
+
+    return 0;
+}
+
+// Bit n is set if register operand n names a 64 bit register pair
+static uint8_t _pair_operands(uint8_t opcode)
+{
+    switch (opcode)
+    {
+        case INSTR_ADD64:
+        case INSTR_SUB64:
+        case INSTR_MUL64:
+        case INSTR_DIV64:
+        case INSTR_IDIV64:
+        case INSTR_DADD:
+        case INSTR_DSUB:
+        case INSTR_DMUL:
+        case INSTR_DDIV:
+            return 0b111;
+        case INSTR_CMP64:
+        case INSTR_CMPI64:
+        case INSTR_DCMP:
+            return 0b11;
+        case INSTR_FTOD:
+            return 0b01;
+        case INSTR_DTOF:
+            return 0b10;
+    }
+
+    return 0;
+}
+
+static bool _decode_register(const std::vector<uint8_t>& program, uint32_t isa_version, uint32_t addr, bool vector, uint8_t& reg_id_out)
+{
+    uint32_t reg_id = vector ? program[addr] : register_id_from_isa(isa_version, program[addr]);
+    if (reg_id >= (vector ? VECTOR_REGISTER_COUNT : REGISTER_COUNT))
+    {
+        std::cout << "ERROR: Invalid " << (vector ? "vector " : "") << "register id " << (int)program[addr] << " at addr " << addr << "\n";
+        return false;
+    }
+
+    reg_id_out = reg_id;
+    return true;
+}
+
+// Base/index register of a memory operand, may be left out
+static bool _decode_memory_register(const std::vector<uint8_t>& program, uint32_t isa_version, uint32_t addr, uint8_t& reg_id_out)
+{
+    if (program[addr] == MEMORY_OPERAND_NO_REG)
+    {
+        reg_id_out = MEMORY_OPERAND_NO_REG;
+        return true;
+    }
+
+    return _decode_register(program, isa_version, addr, false, reg_id_out);
+}
+
+bool decode_program(const std::vector<uint8_t>& program, uint32_t isa_version, uint32_t code_start, uint32_t entry_addr,
+    DecodedProgram& decoded_out)
+{
+    decoded_out.instructions.clear();
+
+    const uint32_t end_addr = program.size();
+
+    // Filled with end index once known
+    decoded_out.addr_to_index.assign(end_addr + 1, UINT32_MAX);
+
+    uint32_t addr = code_start;
+    while (addr < end_addr)
+    {
+        uint8_t opcode = program[addr];
+        uint32_t size = instruction_encoded_size(opcode);
+
+        if (size == 0)
+        {
+            std::cout << "ERROR: Unknown instruction (" << (int)opcode << ") at addr " << addr << "\n";
+            return false;
+        }
+
+        if (addr + size > end_addr)
+        {
+            std::cout << "ERROR: Truncated instruction (" << (int)opcode << ") at addr " << addr << "\n";
+            return false;
+        }
+
+        DecodedInstruction instr = {};
+        instr.opcode = opcode;
+        instr.addr = addr;
+
+        const uint8_t vector_operands = _vector_operands(opcode);
+        const bool vector_a = vector_operands & 0b01;
+        const bool vector_b = vector_operands & 0b10;
+
+        switch (size)
+        {
+            case 2:
+            {
+                if (!_decode_register(program, isa_version, addr + 1, false, instr.reg_a_id)) return false;
+                break;
+            }
+            case 3:
+            {
+                if (!_decode_register(program, isa_version, addr + 1, vector_a, instr.reg_a_id)) return false;
+                if (!_decode_register(program, isa_version, addr + 2, vector_b, instr.reg_b_id)) return false;
+                break;
+            }
+            case 4:
+            {
+                if (!_decode_register(program, isa_version, addr + 1, false, instr.reg_a_id)) return false;
+                if (!_decode_register(program, isa_version, addr + 2, false, instr.reg_b_id)) return false;
+                if (!_decode_register(program, isa_version, addr + 3, false, instr.reg_c_id)) return false;
+                break;
+            }
+            case 5:
+            {
+                // Jump/call address, syscall id or enter size
+                instr.imm = load_int(const_cast<uint8_t*>(&program[addr + 1]));
+                break;
+            }
+            case 6:
+            {
+                if (!_decode_register(program, isa_version, addr + 1, false, instr.reg_a_id)) return false;
+                instr.imm = load_int(const_cast<uint8_t*>(&program[addr + 2]));
+                break;
+            }
+            case 9:
+            {
+                // reg, [base + index*scale + disp], scale kept as a shift in target
+                if (!_decode_register(program, isa_version, addr + 1, false, instr.reg_a_id)) return false;
+                if (!_decode_memory_register(program, isa_version, addr + 2, instr.reg_b_id)) return false;
+                if (!_decode_memory_register(program, isa_version, addr + 3, instr.reg_c_id)) return false;
+                instr.imm = load_int(const_cast<uint8_t*>(&program[addr + 5]));
+
+                uint8_t scale = program[addr + 4];
+                if (scale != 1 && scale != 2 && scale != 4 && scale != 8)
+                {
+                    std::cout << "ERROR: Invalid index scale " << (int)scale << " at addr " << addr << "\n";
+                    return false;
+                }
+
+                instr.target = std::countr_zero(scale);
+                break;
+            }
+            case 7:
+            {
+                if (!_decode_register(program, isa_version, addr + 1, vector_a, instr.reg_a_id)) return false;
+                if (!_decode_register(program, isa_version, addr + 2, vector_b, instr.reg_b_id)) return false;
+                instr.imm = load_int(const_cast<uint8_t*>(&program[addr + 3]));
+
+                // Compare and branch address, resolved to target below
+                if (!vector_operands) break;
+
+                // Lane or 2 bit per lane shuffle selector, checked here so handlers can use it directly
+                uint32_t imm_limit = opcode == INSTR_VSHUF ? 256 : VECTOR_LANE_COUNT;
+                if (instr.imm >= imm_limit)
+                {
+                    std::cout << "ERROR: Invalid vector " << (opcode == INSTR_VSHUF ? "shuffle " : "lane ") << instr.imm <<
+                        " at addr " << addr << "\n";
+                    return false;
+                }
+                break;
+            }
+        }
+
+        // Pairs start on an even register, so both halves are in the same bank
+        const uint8_t pair_operands = _pair_operands(opcode);
+        const uint8_t operand_ids[3] = {instr.reg_a_id, instr.reg_b_id, instr.reg_c_id};
+        for (int operand = 0; operand < 3; operand++)
+        {
+            if ((pair_operands & (1 << operand)) && (operand_ids[operand] & 1))
+            {
+                std::cout << "ERROR: Register pair must start on an even register (" << (int)operand_ids[operand] << ") at addr " <<
+                    addr << "\n";
+                return false;
+            }
+        }
+
+        decoded_out.addr_to_index[addr] = decoded_out.instructions.size();
+        decoded_out.instructions.push_back(instr);
+
+        addr += size;
+    }
+
+    // Running off the end of the program (or jumping into garbage) stops the machine
+    uint32_t end_index = decoded_out.instructions.size();
+
+    DecodedInstruction end_instr = {};
+    end_instr.opcode = INSTR_STOP;
+    end_instr.addr = end_addr;
+    decoded_out.instructions.push_back(end_instr);
+
+    for (uint32_t& index : decoded_out.addr_to_index)
+    {
+        if (index == UINT32_MAX) index = end_index;
+    }
+
+    // Resolve jump targets to decoded indices
+    for (DecodedInstruction& instr : decoded_out.instructions)
+    {
+        if (!_instruction_has_target(instr.opcode)) continue;
+
+        // Jumping to the end of the program is allowed (label with no instructions after it)
+        if (instr.imm > end_addr || (instr.imm != end_addr && decoded_out.index_from_addr(instr.imm) == end_index))
+        {
+            std::cout << "ERROR: Jump target " << instr.imm << " at addr " << instr.addr << " is not an instruction\n";
+            return false;
+        }
+
+        instr.target = decoded_out.index_from_addr(instr.imm);
+    }
+
+    decoded_out.entry_index = decoded_out.index_from_addr(entry_addr);
+
+    return true;
+}
+
+static uint8_t _fused_opcode(const DecodedInstruction& first, const DecodedInstruction& second)
+{
+    switch (first.opcode)
+    {
+        case INSTR_LOADC:
+        {
+            switch (second.opcode)
+            {
+                case INSTR_ADD: return FUSED_LOADC_ADD;
+                case INSTR_SUB: return FUSED_LOADC_SUB;
+                case INSTR_MUL: return FUSED_LOADC_MUL;
+                case INSTR_SHL: return FUSED_LOADC_SHL;
+                case INSTR_SHR: return FUSED_LOADC_SHR;
+                case INSTR_AND: return FUSED_LOADC_AND;
+                case INSTR_OR: return FUSED_LOADC_OR;
+                case INSTR_XOR: return FUSED_LOADC_XOR;
+                case INSTR_LOAD: return FUSED_LOADC_LOAD;
+                case INSTR_PUSH: return FUSED_LOADC_PUSH;
+            }
+            break;
+        }
+        case INSTR_PUSH:
+        {
+            if (second.opcode == INSTR_POP) return FUSED_PUSH_POP;
+            break;
+        }
+        case INSTR_POP:
+        {
+            if (second.opcode == INSTR_POP) return FUSED_POP_POP;
+            break;
+        }
+        case INSTR_CMP:
+        {
+            if (second.opcode == INSTR_JMPZ) return FUSED_CMP_JMPZ;
+            if (second.opcode == INSTR_JMPS) return FUSED_CMP_JMPS;
+            break;
+        }
+        case INSTR_CMPI:
+        {
+            if (second.opcode == INSTR_JMPZ) return FUSED_CMPI_JMPZ;
+            if (second.opcode == INSTR_JMPS) return FUSED_CMPI_JMPS;
+            break;
+        }
+        case INSTR_CMPF:
+        {
+            if (second.opcode == INSTR_JMPZ) return FUSED_CMPF_JMPZ;
+            if (second.opcode == INSTR_JMPS) return FUSED_CMPF_JMPS;
+            break;
+        }
+        case INSTR_CMP_IMM:
+        {
+            if (second.opcode == INSTR_JMPZ) return FUSED_CMP_IMM_JMPZ;
+            if (second.opcode == INSTR_JMPS) return FUSED_CMP_IMM_JMPS;
+            break;
+        }
+        case INSTR_CMPI_IMM:
+        {
+            if (second.opcode == INSTR_JMPZ) return FUSED_CMPI_IMM_JMPZ;
+            if (second.opcode == INSTR_JMPS) return FUSED_CMPI_IMM_JMPS;
+            break;
+        }
+    }
+
+    return 0;
+}
+
+void fuse_instructions(DecodedProgram& program)
+{
+    std::vector<DecodedInstruction>& instructions = program.instructions;
+
+    // Only ever rewrites the first slot of a pair, so the second slot is still the original when it is looked at next
+    for (size_t i = 0; i + 1 < instructions.size(); i++)
+    {
+        DecodedInstruction& first = instructions[i];
+        const DecodedInstruction& second = instructions[i + 1];
+
+        uint8_t fused = _fused_opcode(first, second);
+        if (fused == 0) continue;
+
+        switch (fused)
+        {
+            case FUSED_CMP_JMPZ:
+            case FUSED_CMP_JMPS:
+            case FUSED_CMPI_JMPZ:
+            case FUSED_CMPI_JMPS:
+            case FUSED_CMPF_JMPZ:
+            case FUSED_CMPF_JMPS:
+            {
+                // Compare operands stay in reg_a/reg_b
+                first.target = second.target;
+                first.imm = second.imm;
+                break;
+            }
+            case FUSED_CMP_IMM_JMPZ:
+            case FUSED_CMP_IMM_JMPS:
+            case FUSED_CMPI_IMM_JMPZ:
+            case FUSED_CMPI_IMM_JMPS:
+            {
+                // Compare operands stay in reg_a/imm
+                first.target = second.target;
+                break;
+            }
+            case FUSED_LOADC_PUSH:
+            case FUSED_PUSH_POP:
+            case FUSED_POP_POP:
+            {
+                first.reg_b_id = second.reg_a_id;
+                break;
+            }
+            default:
+            {
+                // loadc + two register operation
+                first.reg_b_id = second.reg_a_id;
+                first.reg_c_id = second.reg_b_id;
+                break;
+            }
+        }
+
+        first.opcode = fused;
+    }
+}
+
+DecodedInstruction unfuse_instruction(const DecodedInstruction& instr)
+{
+    DecodedInstruction original = instr;
+
+    switch (instr.opcode)
+    {
+        case FUSED_LOADC_ADD:
+        case FUSED_LOADC_SUB:
+        case FUSED_LOADC_MUL:
+        case FUSED_LOADC_SHL:
+        case FUSED_LOADC_SHR:
+        case FUSED_LOADC_AND:
+        case FUSED_LOADC_OR:
+        case FUSED_LOADC_XOR:
+        case FUSED_LOADC_LOAD:
+        case FUSED_LOADC_PUSH:
+        {
+            original.opcode = INSTR_LOADC;
+            original.reg_b_id = 0;
+            original.reg_c_id = 0;
+            break;
+        }
+        case FUSED_PUSH_POP:
+        {
+            original.opcode = INSTR_PUSH;
+            original.reg_b_id = 0;
+            break;
+        }
+        case FUSED_POP_POP:
+        {
+            original.opcode = INSTR_POP;
+            original.reg_b_id = 0;
+            break;
+        }
+        case FUSED_CMP_JMPZ:
+        case FUSED_CMP_JMPS:
+        {
+            original.opcode = INSTR_CMP;
+            original.imm = 0;
+            original.target = 0;
+            break;
+        }
+        case FUSED_CMPI_JMPZ:
+        case FUSED_CMPI_JMPS:
+        {
+            original.opcode = INSTR_CMPI;
+            original.imm = 0;
+            original.target = 0;
+            break;
+        }
+        case FUSED_CMPF_JMPZ:
+        case FUSED_CMPF_JMPS:
+        {
+            original.opcode = INSTR_CMPF;
+            original.imm = 0;
+            original.target = 0;
+            break;
+        }
+        case FUSED_CMP_IMM_JMPZ:
+        case FUSED_CMP_IMM_JMPS:
+        {
+            original.opcode = INSTR_CMP_IMM;
+            original.target = 0;
+            break;
+        }
+        case FUSED_CMPI_IMM_JMPZ:
+        case FUSED_CMPI_IMM_JMPS:
+        {
+            original.opcode = INSTR_CMPI_IMM;
+            original.target = 0;
+            break;
+        }
+    }
+
+    return original;
+}
\ No newline at end of file
@@ -0,0 +1,203 @@
+#include <iostream>
+#include <algorithm>
+
+#include "executable.hpp"
+
+#include "bytes.hpp"
+
+static uint32_t _load_int(const std::vector<uint8_t>& file, uint64_t offset)
+{
+    return load_int(const_cast<uint8_t*>(&file[offset]));
+}
+
+static bool _read_flat_executable(const std::vector<uint8_t>& file, Executable& out)
+{
+    if (file.size() < BYTECODE_HEADER_SIZE)
+    {
+        std::cout << "ERROR: Executable is too small to contain a header\n";
+        return false;
+    }
+
+    out.format_version = 1;
+    out.isa_version = _load_int(file, 0);
+    out.syscall_version = _load_int(file, 4);
+    out.entry_addr = _load_int(file, 8);
+
+    uint32_t data_size = _load_int(file, 12);
+    if (data_size > file.size() - BYTECODE_HEADER_SIZE)
+    {
+        std::cout << "ERROR: Executable data size exceeds file size\n";
+        return false;
+    }
+
+    out.data.assign(file.begin() + BYTECODE_HEADER_SIZE, file.begin() + BYTECODE_HEADER_SIZE + data_size);
+
+    // Code addresses are file offsets, so the header and data stay in front of it
+    out.code = file;
+    out.code_start = BYTECODE_HEADER_SIZE + data_size;
+    return true;
+}
+
+static bool _read_symbols(const std::vector<uint8_t>& file, uint64_t offset, uint64_t size, Executable& out)
+{
+    const uint64_t end = offset + size;
+    while (offset < end)
+    {
+        if (offset + 6 > end || offset + 6 + file[offset + 5] > end)
+        {
+            std::cout << "ERROR: Truncated executable symbol table\n";
+            return false;
+        }
+
+        ExecutableSymbol symbol;
+        symbol.addr = _load_int(file, offset);
+        symbol.kind = file[offset + 4];
+        symbol.name.assign(reinterpret_cast<const char*>(&file[offset + 6]), file[offset + 5]);
+        out.symbols.push_back(symbol);
+
+        offset += 6 + file[offset + 5];
+    }
+
+    return true;
+}
+
+bool read_executable(const std::vector<uint8_t>& file, Executable& out)
+{
+    out = Executable();
+
+    if (file.size() < 4 || _load_int(file, 0) != EXECUTABLE_MAGIC)
+    {
+        return _read_flat_executable(file, out);
+    }
+
+    if (file.size() < EXECUTABLE_HEADER_SIZE)
+    {
+        std::cout << "ERROR: Executable is too small to contain a header\n";
+        return false;
+    }
+
+    out.format_version = _load_int(file, 4);
+    if (out.format_version != EXECUTABLE_FORMAT_VERSION)
+    {
+        std::cout << "ERROR: Unsupported executable format version " << out.format_version << "\n";
+        return false;
+    }
+
+    out.isa_version = _load_int(file, 8);
+    out.syscall_version = _load_int(file, 12);
+    out.entry_addr = _load_int(file, 16);
+
+    const uint64_t section_count = _load_int(file, 20);
+    if (EXECUTABLE_HEADER_SIZE + section_count * EXECUTABLE_SECTION_ENTRY_SIZE > file.size())
+    {
+        std::cout << "ERROR: Executable section table exceeds file size\n";
+        return false;
+    }
+
+    bool has_code = false;
+    for (uint64_t i = 0; i < section_count; i++)
+    {
+        const uint64_t entry = EXECUTABLE_HEADER_SIZE + i * EXECUTABLE_SECTION_ENTRY_SIZE;
+        const uint32_t type = _load_int(file, entry);
+        const uint64_t offset = _load_int(file, entry + 4);
+        const uint64_t size = _load_int(file, entry + 8);
+        const uint32_t addr = _load_int(file, entry + 12);
+
+        // bss has no bytes in the file
+        if (type != SECTION_BSS && offset + size > file.size())
+        {
+            std::cout << "ERROR: Executable section " << i << " exceeds file size\n";
+            return false;
+        }
+
+        switch (type)
+        {
+            case SECTION_CODE:
+            {
+                if (addr == 0 || addr > EXECUTABLE_SECTION_ALIGN)
+                {
+                    std::cout << "ERROR: Executable code section has invalid addr " << addr << "\n";
+                    return false;
+                }
+
+                out.code.assign(addr, 0);
+                out.code.insert(out.code.end(), file.begin() + offset, file.begin() + offset + size);
+                out.code_start = addr;
+                has_code = true;
+                break;
+            }
+            case SECTION_DATA:
+            {
+                if (addr != 0)
+                {
+                    std::cout << "ERROR: Executable data section must be at addr 0\n";
+                    return false;
+                }
+
+                out.data.assign(file.begin() + offset, file.begin() + offset + size);
+                break;
+            }
+            case SECTION_BSS:
+            {
+                out.bss_addr = addr;
+                out.bss_size = size;
+                break;
+            }
+            case SECTION_SYMBOLS:
+            {
+                if (!_read_symbols(file, offset, size, out)) return false;
+                break;
+            }
+            case SECTION_DEBUG_LINES:
+            {
+                for (uint64_t line = offset; line + 8 <= offset + size; line += 8)
+                {
+                    out.debug_lines.emplace_back(_load_int(file, line), _load_int(file, line + 4));
+                }
+                std::sort(out.debug_lines.begin(), out.debug_lines.end());
+                break;
+            }
+        }
+    }
+
+    if (!has_code)
+    {
+        std::cout << "ERROR: Executable has no code section\n";
+        return false;
+    }
+
+    if (out.bss_size && (out.bss_addr < out.data.size() || static_cast<uint64_t>(out.bss_addr) + out.bss_size > UINT32_MAX))
+    {
+        std::cout << "ERROR: Executable bss section overlaps data or exceeds guest memory\n";
+        return false;
+    }
+
+    return true;
+}
+
+std::string Executable::describe_code_addr(uint32_t addr) const
+{
+    std::string description;
+
+    const ExecutableSymbol* closest = nullptr;
+    for (const ExecutableSymbol& symbol : symbols)
+    {
+        if (symbol.kind != SYMBOL_CODE || symbol.addr > addr) continue;
+        if (!closest || symbol.addr > closest->addr) closest = &symbol;
+    }
+
+    if (closest)
+    {
+        description = closest->name;
+        if (addr != closest->addr) description += "+" + std::to_string(addr - closest->addr);
+    }
+
+    auto line = std::lower_bound(debug_lines.begin(), debug_lines.end(), std::make_pair(addr, 0u));
+    if (line != debug_lines.end() && line->first == addr)
+    {
+        if (!description.empty()) description += ", ";
+        description += "line " + std::to_string(line->second);
+    }
+
+    return description;
+}
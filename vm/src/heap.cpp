@@ -0,0 +1,441 @@
+#include <iostream>
+#include <bit>
+
+#include "heap.hpp"
+
+#include "bytes.hpp"
+
+#define HEAP_HEADER_SIZE 8
+#define HEAP_MIN_BLOCK 16
+
+// Low bits of the size word, sizes are always multiples of 8
+#define HEAP_FLAG_USED 0x1
+#define HEAP_FLAG_SMALL 0x2
+#define HEAP_FLAG_MASK 0x7
+
+// Block layout: [size | flags] [prev block size] [payload...], free blocks store [next] [prev] in the payload
+#define HEAP_SIZE_OFFSET 0
+#define HEAP_PREV_SIZE_OFFSET 4
+#define HEAP_NEXT_OFFSET 8
+#define HEAP_PREV_OFFSET 12
+
+GuestHeap::GuestHeap(GuestMemory& memory) : memory(memory)
+{
+}
+
+inline uint32_t GuestHeap::read(uint32_t addr) const
+{
+    return load_int(const_cast<uint8_t*>(&memory[addr]));
+}
+
+inline void GuestHeap::write(uint32_t addr, uint32_t value)
+{
+    write_int(&memory[addr], value);
+}
+
+static inline uint32_t _large_bin(uint32_t block_size)
+{
+    return std::bit_width(block_size) - 1;
+}
+
+void GuestHeap::reset(uint32_t heap_start, uint32_t heap_end)
+{
+    // Block addresses are kept 8 byte aligned so payloads are too
+    this->heap_start = (heap_start + 7) & ~7u;
+    this->heap_end = heap_end & ~7u;
+    if (this->heap_start > this->heap_end) this->heap_start = this->heap_end;
+
+    heap_top = this->heap_start;
+    top_prev_size = 0;
+
+    for (uint32_t& head : small_free) head = 0;
+    for (uint32_t& head : large_bins) head = 0;
+    large_bin_mask = 0;
+
+    // Guest memory has been reset, nothing is protected any more
+    guard_ranges.clear();
+
+    stats = HeapStats();
+}
+
+void GuestHeap::protect(uint32_t addr, uint32_t size)
+{
+    guard_ranges.emplace_back(addr, size);
+    memory.protect(addr, size);
+}
+
+void GuestHeap::unprotect(uint32_t addr, uint32_t size)
+{
+    memory.unprotect(addr, size);
+    std::erase(guard_ranges, std::make_pair(addr, size));
+}
+
+bool GuestHeap::guarded(uint32_t addr, uint32_t size) const
+{
+    for (const auto& [guard_addr, guard_size] : guard_ranges)
+    {
+        if (addr < static_cast<uint64_t>(guard_addr) + guard_size && guard_addr < static_cast<uint64_t>(addr) + size)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool GuestHeap::valid_block(uint32_t block) const
+{
+    // Header and free list links are the only part read before the size is known
+    if (block < heap_start || block >= heap_top || (block & 7) != 0 || heap_top - block < HEAP_MIN_BLOCK ||
+        guarded(block, HEAP_MIN_BLOCK))
+    {
+        return false;
+    }
+
+    uint32_t block_size = read(block + HEAP_SIZE_OFFSET) & ~HEAP_FLAG_MASK;
+    return block_size >= HEAP_MIN_BLOCK && block_size <= heap_top - block;
+}
+
+bool GuestHeap::valid_free_block(uint32_t block) const
+{
+    return valid_block(block) && !guarded(block, read(block + HEAP_SIZE_OFFSET) & ~HEAP_FLAG_MASK);
+}
+
+void GuestHeap::report_corruption(uint32_t block) const
+{
+    std::cout << "ERROR: Guest heap is corrupted, block " << block << " is not inside the heap\n";
+}
+
+void GuestHeap::mark_used(uint32_t block_size)
+{
+    stats.alloc_count++;
+    stats.bytes_in_use += block_size;
+    if (stats.bytes_in_use > stats.bytes_peak) stats.bytes_peak = stats.bytes_in_use;
+}
+
+uint32_t GuestHeap::allocate(uint32_t size)
+{
+    if (size == 0 || size > heap_end - heap_start)
+    {
+        stats.failed_count++;
+        return 0;
+    }
+
+    uint32_t block = 0;
+    if (size <= HEAP_SMALL_MAX)
+    {
+        block = allocate_small((size - 1) / 8);
+    }
+    else
+    {
+        block = allocate_large(((size + 7) & ~7u) + HEAP_HEADER_SIZE);
+    }
+
+    if (block == 0)
+    {
+        stats.failed_count++;
+        return 0;
+    }
+
+    return block + HEAP_HEADER_SIZE;
+}
+
+uint32_t GuestHeap::allocate_small(uint32_t class_index)
+{
+    uint32_t block_size = (class_index + 1) * 8 + HEAP_HEADER_SIZE;
+
+    uint32_t block = small_free[class_index];
+    if (block != 0 && (!valid_block(block) || heap_top - block < block_size || guarded(block, block_size)))
+    {
+        // The rest of the list can't be trusted either, it is dropped
+        report_corruption(block);
+        small_free[class_index] = 0;
+        block = 0;
+    }
+
+    if (block != 0)
+    {
+        small_free[class_index] = read(block + HEAP_NEXT_OFFSET);
+        write(block + HEAP_SIZE_OFFSET, block_size | HEAP_FLAG_SMALL | HEAP_FLAG_USED);
+        stats.bytes_free -= block_size;
+    }
+    else
+    {
+        block = carve(block_size, HEAP_FLAG_SMALL | HEAP_FLAG_USED);
+        if (block == 0) return 0;
+    }
+
+    mark_used(block_size);
+    return block;
+}
+
+uint32_t GuestHeap::allocate_large(uint32_t block_size)
+{
+    uint32_t bin = _large_bin(block_size);
+    uint32_t block = 0;
+
+    // First fit within the block's own bin, any block in a higher bin is big enough
+    for (uint32_t candidate = large_bins[bin]; candidate != 0; candidate = read(candidate + HEAP_NEXT_OFFSET))
+    {
+        if (!valid_free_block(candidate))
+        {
+            report_corruption(candidate);
+            return 0;
+        }
+
+        if ((read(candidate + HEAP_SIZE_OFFSET) & ~HEAP_FLAG_MASK) >= block_size)
+        {
+            block = candidate;
+            break;
+        }
+    }
+
+    if (block == 0 && bin + 1 < HEAP_LARGE_BINS)
+    {
+        uint32_t higher = large_bin_mask & (~0u << (bin + 1));
+        if (higher != 0) block = large_bins[std::countr_zero(higher)];
+    }
+
+    if (block == 0)
+    {
+        block = carve(block_size, HEAP_FLAG_USED);
+        if (block == 0) return 0;
+
+        mark_used(block_size);
+        return block;
+    }
+
+    // The header after the block gets its prev size rewritten by the split
+    if (!valid_free_block(block) || (read(block + HEAP_SIZE_OFFSET) & ~HEAP_FLAG_MASK) < block_size ||
+        guarded(block + (read(block + HEAP_SIZE_OFFSET) & ~HEAP_FLAG_MASK), HEAP_HEADER_SIZE) || !large_unlink(block))
+    {
+        report_corruption(block);
+        return 0;
+    }
+
+    uint32_t free_size = read(block + HEAP_SIZE_OFFSET) & ~HEAP_FLAG_MASK;
+    stats.bytes_free -= free_size;
+
+    // Split off the tail if it can hold a free block of its own
+    uint32_t remainder = free_size - block_size;
+    if (remainder >= HEAP_MIN_BLOCK)
+    {
+        uint32_t rest = block + block_size;
+        write(rest + HEAP_SIZE_OFFSET, remainder);
+        write(rest + HEAP_PREV_SIZE_OFFSET, block_size);
+
+        uint32_t after = rest + remainder;
+        if (after < heap_top)
+        {
+            write(after + HEAP_PREV_SIZE_OFFSET, remainder);
+        }
+        else
+        {
+            top_prev_size = remainder;
+        }
+
+        large_insert(rest, remainder);
+        stats.bytes_free += remainder;
+    }
+    else
+    {
+        block_size = free_size;
+    }
+
+    write(block + HEAP_SIZE_OFFSET, block_size | HEAP_FLAG_USED);
+
+    mark_used(block_size);
+    return block;
+}
+
+uint32_t GuestHeap::carve(uint32_t block_size, uint32_t flags)
+{
+    if (block_size > heap_end - heap_top) return 0;
+
+    uint32_t block = heap_top;
+    write(block + HEAP_SIZE_OFFSET, block_size | flags);
+    write(block + HEAP_PREV_SIZE_OFFSET, top_prev_size);
+
+    heap_top += block_size;
+    top_prev_size = block_size;
+
+    return block;
+}
+
+void GuestHeap::large_insert(uint32_t block, uint32_t block_size)
+{
+    uint32_t bin = _large_bin(block_size);
+    uint32_t head = large_bins[bin];
+
+    write(block + HEAP_NEXT_OFFSET, head);
+    write(block + HEAP_PREV_OFFSET, 0);
+    if (head != 0) write(head + HEAP_PREV_OFFSET, block);
+
+    large_bins[bin] = block;
+    large_bin_mask |= 1u << bin;
+}
+
+bool GuestHeap::large_unlink(uint32_t block)
+{
+    uint32_t next = read(block + HEAP_NEXT_OFFSET);
+    uint32_t prev = read(block + HEAP_PREV_OFFSET);
+
+    if ((next != 0 && !valid_free_block(next)) || (prev != 0 && !valid_free_block(prev)))
+    {
+        return false;
+    }
+
+    if (next != 0) write(next + HEAP_PREV_OFFSET, prev);
+
+    if (prev != 0)
+    {
+        write(prev + HEAP_NEXT_OFFSET, next);
+    }
+    else
+    {
+        uint32_t bin = _large_bin(read(block + HEAP_SIZE_OFFSET) & ~HEAP_FLAG_MASK);
+        large_bins[bin] = next;
+        if (next == 0) large_bin_mask &= ~(1u << bin);
+    }
+
+    return true;
+}
+
+void GuestHeap::free(uint32_t addr)
+{
+    if (addr == 0) return;
+
+    uint32_t block = addr - HEAP_HEADER_SIZE;
+    uint32_t header = (addr >= heap_start + HEAP_HEADER_SIZE && valid_block(block)) ? read(block) : 0;
+
+    if (!(header & HEAP_FLAG_USED))
+    {
+        std::cout << "WARNING: Free of invalid or already freed heap pointer " << addr << "\n";
+        return;
+    }
+
+    uint32_t block_size = header & ~HEAP_FLAG_MASK;
+
+    if (guarded(block, block_size))
+    {
+        std::cout << "WARNING: Free of heap pointer " << addr << " holding a running thread's stack\n";
+        return;
+    }
+
+    // Neighbours are checked before anything changes, a corrupted heap leaks the block instead
+    uint32_t next = block + block_size;
+    uint32_t prev_size = read(block + HEAP_PREV_SIZE_OFFSET);
+    uint32_t prev = block - prev_size;
+
+    bool corrupted = false;
+    if (header & HEAP_FLAG_SMALL)
+    {
+        corrupted = block_size > HEAP_SMALL_MAX + HEAP_HEADER_SIZE;
+    }
+    else
+    {
+        corrupted = (next < heap_top && !valid_block(next)) || (block > heap_start &&
+            (prev_size > block - heap_start || !valid_block(prev) || (read(prev + HEAP_SIZE_OFFSET) & ~HEAP_FLAG_MASK) != prev_size));
+
+        // Free neighbours are merged in, so they and the header after the merged block must be clear of guard pages
+        if (!corrupted && next < heap_top && !(read(next + HEAP_SIZE_OFFSET) & (HEAP_FLAG_USED | HEAP_FLAG_SMALL)))
+        {
+            uint32_t after = next + read(next + HEAP_SIZE_OFFSET);
+            corrupted = !valid_free_block(next) || (after < heap_top && guarded(after, HEAP_HEADER_SIZE));
+        }
+
+        if (!corrupted && block > heap_start && !(read(prev + HEAP_SIZE_OFFSET) & (HEAP_FLAG_USED | HEAP_FLAG_SMALL)))
+        {
+            corrupted = !valid_free_block(prev);
+        }
+    }
+
+    if (corrupted)
+    {
+        report_corruption(block);
+        return;
+    }
+
+    stats.free_count++;
+    stats.bytes_in_use -= block_size;
+
+    if (header & HEAP_FLAG_SMALL)
+    {
+        uint32_t class_index = (block_size - HEAP_HEADER_SIZE) / 8 - 1;
+        write(block + HEAP_SIZE_OFFSET, block_size | HEAP_FLAG_SMALL);
+        write(block + HEAP_NEXT_OFFSET, small_free[class_index]);
+        small_free[class_index] = block;
+        stats.bytes_free += block_size;
+        return;
+    }
+
+    // Merge with free large neighbours, small blocks are never merged
+    if (next < heap_top)
+    {
+        uint32_t next_header = read(next + HEAP_SIZE_OFFSET);
+        if (!(next_header & (HEAP_FLAG_USED | HEAP_FLAG_SMALL)))
+        {
+            if (!large_unlink(next))
+            {
+                report_corruption(next);
+                return;
+            }
+
+            block_size += next_header;
+            stats.bytes_free -= next_header;
+        }
+    }
+
+    if (block > heap_start)
+    {
+        uint32_t prev_header = read(prev + HEAP_SIZE_OFFSET);
+        if (!(prev_header & (HEAP_FLAG_USED | HEAP_FLAG_SMALL)))
+        {
+            if (!large_unlink(prev))
+            {
+                report_corruption(prev);
+                return;
+            }
+
+            block = prev;
+            block_size += prev_header;
+            stats.bytes_free -= prev_header;
+        }
+    }
+
+    // Blocks at the top go back to untouched space
+    if (block + block_size == heap_top)
+    {
+        heap_top = block;
+        top_prev_size = read(block + HEAP_PREV_SIZE_OFFSET);
+        return;
+    }
+
+    write(block + HEAP_SIZE_OFFSET, block_size);
+    write(block + block_size + HEAP_PREV_SIZE_OFFSET, block_size);
+
+    large_insert(block, block_size);
+    stats.bytes_free += block_size;
+}
+
+void GuestHeap::print_stats() const
+{
+    // Largest block that could be handed out without growing the heap
+    uint32_t largest_free = 0;
+    for (uint32_t head : large_bins)
+    {
+        for (uint32_t block = head; block != 0 && valid_free_block(block); block = read(block + HEAP_NEXT_OFFSET))
+        {
+            uint32_t block_size = read(block + HEAP_SIZE_OFFSET) & ~HEAP_FLAG_MASK;
+            if (block_size > largest_free) largest_free = block_size;
+        }
+    }
+
+    double fragmentation = stats.bytes_free > 0 ? 100.0 * (1.0 - (double)largest_free / stats.bytes_free) : 0.0;
+
+    std::cout << "Heap: " << stats.alloc_count << " allocs, " << stats.free_count << " frees, " <<
+        stats.failed_count << " failed\n";
+    std::cout << "Heap: " << stats.bytes_in_use << " bytes in use (peak " << stats.bytes_peak << "), " <<
+        heap_top - heap_start << " bytes of " << heap_end - heap_start << " reserved\n";
+    std::cout << "Heap: " << stats.bytes_free << " bytes in free lists, fragmentation " << fragmentation << "%\n";
+}
\ No newline at end of file
@@ -0,0 +1,2028 @@
+#include <iostream>
+#include <cstring>
+#include <cstddef>
+#include <algorithm>
+
+#include "jit.hpp"
+#include "VirtualMachine.hpp"
+
+#include "ISA.hpp"
+
+#if defined(__x86_64__) && defined(__linux__)
+#define JIT_SUPPORTED 1
+#include <sys/mman.h>
+#else
+#define JIT_SUPPORTED 0
+#endif
+
+#define JIT_CODE_BUFFER_SIZE 32 * 1024 * 1024
+
+// Set in the index returned by native code to have the interpreter run that instruction once before re-entering,
+// used where a template finds a case it cannot handle (e.g. a misaligned vector access, which the interpreter reports)
+#define JIT_EXIT_STEP 0x80000000u
+
+// Space needed to emit the largest block before checking the buffer
+#define JIT_MAX_BLOCK_INSTRUCTIONS 256
+#define JIT_MAX_INSTRUCTION_BYTES 64
+
+// Size of the direct jump written over a pending chain exit
+#define JIT_CHAIN_JUMP_BYTES 5
+
+#if JIT_SUPPORTED
+
+enum HostReg : uint8_t
+{
+    RAX = 0, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15
+};
+
+enum HostCond : uint8_t
+{
+    COND_B = 0x2, COND_AE = 0x3, COND_E = 0x4, COND_NE = 0x5, COND_BE = 0x6, COND_A = 0x7,
+    COND_NP = 0xB, COND_L = 0xC, COND_GE = 0xD
+};
+
+// Guest registers kept in host registers while native code runs, ax..r6 and fax..f13.
+// The rest are read and written straight from JitState.
+#define JIT_PINNED_GPR_COUNT 7
+#define JIT_PINNED_XMM_COUNT 14
+
+static const uint8_t guest_gpr[JIT_PINNED_GPR_COUNT] = {R8, R9, R10, R11, RSI, RDI, RBP};
+static const uint8_t guest_xmm[JIT_PINNED_XMM_COUNT] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13};
+
+static const uint8_t HOST_STACK_PTR = R12;
+static const uint8_t HOST_BASE_PTR = R13;
+static const uint8_t HOST_MEMORY = R14;
+static const uint8_t HOST_BLOCK_TABLE = R15;
+static const uint8_t HOST_STATE = RBX;
+
+static const uint8_t XMM_SCRATCH_A = 14;
+static const uint8_t XMM_SCRATCH_B = 15;
+
+#define STATE_OFFSET(field) static_cast<int32_t>(offsetof(JitState, field))
+#define STATE_REGISTER_OFFSET(id) static_cast<int32_t>(offsetof(JitState, registers) + (id) * 4)
+#define VECTOR_OFFSET(id) static_cast<int32_t>((id) * sizeof(VectorRegister))
+
+// Minimal x86-64 encoder, only the forms the templates need. 32 bit operations zero the upper half of
+// host registers, so guest values can be used directly as 64 bit indices into guest memory.
+class CodeEmitter
+{
+public:
+    CodeEmitter(uint8_t* code) : start(code), ptr(code) {}
+
+    uint8_t* position() const { return ptr; }
+    size_t size() const { return ptr - start; }
+
+    void byte(uint8_t value) { *ptr++ = value; }
+
+    void dword(uint32_t value)
+    {
+        memcpy(ptr, &value, 4);
+        ptr += 4;
+    }
+
+    void rex(bool w, uint8_t reg, uint8_t index, uint8_t base, bool force = false)
+    {
+        uint8_t value = 0x40 | (w << 3) | ((reg >> 3) << 2) | ((index >> 3) << 1) | (base >> 3);
+        if (value != 0x40 || force) byte(value);
+    }
+
+    void modrm(uint8_t mod, uint8_t reg, uint8_t rm) { byte((mod << 6) | ((reg & 7) << 3) | (rm & 7)); }
+
+    // [rbx + disp32]
+    void mem_state(uint8_t reg, int32_t disp)
+    {
+        modrm(2, reg, HOST_STATE);
+        dword(disp);
+    }
+
+    // [r14 + index + disp32]
+    void mem_guest(uint8_t reg, uint8_t index, int32_t disp)
+    {
+        modrm(2, reg, 4);
+        byte(((index & 7) << 3) | (HOST_MEMORY & 7));
+        dword(disp);
+    }
+
+    void mov_rr32(uint8_t dst, uint8_t src)
+    {
+        rex(false, src, 0, dst);
+        byte(0x89);
+        modrm(3, src, dst);
+    }
+
+    // lea dst32, [base + disp32], wraps at 32 bits like guest address arithmetic
+    void lea_r32(uint8_t dst, uint8_t base, int32_t disp)
+    {
+        rex(false, dst, 0, base);
+        byte(0x8D);
+        modrm(2, dst, base);
+        if ((base & 7) == 4) byte(0x24);
+        dword(disp);
+    }
+
+    void mov_ri32(uint8_t dst, uint32_t imm)
+    {
+        rex(false, 0, 0, dst);
+        byte(0xB8 + (dst & 7));
+        dword(imm);
+    }
+
+    // add 0x01, or 0x09, and 0x21, sub 0x29, xor 0x31, cmp 0x39
+    void alu_rr32(uint8_t op, uint8_t dst, uint8_t src)
+    {
+        rex(false, src, 0, dst);
+        byte(op);
+        modrm(3, src, dst);
+    }
+
+    // add /0, sub /5
+    void alu_ri8(uint8_t ext, uint8_t dst, int8_t imm)
+    {
+        rex(false, 0, 0, dst);
+        byte(0x83);
+        modrm(3, ext, dst);
+        byte(imm);
+    }
+
+    // add /0, or /1, and /4, sub /5, xor /6, cmp /7
+    void alu_ri32(uint8_t ext, uint8_t dst, uint32_t imm)
+    {
+        rex(false, 0, 0, dst);
+        byte(0x81);
+        modrm(3, ext, dst);
+        dword(imm);
+    }
+
+    void imul_rri32(uint8_t dst, uint8_t src, uint32_t imm)
+    {
+        rex(false, dst, 0, src);
+        byte(0x69);
+        modrm(3, dst, src);
+        dword(imm);
+    }
+
+    void imul_rr32(uint8_t dst, uint8_t src)
+    {
+        rex(false, dst, 0, src);
+        byte(0x0F);
+        byte(0xAF);
+        modrm(3, dst, src);
+    }
+
+    // shl /4, shr /5, count in cl
+    void shift_cl32(uint8_t ext, uint8_t dst)
+    {
+        rex(false, 0, 0, dst);
+        byte(0xD3);
+        modrm(3, ext, dst);
+    }
+
+    // shl /4, shr /5
+    void shift_ri32(uint8_t ext, uint8_t dst, uint8_t count)
+    {
+        rex(false, 0, 0, dst);
+        byte(0xC1);
+        modrm(3, ext, dst);
+        byte(count);
+    }
+
+    // div /6, idiv /7, dividend in edx:eax
+    void div32(uint8_t ext, uint8_t src)
+    {
+        rex(false, 0, 0, src);
+        byte(0xF7);
+        modrm(3, ext, src);
+    }
+
+    void cdq() { byte(0x99); }
+
+    // 64 bit forms for register pair instructions, same opcodes and extensions as the 32 bit ones
+    void alu_rr64(uint8_t op, uint8_t dst, uint8_t src)
+    {
+        rex(true, src, 0, dst);
+        byte(op);
+        modrm(3, src, dst);
+    }
+
+    void imul_rr64(uint8_t dst, uint8_t src)
+    {
+        rex(true, dst, 0, src);
+        byte(0x0F);
+        byte(0xAF);
+        modrm(3, dst, src);
+    }
+
+    void shift_ri64(uint8_t ext, uint8_t dst, uint8_t count)
+    {
+        rex(true, 0, 0, dst);
+        byte(0xC1);
+        modrm(3, ext, dst);
+        byte(count);
+    }
+
+    // div /6, idiv /7, dividend in rdx:rax
+    void div64(uint8_t ext, uint8_t src)
+    {
+        rex(true, 0, 0, src);
+        byte(0xF7);
+        modrm(3, ext, src);
+    }
+
+    void cqo()
+    {
+        byte(0x48);
+        byte(0x99);
+    }
+
+    void load_guest32(uint8_t dst, uint8_t index, int32_t disp)
+    {
+        rex(false, dst, index, HOST_MEMORY);
+        byte(0x8B);
+        mem_guest(dst, index, disp);
+    }
+
+    void store_guest32(uint8_t src, uint8_t index, int32_t disp)
+    {
+        rex(false, src, index, HOST_MEMORY);
+        byte(0x89);
+        mem_guest(src, index, disp);
+    }
+
+    // movzx 0xB6 (byte) / 0xB7 (half), movsx 0xBE / 0xBF
+    void load_guest_extend(uint8_t op, uint8_t dst, uint8_t index, int32_t disp)
+    {
+        rex(false, dst, index, HOST_MEMORY);
+        byte(0x0F);
+        byte(op);
+        mem_guest(dst, index, disp);
+    }
+
+    void store_guest8(uint8_t src, uint8_t index, int32_t disp)
+    {
+        rex(false, src, index, HOST_MEMORY, true);
+        byte(0x88);
+        mem_guest(src, index, disp);
+    }
+
+    void store_guest16(uint8_t src, uint8_t index, int32_t disp)
+    {
+        byte(0x66);
+        rex(false, src, index, HOST_MEMORY);
+        byte(0x89);
+        mem_guest(src, index, disp);
+    }
+
+    void store_guest_imm32(uint8_t index, int32_t disp, uint32_t imm)
+    {
+        rex(false, 0, index, HOST_MEMORY);
+        byte(0xC7);
+        mem_guest(0, index, disp);
+        dword(imm);
+    }
+
+    void load_state32(uint8_t dst, int32_t disp)
+    {
+        rex(false, dst, 0, 0);
+        byte(0x8B);
+        mem_state(dst, disp);
+    }
+
+    void store_state32(uint8_t src, int32_t disp)
+    {
+        rex(false, src, 0, 0);
+        byte(0x89);
+        mem_state(src, disp);
+    }
+
+    void load_state64(uint8_t dst, int32_t disp)
+    {
+        rex(true, dst, 0, 0);
+        byte(0x8B);
+        mem_state(dst, disp);
+    }
+
+    void cmp_r32_state(uint8_t reg, int32_t disp)
+    {
+        rex(false, reg, 0, 0);
+        byte(0x3B);
+        mem_state(reg, disp);
+    }
+
+    // Only al, cl, dl are used as byte registers
+    void store_state8(uint8_t src, int32_t disp)
+    {
+        byte(0x88);
+        mem_state(src, disp);
+    }
+
+    void mov_state8_imm(int32_t disp, uint8_t imm)
+    {
+        byte(0xC6);
+        mem_state(0, disp);
+        byte(imm);
+    }
+
+    void cmp_state8_imm(int32_t disp, uint8_t imm)
+    {
+        byte(0x80);
+        mem_state(7, disp);
+        byte(imm);
+    }
+
+    void sub_state32_imm8(int32_t disp, int8_t imm)
+    {
+        byte(0x83);
+        mem_state(5, disp);
+        byte(imm);
+    }
+
+    void setcc(uint8_t cond, uint8_t dst8)
+    {
+        byte(0x0F);
+        byte(0x90 + cond);
+        modrm(3, 0, dst8);
+    }
+
+    // and 0x20, or 0x08
+    void alu_rr8(uint8_t op, uint8_t dst8, uint8_t src8)
+    {
+        byte(op);
+        modrm(3, src8, dst8);
+    }
+
+    void xor_r8_imm(uint8_t dst8, uint8_t imm)
+    {
+        byte(0x80);
+        modrm(3, 6, dst8);
+        byte(imm);
+    }
+
+    void movss_rr(uint8_t dst, uint8_t src)
+    {
+        byte(0xF3);
+        rex(false, dst, 0, src);
+        byte(0x0F);
+        byte(0x10);
+        modrm(3, dst, src);
+    }
+
+    // addss 0x58, mulss 0x59, subss 0x5C, divss 0x5E
+    void sse_op(uint8_t op, uint8_t dst, uint8_t src)
+    {
+        byte(0xF3);
+        rex(false, dst, 0, src);
+        byte(0x0F);
+        byte(op);
+        modrm(3, dst, src);
+    }
+
+    // addsd 0x58, mulsd 0x59, subsd 0x5C, divsd 0x5E, cvtsd2ss 0x5A
+    void sd_op(uint8_t op, uint8_t dst, uint8_t src)
+    {
+        byte(0xF2);
+        rex(false, dst, 0, src);
+        byte(0x0F);
+        byte(op);
+        modrm(3, dst, src);
+    }
+
+    // roundss with the rounding mode in imm, needs SSE4.1
+    void roundss(uint8_t dst, uint8_t src, uint8_t imm)
+    {
+        byte(0x66);
+        rex(false, dst, 0, src);
+        byte(0x0F);
+        byte(0x3A);
+        byte(0x0A);
+        modrm(3, dst, src);
+        byte(imm);
+    }
+
+    // 3 byte VEX prefix without an index register, vvvv is the extra source register
+    void vex3(uint8_t reg, uint8_t base, uint8_t map, uint8_t vvvv, uint8_t pp)
+    {
+        byte(0xC4);
+        byte((((~reg >> 3) & 1) << 7) | (1 << 6) | (((~base >> 3) & 1) << 5) | map);
+        byte(((~vvvv & 15) << 3) | pp);
+    }
+
+    // vfmadd231ss dst, a, b: dst = a * b + dst rounded once, needs FMA
+    void vfmadd231ss(uint8_t dst, uint8_t a, uint8_t b)
+    {
+        vex3(dst, b, 2, a, 1);
+        byte(0xB9);
+        modrm(3, dst, b);
+    }
+
+    void vfmadd231ss_state(uint8_t dst, uint8_t a, int32_t disp)
+    {
+        vex3(dst, HOST_STATE, 2, a, 1);
+        byte(0xB9);
+        mem_state(dst, disp);
+    }
+
+    void movss_load_state(uint8_t dst, int32_t disp)
+    {
+        byte(0xF3);
+        rex(false, dst, 0, 0);
+        byte(0x0F);
+        byte(0x10);
+        mem_state(dst, disp);
+    }
+
+    void movss_store_state(uint8_t src, int32_t disp)
+    {
+        byte(0xF3);
+        rex(false, src, 0, 0);
+        byte(0x0F);
+        byte(0x11);
+        mem_state(src, disp);
+    }
+
+    void movd_xmm_r32(uint8_t dst, uint8_t src)
+    {
+        byte(0x66);
+        rex(false, dst, 0, src);
+        byte(0x0F);
+        byte(0x6E);
+        modrm(3, dst, src);
+    }
+
+    void movd_r32_xmm(uint8_t dst, uint8_t src)
+    {
+        byte(0x66);
+        rex(false, src, 0, dst);
+        byte(0x0F);
+        byte(0x7E);
+        modrm(3, src, dst);
+    }
+
+    void movq_xmm_r64(uint8_t dst, uint8_t src)
+    {
+        byte(0x66);
+        rex(true, dst, 0, src);
+        byte(0x0F);
+        byte(0x6E);
+        modrm(3, dst, src);
+    }
+
+    void movq_r64_xmm(uint8_t dst, uint8_t src)
+    {
+        byte(0x66);
+        rex(true, src, 0, dst);
+        byte(0x0F);
+        byte(0x7E);
+        modrm(3, src, dst);
+    }
+
+    // Source is zero extended, so converts as unsigned 32 bit
+    void cvtsi2ss_r64(uint8_t dst, uint8_t src)
+    {
+        byte(0xF3);
+        rex(true, dst, 0, src);
+        byte(0x0F);
+        byte(0x2A);
+        modrm(3, dst, src);
+    }
+
+    void cvttss2si_r64(uint8_t dst, uint8_t src)
+    {
+        byte(0xF3);
+        rex(true, dst, 0, src);
+        byte(0x0F);
+        byte(0x2C);
+        modrm(3, dst, src);
+    }
+
+    void ucomiss(uint8_t a, uint8_t b)
+    {
+        rex(false, a, 0, b);
+        byte(0x0F);
+        byte(0x2E);
+        modrm(3, a, b);
+    }
+
+    void ucomisd(uint8_t a, uint8_t b)
+    {
+        byte(0x66);
+        ucomiss(a, b);
+    }
+
+    // [base + disp32], base must not be rsp/rbp/r12/r13
+    void mem_base(uint8_t reg, uint8_t base, int32_t disp)
+    {
+        modrm(2, reg, base);
+        dword(disp);
+    }
+
+    void load_base32(uint8_t dst, uint8_t base, int32_t disp)
+    {
+        rex(false, dst, 0, base);
+        byte(0x8B);
+        mem_base(dst, base, disp);
+    }
+
+    void store_base32(uint8_t src, uint8_t base, int32_t disp)
+    {
+        rex(false, src, 0, base);
+        byte(0x89);
+        mem_base(src, base, disp);
+    }
+
+    void test_ri32(uint8_t reg, uint32_t imm)
+    {
+        rex(false, 0, 0, reg);
+        byte(0xF7);
+        modrm(3, 0, reg);
+        dword(imm);
+    }
+
+    // movups xmm, [base + disp32]
+    void movups_load(uint8_t dst, uint8_t base, int32_t disp)
+    {
+        rex(false, dst, 0, base);
+        byte(0x0F);
+        byte(0x10);
+        mem_base(dst, base, disp);
+    }
+
+    void movups_store(uint8_t src, uint8_t base, int32_t disp)
+    {
+        rex(false, src, 0, base);
+        byte(0x0F);
+        byte(0x11);
+        mem_base(src, base, disp);
+    }
+
+    void movups_load_guest(uint8_t dst, uint8_t index)
+    {
+        rex(false, dst, index, HOST_MEMORY);
+        byte(0x0F);
+        byte(0x10);
+        mem_guest(dst, index, 0);
+    }
+
+    void movups_store_guest(uint8_t src, uint8_t index)
+    {
+        rex(false, src, index, HOST_MEMORY);
+        byte(0x0F);
+        byte(0x11);
+        mem_guest(src, index, 0);
+    }
+
+    // Packed op on xmm registers, prefix 0x66 for integer forms (0 for none). Opcodes above 0xFF are 0x38xx three byte forms
+    // addps 0x58, mulps 0x59, subps 0x5C, minps 0x5D, maxps 0x5F, paddd 0xFE, psubd 0xFA, pcmpeqd 0x76, pcmpgtd 0x66,
+    // pand 0xDB, por 0xEB, pxor 0xEF, pmulld 0x3840, pminsd 0x3839, pmaxsd 0x383D
+    void sse_packed(uint8_t prefix, uint16_t op, uint8_t dst, uint8_t src)
+    {
+        if (prefix) byte(prefix);
+        rex(false, dst, 0, src);
+        byte(0x0F);
+        if (op > 0xFF) byte(op >> 8);
+        byte(op & 0xFF);
+        modrm(3, dst, src);
+    }
+
+    // cmpps with predicate, 0 equal, 1 less than
+    void cmpps(uint8_t dst, uint8_t src, uint8_t predicate)
+    {
+        rex(false, dst, 0, src);
+        byte(0x0F);
+        byte(0xC2);
+        modrm(3, dst, src);
+        byte(predicate);
+    }
+
+    void pshufd(uint8_t dst, uint8_t src, uint8_t selector)
+    {
+        byte(0x66);
+        rex(false, dst, 0, src);
+        byte(0x0F);
+        byte(0x70);
+        modrm(3, dst, src);
+        byte(selector);
+    }
+
+    void push(uint8_t reg)
+    {
+        rex(false, 0, 0, reg);
+        byte(0x50 + (reg & 7));
+    }
+
+    void pop(uint8_t reg)
+    {
+        rex(false, 0, 0, reg);
+        byte(0x58 + (reg & 7));
+    }
+
+    void mov_rr64(uint8_t dst, uint8_t src)
+    {
+        rex(true, src, 0, dst);
+        byte(0x89);
+        modrm(3, src, dst);
+    }
+
+    void test_rr64(uint8_t a, uint8_t b)
+    {
+        rex(true, b, 0, a);
+        byte(0x85);
+        modrm(3, b, a);
+    }
+
+    // mov eax, [base + index * 4]
+    void load_index32(uint8_t dst, uint8_t base, uint8_t index)
+    {
+        rex(false, dst, index, base);
+        byte(0x8B);
+        modrm(0, dst, 4);
+        byte((2 << 6) | ((index & 7) << 3) | (base & 7));
+    }
+
+    // mov rcx, [base + index * 8]
+    void load_index64(uint8_t dst, uint8_t base, uint8_t index)
+    {
+        rex(true, dst, index, base);
+        byte(0x8B);
+        modrm(0, dst, 4);
+        byte((3 << 6) | ((index & 7) << 3) | (base & 7));
+    }
+
+    void jmp_reg(uint8_t reg)
+    {
+        rex(false, 0, 0, reg);
+        byte(0xFF);
+        modrm(3, 4, reg);
+    }
+
+    void jmp_rel32(const uint8_t* target)
+    {
+        byte(0xE9);
+        dword(static_cast<uint32_t>(target - (ptr + 4)));
+    }
+
+    // Returns position of rel32 to patch
+    uint8_t* jcc_rel32(uint8_t cond)
+    {
+        byte(0x0F);
+        byte(0x80 + cond);
+        uint8_t* patch = ptr;
+        dword(0);
+        return patch;
+    }
+
+    uint8_t* jcc_rel8(uint8_t cond)
+    {
+        byte(0x70 + cond);
+        uint8_t* patch = ptr;
+        byte(0);
+        return patch;
+    }
+
+    void ret() { byte(0xC3); }
+
+    static void patch_rel32(uint8_t* patch, const uint8_t* target)
+    {
+        uint32_t rel = static_cast<uint32_t>(target - (patch + 4));
+        memcpy(patch, &rel, 4);
+    }
+
+    static void patch_rel8(uint8_t* patch, const uint8_t* target)
+    {
+        *patch = static_cast<uint8_t>(target - (patch + 1));
+    }
+
+private:
+    uint8_t* start;
+    uint8_t* ptr;
+
+};
+
+static bool _is_pinned_gpr(uint8_t reg_id)
+{
+    return reg_id < JIT_PINNED_GPR_COUNT;
+}
+
+static bool _is_pinned_xmm(uint8_t reg_id)
+{
+    return reg_id >= REGISTER_FLOAT_START && reg_id - REGISTER_FLOAT_START < JIT_PINNED_XMM_COUNT;
+}
+
+// Returns host register holding the guest register's 32 bit value, moving float bits or an unpinned register into
+// scratch if needed
+static uint8_t _guest_value_gpr(CodeEmitter& emitter, uint8_t reg_id, uint8_t scratch)
+{
+    if (_is_pinned_gpr(reg_id)) return guest_gpr[reg_id];
+
+    if (_is_pinned_xmm(reg_id))
+    {
+        emitter.movd_r32_xmm(scratch, guest_xmm[reg_id - REGISTER_FLOAT_START]);
+    }
+    else
+    {
+        emitter.load_state32(scratch, STATE_REGISTER_OFFSET(reg_id));
+    }
+    return scratch;
+}
+
+// Returns xmm register holding the guest register's bits as a float
+static uint8_t _guest_value_xmm(CodeEmitter& emitter, uint8_t reg_id, uint8_t scratch)
+{
+    if (_is_pinned_xmm(reg_id)) return guest_xmm[reg_id - REGISTER_FLOAT_START];
+
+    if (_is_pinned_gpr(reg_id))
+    {
+        emitter.movd_xmm_r32(scratch, guest_gpr[reg_id]);
+    }
+    else
+    {
+        emitter.movss_load_state(scratch, STATE_REGISTER_OFFSET(reg_id));
+    }
+    return scratch;
+}
+
+// Host register to produce an int result for the guest register in, written back with _write_guest_gpr
+static uint8_t _guest_dst_gpr(uint8_t reg_id, uint8_t scratch)
+{
+    return _is_pinned_gpr(reg_id) ? guest_gpr[reg_id] : scratch;
+}
+
+// Leaves the 32 bit guest address of a loadx/storex memory operand in ecx, clobbers edx
+static void _emit_memory_operand_addr(CodeEmitter& emitter, const DecodedInstruction& instr)
+{
+    if (instr.reg_b_id != MEMORY_OPERAND_NO_REG)
+    {
+        emitter.lea_r32(RCX, _guest_value_gpr(emitter, instr.reg_b_id, RCX), instr.imm);
+    }
+    else
+    {
+        emitter.mov_ri32(RCX, instr.imm);
+    }
+
+    if (instr.reg_c_id != MEMORY_OPERAND_NO_REG)
+    {
+        emitter.mov_rr32(RDX, _guest_value_gpr(emitter, instr.reg_c_id, RDX));
+        if (instr.target) emitter.shift_ri32(4, RDX, instr.target);
+        emitter.alu_rr32(0x01, RCX, RDX);
+    }
+}
+
+static void _write_guest_gpr(CodeEmitter& emitter, uint8_t reg_id, uint8_t src)
+{
+    if (_is_pinned_gpr(reg_id))
+    {
+        if (guest_gpr[reg_id] != src) emitter.mov_rr32(guest_gpr[reg_id], src);
+    }
+    else if (_is_pinned_xmm(reg_id))
+    {
+        emitter.movd_xmm_r32(guest_xmm[reg_id - REGISTER_FLOAT_START], src);
+    }
+    else
+    {
+        emitter.store_state32(src, STATE_REGISTER_OFFSET(reg_id));
+    }
+}
+
+static void _write_guest_xmm(CodeEmitter& emitter, uint8_t reg_id, uint8_t src)
+{
+    if (_is_pinned_xmm(reg_id))
+    {
+        if (guest_xmm[reg_id - REGISTER_FLOAT_START] != src) emitter.movss_rr(guest_xmm[reg_id - REGISTER_FLOAT_START], src);
+    }
+    else if (_is_pinned_gpr(reg_id))
+    {
+        emitter.movd_r32_xmm(guest_gpr[reg_id], src);
+    }
+    else
+    {
+        emitter.movss_store_state(src, STATE_REGISTER_OFFSET(reg_id));
+    }
+}
+
+// Loads the 64 bit value of the register pair starting at reg_id into dst, clobbers scratch
+static void _load_guest_pair(CodeEmitter& emitter, uint8_t reg_id, uint8_t dst, uint8_t scratch)
+{
+    emitter.mov_rr32(dst, _guest_value_gpr(emitter, reg_id, dst));
+    emitter.mov_rr32(scratch, _guest_value_gpr(emitter, reg_id + 1, scratch));
+    emitter.shift_ri64(4, scratch, 32);
+    emitter.alu_rr64(0x09, dst, scratch);
+}
+
+// Splits src back into the register pair starting at reg_id, clobbers src
+static void _write_guest_pair(CodeEmitter& emitter, uint8_t reg_id, uint8_t src)
+{
+    _write_guest_gpr(emitter, reg_id, src);
+    emitter.shift_ri64(5, src, 32);
+    _write_guest_gpr(emitter, reg_id + 1, src);
+}
+
+#endif
+
+Jit::Jit(VirtualMachine& vm, ThreadContext& context, uint32_t hot_threshold) : vm(vm), context(context), hot_threshold(hot_threshold)
+{
+    const DecodedProgram& program = vm.image->decoded_program;
+
+    block_table.assign(program.instructions.size(), nullptr);
+    block_counts.assign(program.instructions.size(), 0);
+
+    state.memory = vm.memory.data();
+    state.block_table = block_table.data();
+    state.addr_to_index = program.addr_to_index.data();
+    state.addr_last = program.addr_to_index.size() - 1;
+    state.vectors = context.vectors;
+
+    #if JIT_SUPPORTED
+    void* buffer = mmap(nullptr, JIT_CODE_BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffer == MAP_FAILED)
+    {
+        std::cout << "WARNING: Could not allocate JIT code buffer\n";
+        code_buffer_full = true;
+        return;
+    }
+
+    code_buffer = static_cast<uint8_t*>(buffer);
+    code_buffer_size = JIT_CODE_BUFFER_SIZE;
+
+    emit_trampolines();
+
+    if (!protect_code(code_buffer, code_buffer + code_buffer_top, PROT_READ | PROT_EXEC))
+    {
+        disable_code_buffer();
+    }
+    #else
+    code_buffer_full = true;
+    #endif
+}
+
+Jit::~Jit()
+{
+    #if JIT_SUPPORTED
+    if (code_buffer)
+    {
+        munmap(code_buffer, code_buffer_size);
+    }
+    #endif
+}
+
+uint32_t Jit::guest_index_from_host_pc(uintptr_t pc) const
+{
+    uintptr_t start = reinterpret_cast<uintptr_t>(code_buffer);
+    if (pc < start || pc >= start + code_buffer_top) return UINT32_MAX;
+
+    uint32_t offset = pc - start;
+    auto iter = std::upper_bound(host_pc_map.begin(), host_pc_map.end(), offset,
+        [](uint32_t value, const std::pair<uint32_t, uint32_t>& entry) { return value < entry.first; });
+
+    if (iter == host_pc_map.begin()) return UINT32_MAX;
+    return std::prev(iter)->second;
+}
+
+bool Jit::is_supported()
+{
+    return JIT_SUPPORTED;
+}
+
+bool Jit::is_translatable(uint8_t opcode) const
+{
+    switch (opcode)
+    {
+        case INSTR_SYSCALL:
+        // Atomics are rare enough to leave to the interpreter, which also reports misaligned addresses
+        case INSTR_XADD:
+        case INSTR_XCHG:
+        case INSTR_CAS:
+        case INSTR_FENCE:
+            return false;
+        // pmulld/pminsd/pmaxsd need SSE4.1, without it these are left to the interpreter
+        case INSTR_VMUL:
+        case INSTR_VMIN:
+        case INSTR_VMAX:
+        case INSTR_FFLOOR:
+            #if JIT_SUPPORTED
+            return __builtin_cpu_supports("sse4.1");
+            #else
+            return false;
+            #endif
+        case INSTR_FFMA:
+            #if JIT_SUPPORTED
+            return __builtin_cpu_supports("fma");
+            #else
+            return false;
+            #endif
+        // No host instruction, the interpreter calls libm
+        case INSTR_FSIN:
+        case INSTR_FCOS:
+            return false;
+    }
+
+    return true;
+}
+
+void Jit::save_state()
+{
+    for (int i = 0; i < REGISTER_COUNT; i++)
+    {
+        state.registers[i] = context.registers[i].u;
+    }
+
+    state.stack_ptr = context.reg_stack_ptr;
+    state.base_ptr = context.reg_base_ptr;
+    state.poll_countdown = context.poll_countdown;
+    state.flag_zero = context.flag_zero;
+    state.flag_sign = context.flag_sign;
+    state.flag_carry = context.flag_carry;
+}
+
+void Jit::load_state()
+{
+    for (int i = 0; i < REGISTER_COUNT; i++)
+    {
+        context.registers[i].u = state.registers[i];
+    }
+
+    context.reg_stack_ptr = state.stack_ptr;
+    context.reg_base_ptr = state.base_ptr;
+    context.poll_countdown = state.poll_countdown;
+    context.flag_zero = state.flag_zero;
+    context.flag_sign = state.flag_sign;
+    context.flag_carry = state.flag_carry;
+}
+
+void Jit::execute()
+{
+    const std::vector<DecodedInstruction>& instructions = vm.image->decoded_program.instructions;
+    uint32_t ip = context.reg_instruction_ptr;
+
+    while (true)
+    {
+        const DecodedInstruction& instr = instructions[ip];
+        if (instr.opcode == INSTR_STOP)
+        {
+            context.reg_instruction_ptr = ip;
+            return;
+        }
+
+        void* code = block_table[ip];
+        if (!code && !code_buffer_full && is_translatable(instr.opcode) && ++block_counts[ip] >= hot_threshold)
+        {
+            code = compile_block(ip);
+        }
+
+        if (!code)
+        {
+            // Cold code, syscalls and anything without a template go through the interpreter
+            context.reg_instruction_ptr = ip;
+            vm.step(context);
+            ip = context.reg_instruction_ptr;
+            continue;
+        }
+
+        save_state();
+        ip = entry(&state, code);
+        load_state();
+
+        if (ip & JIT_EXIT_STEP)
+        {
+            context.reg_instruction_ptr = ip & ~JIT_EXIT_STEP;
+            vm.step(context);
+            ip = context.reg_instruction_ptr;
+        }
+
+        if (context.poll_countdown == 0)
+        {
+            vm.poll_events_tick(context);
+        }
+    }
+}
+
+#if JIT_SUPPORTED
+
+bool Jit::protect_code(const uint8_t* start, const uint8_t* end, int prot)
+{
+    const uintptr_t page = GuestMemory::page_size();
+    const uintptr_t first = reinterpret_cast<uintptr_t>(start) & ~(page - 1);
+    const uintptr_t last = (reinterpret_cast<uintptr_t>(end) + page - 1) & ~(page - 1);
+
+    return mprotect(reinterpret_cast<void*>(first), last - first, prot) == 0;
+}
+
+void Jit::disable_code_buffer()
+{
+    std::cout << "WARNING: Could not change JIT code buffer protection, interpreting from here on\n";
+
+    code_buffer_full = true;
+    std::fill(block_table.begin(), block_table.end(), nullptr);
+    pending_chains.clear();
+}
+
+void Jit::emit_trampolines()
+{
+    CodeEmitter emitter(code_buffer);
+
+    // uint32_t entry(JitState* state, const void* code)
+    entry = reinterpret_cast<EntryFunction>(emitter.position());
+
+    emitter.push(RBX);
+    emitter.push(RBP);
+    emitter.push(R12);
+    emitter.push(R13);
+    emitter.push(R14);
+    emitter.push(R15);
+
+    // rsi and rdi hold guest registers from here on
+    emitter.mov_rr64(HOST_STATE, RDI);
+    emitter.mov_rr64(RAX, RSI);
+
+    for (uint8_t id = 0; id < JIT_PINNED_GPR_COUNT; id++)
+    {
+        emitter.load_state32(guest_gpr[id], STATE_REGISTER_OFFSET(id));
+    }
+    for (uint8_t id = 0; id < JIT_PINNED_XMM_COUNT; id++)
+    {
+        emitter.movss_load_state(guest_xmm[id], STATE_REGISTER_OFFSET(REGISTER_FLOAT_START + id));
+    }
+
+    emitter.load_state32(HOST_STACK_PTR, STATE_OFFSET(stack_ptr));
+    emitter.load_state32(HOST_BASE_PTR, STATE_OFFSET(base_ptr));
+    emitter.load_state64(HOST_MEMORY, STATE_OFFSET(memory));
+    emitter.load_state64(HOST_BLOCK_TABLE, STATE_OFFSET(block_table));
+
+    emitter.jmp_reg(RAX);
+
+    // Next instruction index in eax
+    common_exit = emitter.position();
+
+    for (uint8_t id = 0; id < JIT_PINNED_GPR_COUNT; id++)
+    {
+        emitter.store_state32(guest_gpr[id], STATE_REGISTER_OFFSET(id));
+    }
+    for (uint8_t id = 0; id < JIT_PINNED_XMM_COUNT; id++)
+    {
+        emitter.movss_store_state(guest_xmm[id], STATE_REGISTER_OFFSET(REGISTER_FLOAT_START + id));
+    }
+
+    emitter.store_state32(HOST_STACK_PTR, STATE_OFFSET(stack_ptr));
+    emitter.store_state32(HOST_BASE_PTR, STATE_OFFSET(base_ptr));
+
+    emitter.pop(R15);
+    emitter.pop(R14);
+    emitter.pop(R13);
+    emitter.pop(R12);
+    emitter.pop(RBP);
+    emitter.pop(RBX);
+    emitter.ret();
+
+    code_buffer_top = emitter.size();
+}
+
+void* Jit::compile_block(uint32_t ip)
+{
+    if (code_buffer_top + JIT_MAX_BLOCK_INSTRUCTIONS * JIT_MAX_INSTRUCTION_BYTES > code_buffer_size)
+    {
+        code_buffer_full = true;
+        return nullptr;
+    }
+
+    // Only the page the last block ended in is executable, everything past it is still writable
+    uint8_t* const write_start = code_buffer + code_buffer_top;
+    if (code_buffer_top % GuestMemory::page_size() != 0 && !protect_code(write_start, write_start + 1, PROT_READ | PROT_WRITE))
+    {
+        disable_code_buffer();
+        return nullptr;
+    }
+
+    const std::vector<DecodedInstruction>& instructions = vm.image->decoded_program.instructions;
+    const uint32_t start_ip = ip;
+    CodeEmitter emitter(code_buffer + code_buffer_top);
+    uint8_t* block_code = emitter.position();
+
+    // Exit to dispatcher with next ip, later patched to jump straight to the target block
+    auto emit_chain = [&](uint32_t target)
+    {
+        if (block_table[target])
+        {
+            emitter.jmp_rel32(static_cast<uint8_t*>(block_table[target]));
+            return;
+        }
+
+        pending_chains[target].push_back(emitter.position());
+        emitter.mov_ri32(RAX, target);
+        emitter.jmp_rel32(common_exit);
+    };
+
+    // Taken control transfers count down to the next event poll, same as the interpreter
+    auto emit_poll_tick = [&](uint32_t target)
+    {
+        emitter.sub_state32_imm8(STATE_OFFSET(poll_countdown), 1);
+        uint8_t* skip = emitter.jcc_rel8(COND_NE);
+        emitter.mov_ri32(RAX, target);
+        emitter.jmp_rel32(common_exit);
+        CodeEmitter::patch_rel8(skip, emitter.position());
+    };
+
+    auto emit_compare_flags = [&](uint8_t sign_cond)
+    {
+        emitter.setcc(COND_E, RAX);
+        emitter.setcc(sign_cond, RCX);
+        emitter.store_state8(RAX, STATE_OFFSET(flag_zero));
+        emitter.store_state8(RCX, STATE_OFFSET(flag_sign));
+        emitter.mov_state8_imm(STATE_OFFSET(flag_carry), 0);
+    };
+
+    // After ucomiss/ucomisd: zero = equal and ordered, sign = neither equal nor greater (true for NaN like the interpreter).
+    // All setcc come first, the and/or below overwrite the host flags
+    auto emit_float_compare_flags = [&]()
+    {
+        emitter.setcc(COND_E, RAX);
+        emitter.setcc(COND_NP, RCX);
+        emitter.setcc(COND_A, RDX);
+        emitter.alu_rr8(0x20, RAX, RCX);
+        emitter.alu_rr8(0x08, RDX, RAX);
+        emitter.xor_r8_imm(RDX, 1);
+
+        emitter.store_state8(RAX, STATE_OFFSET(flag_zero));
+        emitter.store_state8(RDX, STATE_OFFSET(flag_sign));
+        emitter.mov_state8_imm(STATE_OFFSET(flag_carry), 0);
+    };
+
+    bool block_ended = false;
+    for (uint32_t count = 0; !block_ended; count++)
+    {
+        // Super-instructions are translated one original instruction at a time, the pair is still in the stream
+        const DecodedInstruction instr = unfuse_instruction(instructions[ip]);
+
+        if (count >= JIT_MAX_BLOCK_INSTRUCTIONS || !is_translatable(instr.opcode))
+        {
+            emit_chain(ip);
+            break;
+        }
+
+        host_pc_map.emplace_back(emitter.position() - code_buffer, ip);
+
+        switch (instr.opcode)
+        {
+            case INSTR_LOAD:
+            {
+                uint8_t addr = _guest_value_gpr(emitter, instr.reg_b_id, RCX);
+                uint8_t dst = _guest_dst_gpr(instr.reg_a_id, RAX);
+                emitter.load_guest32(dst, addr, 0);
+                _write_guest_gpr(emitter, instr.reg_a_id, dst);
+                break;
+            }
+            case INSTR_LOADS:
+            {
+                uint8_t dst = _guest_dst_gpr(instr.reg_a_id, RAX);
+                emitter.lea_r32(RCX, HOST_BASE_PTR, instr.imm);
+                emitter.load_guest32(dst, RCX, 0);
+                _write_guest_gpr(emitter, instr.reg_a_id, dst);
+                break;
+            }
+            case INSTR_LOADC:
+            {
+                uint8_t dst = _guest_dst_gpr(instr.reg_a_id, RAX);
+                emitter.mov_ri32(dst, instr.imm);
+                _write_guest_gpr(emitter, instr.reg_a_id, dst);
+                break;
+            }
+            case INSTR_LOADX:
+            {
+                _emit_memory_operand_addr(emitter, instr);
+                uint8_t dst = _guest_dst_gpr(instr.reg_a_id, RAX);
+                emitter.load_guest32(dst, RCX, 0);
+                _write_guest_gpr(emitter, instr.reg_a_id, dst);
+                break;
+            }
+            case INSTR_STOREX:
+            {
+                _emit_memory_operand_addr(emitter, instr);
+                uint8_t value = _guest_value_gpr(emitter, instr.reg_a_id, RAX);
+                emitter.store_guest32(value, RCX, 0);
+                break;
+            }
+            case INSTR_LOADB:
+            case INSTR_LOADBI:
+            case INSTR_LOADH:
+            case INSTR_LOADHI:
+            case INSTR_LOADBX:
+            case INSTR_LOADBIX:
+            case INSTR_LOADHX:
+            case INSTR_LOADHIX:
+            {
+                uint8_t addr = RCX;
+                if (instr.opcode >= INSTR_LOADBX)
+                {
+                    _emit_memory_operand_addr(emitter, instr);
+                }
+                else
+                {
+                    addr = _guest_value_gpr(emitter, instr.reg_b_id, RCX);
+                }
+
+                // movzx/movsx by width and signedness
+                uint8_t op = 0;
+                switch (instr.opcode)
+                {
+                    case INSTR_LOADB: case INSTR_LOADBX: op = 0xB6; break;
+                    case INSTR_LOADBI: case INSTR_LOADBIX: op = 0xBE; break;
+                    case INSTR_LOADH: case INSTR_LOADHX: op = 0xB7; break;
+                    default: op = 0xBF; break;
+                }
+
+                uint8_t dst = _guest_dst_gpr(instr.reg_a_id, RAX);
+                emitter.load_guest_extend(op, dst, addr, 0);
+                _write_guest_gpr(emitter, instr.reg_a_id, dst);
+                break;
+            }
+            case INSTR_STOREB:
+            case INSTR_STOREH:
+            case INSTR_STOREBX:
+            case INSTR_STOREHX:
+            {
+                uint8_t addr = RCX;
+                if (instr.opcode == INSTR_STOREB || instr.opcode == INSTR_STOREH)
+                {
+                    addr = _guest_value_gpr(emitter, instr.reg_b_id, RCX);
+                }
+                else
+                {
+                    _emit_memory_operand_addr(emitter, instr);
+                }
+
+                uint8_t value = _guest_value_gpr(emitter, instr.reg_a_id, RAX);
+
+                if (instr.opcode == INSTR_STOREB || instr.opcode == INSTR_STOREBX)
+                {
+                    emitter.store_guest8(value, addr, 0);
+                }
+                else
+                {
+                    emitter.store_guest16(value, addr, 0);
+                }
+                break;
+            }
+            case INSTR_STORE:
+            {
+                uint8_t value = _guest_value_gpr(emitter, instr.reg_a_id, RAX);
+                uint8_t addr = _guest_value_gpr(emitter, instr.reg_b_id, RCX);
+                emitter.store_guest32(value, addr, 0);
+                break;
+            }
+            case INSTR_STORES:
+            {
+                uint8_t value = _guest_value_gpr(emitter, instr.reg_a_id, RAX);
+                emitter.lea_r32(RCX, HOST_BASE_PTR, instr.imm);
+                emitter.store_guest32(value, RCX, 0);
+                break;
+            }
+            case INSTR_COPY:
+            {
+                bool src_float = instr.reg_a_id >= REGISTER_FLOAT_START;
+                bool dest_float = instr.reg_b_id >= REGISTER_FLOAT_START;
+
+                if (!src_float && dest_float)
+                {
+                    uint8_t dst = _is_pinned_xmm(instr.reg_b_id) ? guest_xmm[instr.reg_b_id - REGISTER_FLOAT_START] : XMM_SCRATCH_A;
+                    emitter.cvtsi2ss_r64(dst, _guest_value_gpr(emitter, instr.reg_a_id, RAX));
+                    _write_guest_xmm(emitter, instr.reg_b_id, dst);
+                }
+                else if (src_float && !dest_float)
+                {
+                    uint8_t dst = _guest_dst_gpr(instr.reg_b_id, RAX);
+                    emitter.cvttss2si_r64(dst, _guest_value_xmm(emitter, instr.reg_a_id, XMM_SCRATCH_A));
+                    emitter.mov_rr32(dst, dst);
+                    _write_guest_gpr(emitter, instr.reg_b_id, dst);
+                }
+                else if (src_float)
+                {
+                    _write_guest_xmm(emitter, instr.reg_b_id, _guest_value_xmm(emitter, instr.reg_a_id, XMM_SCRATCH_A));
+                }
+                else
+                {
+                    _write_guest_gpr(emitter, instr.reg_b_id, _guest_value_gpr(emitter, instr.reg_a_id, RAX));
+                }
+                break;
+            }
+            case INSTR_ADD:
+            case INSTR_SUB:
+            case INSTR_AND:
+            case INSTR_OR:
+            case INSTR_XOR:
+            case INSTR_MUL:
+            {
+                emitter.mov_rr32(RAX, _guest_value_gpr(emitter, instr.reg_a_id, RAX));
+                uint8_t b = _guest_value_gpr(emitter, instr.reg_b_id, RCX);
+
+                switch (instr.opcode)
+                {
+                    case INSTR_ADD: emitter.alu_rr32(0x01, RAX, b); break;
+                    case INSTR_SUB: emitter.alu_rr32(0x29, RAX, b); break;
+                    case INSTR_AND: emitter.alu_rr32(0x21, RAX, b); break;
+                    case INSTR_OR: emitter.alu_rr32(0x09, RAX, b); break;
+                    case INSTR_XOR: emitter.alu_rr32(0x31, RAX, b); break;
+                    case INSTR_MUL: emitter.imul_rr32(RAX, b); break;
+                }
+
+                emitter.mov_rr32(guest_gpr[REG_ID_A], RAX);
+                break;
+            }
+            case INSTR_DIV:
+            case INSTR_IDIV:
+            {
+                emitter.mov_rr32(RAX, _guest_value_gpr(emitter, instr.reg_a_id, RAX));
+                uint8_t b = _guest_value_gpr(emitter, instr.reg_b_id, RCX);
+
+                if (instr.opcode == INSTR_DIV)
+                {
+                    emitter.alu_rr32(0x31, RDX, RDX);
+                    emitter.div32(6, b);
+                }
+                else
+                {
+                    emitter.cdq();
+                    emitter.div32(7, b);
+                }
+
+                emitter.mov_rr32(guest_gpr[REG_ID_A], RAX);
+                break;
+            }
+            case INSTR_SHL:
+            case INSTR_SHR:
+            {
+                emitter.mov_rr32(RAX, _guest_value_gpr(emitter, instr.reg_a_id, RAX));
+                emitter.mov_rr32(RCX, _guest_value_gpr(emitter, instr.reg_b_id, RCX));
+                emitter.shift_cl32(instr.opcode == INSTR_SHL ? 4 : 5, RAX);
+                emitter.mov_rr32(guest_gpr[REG_ID_A], RAX);
+                break;
+            }
+            case INSTR_ADD_IMM:
+            case INSTR_SUB_IMM:
+            case INSTR_AND_IMM:
+            case INSTR_OR_IMM:
+            case INSTR_XOR_IMM:
+            case INSTR_MUL_IMM:
+            {
+                uint8_t a = _guest_value_gpr(emitter, instr.reg_a_id, RAX);
+
+                switch (instr.opcode)
+                {
+                    case INSTR_ADD_IMM: emitter.mov_rr32(RAX, a); emitter.alu_ri32(0, RAX, instr.imm); break;
+                    case INSTR_SUB_IMM: emitter.mov_rr32(RAX, a); emitter.alu_ri32(5, RAX, instr.imm); break;
+                    case INSTR_AND_IMM: emitter.mov_rr32(RAX, a); emitter.alu_ri32(4, RAX, instr.imm); break;
+                    case INSTR_OR_IMM: emitter.mov_rr32(RAX, a); emitter.alu_ri32(1, RAX, instr.imm); break;
+                    case INSTR_XOR_IMM: emitter.mov_rr32(RAX, a); emitter.alu_ri32(6, RAX, instr.imm); break;
+                    case INSTR_MUL_IMM: emitter.imul_rri32(RAX, a, instr.imm); break;
+                }
+
+                emitter.mov_rr32(guest_gpr[REG_ID_A], RAX);
+                break;
+            }
+            case INSTR_DIV_IMM:
+            case INSTR_IDIV_IMM:
+            {
+                emitter.mov_rr32(RAX, _guest_value_gpr(emitter, instr.reg_a_id, RAX));
+                emitter.mov_ri32(RCX, instr.imm);
+
+                if (instr.opcode == INSTR_DIV_IMM)
+                {
+                    emitter.alu_rr32(0x31, RDX, RDX);
+                    emitter.div32(6, RCX);
+                }
+                else
+                {
+                    emitter.cdq();
+                    emitter.div32(7, RCX);
+                }
+
+                emitter.mov_rr32(guest_gpr[REG_ID_A], RAX);
+                break;
+            }
+            case INSTR_SHL_IMM:
+            case INSTR_SHR_IMM:
+            {
+                // Through cl so the count is masked the same way as the register form
+                emitter.mov_rr32(RAX, _guest_value_gpr(emitter, instr.reg_a_id, RAX));
+                emitter.mov_ri32(RCX, instr.imm);
+                emitter.shift_cl32(instr.opcode == INSTR_SHL_IMM ? 4 : 5, RAX);
+                emitter.mov_rr32(guest_gpr[REG_ID_A], RAX);
+                break;
+            }
+            case INSTR_NOT:
+            {
+                _write_guest_gpr(emitter, REG_ID_A, _guest_value_gpr(emitter, instr.reg_a_id, RAX));
+                break;
+            }
+            case INSTR_FADD:
+            case INSTR_FSUB:
+            case INSTR_FMUL:
+            case INSTR_FDIV:
+            {
+                emitter.movss_rr(XMM_SCRATCH_A, _guest_value_xmm(emitter, instr.reg_a_id, XMM_SCRATCH_A));
+                uint8_t b = _guest_value_xmm(emitter, instr.reg_b_id, XMM_SCRATCH_B);
+
+                switch (instr.opcode)
+                {
+                    case INSTR_FADD: emitter.sse_op(0x58, XMM_SCRATCH_A, b); break;
+                    case INSTR_FSUB: emitter.sse_op(0x5C, XMM_SCRATCH_A, b); break;
+                    case INSTR_FMUL: emitter.sse_op(0x59, XMM_SCRATCH_A, b); break;
+                    case INSTR_FDIV: emitter.sse_op(0x5E, XMM_SCRATCH_A, b); break;
+                }
+
+                emitter.movss_rr(guest_xmm[REG_ID_FA - REGISTER_FLOAT_START], XMM_SCRATCH_A);
+                break;
+            }
+            case INSTR_CMP:
+            case INSTR_CMPI:
+            {
+                uint8_t a = _guest_value_gpr(emitter, instr.reg_a_id, RAX);
+                uint8_t b = _guest_value_gpr(emitter, instr.reg_b_id, RCX);
+                emitter.alu_rr32(0x39, a, b);
+                emit_compare_flags(instr.opcode == INSTR_CMP ? COND_B : COND_L);
+                break;
+            }
+            case INSTR_ADD3:
+            case INSTR_SUB3:
+            case INSTR_AND3:
+            case INSTR_OR3:
+            case INSTR_XOR3:
+            case INSTR_MUL3:
+            {
+                emitter.mov_rr32(RAX, _guest_value_gpr(emitter, instr.reg_b_id, RAX));
+                uint8_t c = _guest_value_gpr(emitter, instr.reg_c_id, RCX);
+
+                switch (instr.opcode)
+                {
+                    case INSTR_ADD3: emitter.alu_rr32(0x01, RAX, c); break;
+                    case INSTR_SUB3: emitter.alu_rr32(0x29, RAX, c); break;
+                    case INSTR_AND3: emitter.alu_rr32(0x21, RAX, c); break;
+                    case INSTR_OR3: emitter.alu_rr32(0x09, RAX, c); break;
+                    case INSTR_XOR3: emitter.alu_rr32(0x31, RAX, c); break;
+                    case INSTR_MUL3: emitter.imul_rr32(RAX, c); break;
+                }
+
+                _write_guest_gpr(emitter, instr.reg_a_id, RAX);
+                break;
+            }
+            case INSTR_DIV3:
+            case INSTR_IDIV3:
+            {
+                emitter.mov_rr32(RAX, _guest_value_gpr(emitter, instr.reg_b_id, RAX));
+                emitter.mov_rr32(RCX, _guest_value_gpr(emitter, instr.reg_c_id, RCX));
+
+                if (instr.opcode == INSTR_DIV3)
+                {
+                    emitter.alu_rr32(0x31, RDX, RDX);
+                    emitter.div32(6, RCX);
+                }
+                else
+                {
+                    emitter.cdq();
+                    emitter.div32(7, RCX);
+                }
+
+                _write_guest_gpr(emitter, instr.reg_a_id, RAX);
+                break;
+            }
+            case INSTR_SHL3:
+            case INSTR_SHR3:
+            {
+                emitter.mov_rr32(RAX, _guest_value_gpr(emitter, instr.reg_b_id, RAX));
+                emitter.mov_rr32(RCX, _guest_value_gpr(emitter, instr.reg_c_id, RCX));
+                emitter.shift_cl32(instr.opcode == INSTR_SHL3 ? 4 : 5, RAX);
+                _write_guest_gpr(emitter, instr.reg_a_id, RAX);
+                break;
+            }
+            case INSTR_FADD3:
+            case INSTR_FSUB3:
+            case INSTR_FMUL3:
+            case INSTR_FDIV3:
+            {
+                emitter.movss_rr(XMM_SCRATCH_A, _guest_value_xmm(emitter, instr.reg_b_id, XMM_SCRATCH_A));
+                uint8_t c = _guest_value_xmm(emitter, instr.reg_c_id, XMM_SCRATCH_B);
+
+                switch (instr.opcode)
+                {
+                    case INSTR_FADD3: emitter.sse_op(0x58, XMM_SCRATCH_A, c); break;
+                    case INSTR_FSUB3: emitter.sse_op(0x5C, XMM_SCRATCH_A, c); break;
+                    case INSTR_FMUL3: emitter.sse_op(0x59, XMM_SCRATCH_A, c); break;
+                    case INSTR_FDIV3: emitter.sse_op(0x5E, XMM_SCRATCH_A, c); break;
+                }
+
+                _write_guest_xmm(emitter, instr.reg_a_id, XMM_SCRATCH_A);
+                break;
+            }
+            case INSTR_CMP_IMM:
+            case INSTR_CMPI_IMM:
+            {
+                emitter.alu_ri32(7, _guest_value_gpr(emitter, instr.reg_a_id, RAX), instr.imm);
+                emit_compare_flags(instr.opcode == INSTR_CMP_IMM ? COND_B : COND_L);
+                break;
+            }
+            case INSTR_CMPF:
+            {
+                uint8_t a = _guest_value_xmm(emitter, instr.reg_a_id, XMM_SCRATCH_A);
+                uint8_t b = _guest_value_xmm(emitter, instr.reg_b_id, XMM_SCRATCH_B);
+                emitter.ucomiss(a, b);
+                emit_float_compare_flags();
+                break;
+            }
+            case INSTR_FMIN:
+            case INSTR_FMAX:
+            {
+                emitter.movss_rr(XMM_SCRATCH_A, _guest_value_xmm(emitter, instr.reg_b_id, XMM_SCRATCH_A));
+                uint8_t c = _guest_value_xmm(emitter, instr.reg_c_id, XMM_SCRATCH_B);
+                emitter.sse_op(instr.opcode == INSTR_FMIN ? 0x5D : 0x5F, XMM_SCRATCH_A, c);
+                _write_guest_xmm(emitter, instr.reg_a_id, XMM_SCRATCH_A);
+                break;
+            }
+            case INSTR_FFMA:
+            {
+                emitter.movss_rr(XMM_SCRATCH_A, _guest_value_xmm(emitter, instr.reg_a_id, XMM_SCRATCH_A));
+                uint8_t b = _guest_value_xmm(emitter, instr.reg_b_id, XMM_SCRATCH_B);
+
+                // Both scratch registers may be taken, an unpinned third operand is read from its state slot. A pinned
+                // int register's slot is stale inside a block and rewritten on exit, so it can be refreshed here
+                if (_is_pinned_xmm(instr.reg_c_id))
+                {
+                    emitter.vfmadd231ss(XMM_SCRATCH_A, b, guest_xmm[instr.reg_c_id - REGISTER_FLOAT_START]);
+                }
+                else
+                {
+                    if (_is_pinned_gpr(instr.reg_c_id)) emitter.store_state32(guest_gpr[instr.reg_c_id], STATE_REGISTER_OFFSET(instr.reg_c_id));
+                    emitter.vfmadd231ss_state(XMM_SCRATCH_A, b, STATE_REGISTER_OFFSET(instr.reg_c_id));
+                }
+
+                _write_guest_xmm(emitter, instr.reg_a_id, XMM_SCRATCH_A);
+                break;
+            }
+            case INSTR_FSQRT:
+            {
+                emitter.sse_op(0x51, XMM_SCRATCH_A, _guest_value_xmm(emitter, instr.reg_b_id, XMM_SCRATCH_A));
+                _write_guest_xmm(emitter, instr.reg_a_id, XMM_SCRATCH_A);
+                break;
+            }
+            case INSTR_FFLOOR:
+            {
+                // Round toward -inf, precision exception suppressed
+                emitter.roundss(XMM_SCRATCH_A, _guest_value_xmm(emitter, instr.reg_b_id, XMM_SCRATCH_A), 0x09);
+                _write_guest_xmm(emitter, instr.reg_a_id, XMM_SCRATCH_A);
+                break;
+            }
+            case INSTR_FABS:
+            {
+                emitter.mov_rr32(RAX, _guest_value_gpr(emitter, instr.reg_b_id, RAX));
+                emitter.alu_ri32(4, RAX, 0x7FFFFFFF);
+                _write_guest_gpr(emitter, instr.reg_a_id, RAX);
+                break;
+            }
+            case INSTR_ADD64:
+            case INSTR_SUB64:
+            case INSTR_MUL64:
+            {
+                _load_guest_pair(emitter, instr.reg_b_id, RAX, RDX);
+                _load_guest_pair(emitter, instr.reg_c_id, RCX, RDX);
+
+                switch (instr.opcode)
+                {
+                    case INSTR_ADD64: emitter.alu_rr64(0x01, RAX, RCX); break;
+                    case INSTR_SUB64: emitter.alu_rr64(0x29, RAX, RCX); break;
+                    case INSTR_MUL64: emitter.imul_rr64(RAX, RCX); break;
+                }
+
+                _write_guest_pair(emitter, instr.reg_a_id, RAX);
+                break;
+            }
+            case INSTR_DIV64:
+            case INSTR_IDIV64:
+            {
+                _load_guest_pair(emitter, instr.reg_b_id, RAX, RDX);
+                _load_guest_pair(emitter, instr.reg_c_id, RCX, RDX);
+
+                if (instr.opcode == INSTR_DIV64)
+                {
+                    emitter.alu_rr32(0x31, RDX, RDX);
+                    emitter.div64(6, RCX);
+                }
+                else
+                {
+                    emitter.cqo();
+                    emitter.div64(7, RCX);
+                }
+
+                _write_guest_pair(emitter, instr.reg_a_id, RAX);
+                break;
+            }
+            case INSTR_CMP64:
+            case INSTR_CMPI64:
+            {
+                _load_guest_pair(emitter, instr.reg_a_id, RAX, RDX);
+                _load_guest_pair(emitter, instr.reg_b_id, RCX, RDX);
+                emitter.alu_rr64(0x39, RAX, RCX);
+                emit_compare_flags(instr.opcode == INSTR_CMP64 ? COND_B : COND_L);
+                break;
+            }
+            case INSTR_DADD:
+            case INSTR_DSUB:
+            case INSTR_DMUL:
+            case INSTR_DDIV:
+            {
+                _load_guest_pair(emitter, instr.reg_b_id, RAX, RDX);
+                _load_guest_pair(emitter, instr.reg_c_id, RCX, RDX);
+                emitter.movq_xmm_r64(XMM_SCRATCH_A, RAX);
+                emitter.movq_xmm_r64(XMM_SCRATCH_B, RCX);
+
+                switch (instr.opcode)
+                {
+                    case INSTR_DADD: emitter.sd_op(0x58, XMM_SCRATCH_A, XMM_SCRATCH_B); break;
+                    case INSTR_DSUB: emitter.sd_op(0x5C, XMM_SCRATCH_A, XMM_SCRATCH_B); break;
+                    case INSTR_DMUL: emitter.sd_op(0x59, XMM_SCRATCH_A, XMM_SCRATCH_B); break;
+                    case INSTR_DDIV: emitter.sd_op(0x5E, XMM_SCRATCH_A, XMM_SCRATCH_B); break;
+                }
+
+                emitter.movq_r64_xmm(RAX, XMM_SCRATCH_A);
+                _write_guest_pair(emitter, instr.reg_a_id, RAX);
+                break;
+            }
+            case INSTR_DCMP:
+            {
+                _load_guest_pair(emitter, instr.reg_a_id, RAX, RDX);
+                _load_guest_pair(emitter, instr.reg_b_id, RCX, RDX);
+                emitter.movq_xmm_r64(XMM_SCRATCH_A, RAX);
+                emitter.movq_xmm_r64(XMM_SCRATCH_B, RCX);
+                emitter.ucomisd(XMM_SCRATCH_A, XMM_SCRATCH_B);
+                emit_float_compare_flags();
+                break;
+            }
+            case INSTR_FTOD:
+            {
+                // cvtss2sd
+                emitter.sse_op(0x5A, XMM_SCRATCH_A, _guest_value_xmm(emitter, instr.reg_b_id, XMM_SCRATCH_A));
+                emitter.movq_r64_xmm(RAX, XMM_SCRATCH_A);
+                _write_guest_pair(emitter, instr.reg_a_id, RAX);
+                break;
+            }
+            case INSTR_DTOF:
+            {
+                _load_guest_pair(emitter, instr.reg_b_id, RAX, RDX);
+                emitter.movq_xmm_r64(XMM_SCRATCH_A, RAX);
+                emitter.sd_op(0x5A, XMM_SCRATCH_A, XMM_SCRATCH_A);
+                _write_guest_xmm(emitter, instr.reg_a_id, XMM_SCRATCH_A);
+                break;
+            }
+            case INSTR_PUSH:
+            {
+                uint8_t value = _guest_value_gpr(emitter, instr.reg_a_id, RAX);
+                emitter.store_guest32(value, HOST_STACK_PTR, 0);
+                emitter.alu_ri8(0, HOST_STACK_PTR, 4);
+                break;
+            }
+            case INSTR_POP:
+            {
+                emitter.alu_ri8(5, HOST_STACK_PTR, 4);
+                uint8_t dst = _guest_dst_gpr(instr.reg_a_id, RAX);
+                emitter.load_guest32(dst, HOST_STACK_PTR, 0);
+                _write_guest_gpr(emitter, instr.reg_a_id, dst);
+                break;
+            }
+            case INSTR_CALL:
+            {
+                emitter.store_guest_imm32(HOST_STACK_PTR, 0, instructions[ip + 1].addr);
+                emitter.store_guest32(HOST_BASE_PTR, HOST_STACK_PTR, 4);
+                emitter.alu_ri8(0, HOST_STACK_PTR, 8);
+                emitter.mov_rr32(HOST_BASE_PTR, HOST_STACK_PTR);
+                emitter.alu_ri8(5, HOST_BASE_PTR, 8);
+
+                emit_poll_tick(instr.target);
+                emit_chain(instr.target);
+                block_ended = true;
+                break;
+            }
+            case INSTR_RET:
+            {
+                emitter.mov_rr32(HOST_STACK_PTR, HOST_BASE_PTR);
+                emitter.load_guest32(RAX, HOST_STACK_PTR, 0);
+                emitter.load_guest32(HOST_BASE_PTR, HOST_STACK_PTR, 4);
+
+                // Return address -> decoded index, clamped like DecodedProgram::index_from_addr
+                emitter.cmp_r32_state(RAX, STATE_OFFSET(addr_last));
+                uint8_t* in_range = emitter.jcc_rel8(COND_B);
+                emitter.load_state32(RAX, STATE_OFFSET(addr_last));
+                CodeEmitter::patch_rel8(in_range, emitter.position());
+                emitter.load_state64(RCX, STATE_OFFSET(addr_to_index));
+                emitter.load_index32(RAX, RCX, RAX);
+
+                // Poll check with the target in eax
+                emitter.sub_state32_imm8(STATE_OFFSET(poll_countdown), 1);
+                uint8_t* poll_exit = emitter.jcc_rel32(COND_E);
+
+                // Jump straight to the compiled block if there is one
+                emitter.load_index64(RCX, HOST_BLOCK_TABLE, RAX);
+                emitter.test_rr64(RCX, RCX);
+                uint8_t* not_compiled = emitter.jcc_rel32(COND_E);
+                emitter.jmp_reg(RCX);
+
+                CodeEmitter::patch_rel32(poll_exit, common_exit);
+                CodeEmitter::patch_rel32(not_compiled, common_exit);
+                block_ended = true;
+                break;
+            }
+            case INSTR_TAILCALL:
+            {
+                emitter.lea_r32(HOST_STACK_PTR, HOST_BASE_PTR, 8);
+                emit_poll_tick(instr.target);
+                emit_chain(instr.target);
+                block_ended = true;
+                break;
+            }
+            case INSTR_ENTER:
+            {
+                emitter.alu_ri32(0, HOST_STACK_PTR, instr.imm);
+                break;
+            }
+            case INSTR_LEAVE:
+            {
+                emitter.lea_r32(HOST_STACK_PTR, HOST_BASE_PTR, 8);
+                break;
+            }
+            case INSTR_JMP:
+            {
+                emit_poll_tick(instr.target);
+                emit_chain(instr.target);
+                block_ended = true;
+                break;
+            }
+            case INSTR_JMPZ:
+            case INSTR_JMPS:
+            case INSTR_JMPC:
+            {
+                int32_t flag_offset = STATE_OFFSET(flag_zero);
+                if (instr.opcode == INSTR_JMPS) flag_offset = STATE_OFFSET(flag_sign);
+                if (instr.opcode == INSTR_JMPC) flag_offset = STATE_OFFSET(flag_carry);
+
+                emitter.cmp_state8_imm(flag_offset, 0);
+                uint8_t* not_taken = emitter.jcc_rel32(COND_E);
+
+                emit_poll_tick(instr.target);
+                emit_chain(instr.target);
+
+                CodeEmitter::patch_rel32(not_taken, emitter.position());
+                emit_chain(ip + 1);
+                block_ended = true;
+                break;
+            }
+            case INSTR_BEQ:
+            case INSTR_BNE:
+            case INSTR_BLT:
+            case INSTR_BGE:
+            case INSTR_BLTI:
+            case INSTR_BGEI:
+            case INSTR_BEQF:
+            case INSTR_BNEF:
+            case INSTR_BLTF:
+            case INSTR_BGEF:
+            {
+                // Compared straight into host flags, guest flags are never written
+                uint8_t not_taken_cond = 0;
+                switch (instr.opcode)
+                {
+                    case INSTR_BEQ: not_taken_cond = COND_NE; break;
+                    case INSTR_BNE: not_taken_cond = COND_E; break;
+                    case INSTR_BLT: not_taken_cond = COND_AE; break;
+                    case INSTR_BGE: not_taken_cond = COND_B; break;
+                    case INSTR_BLTI: not_taken_cond = COND_GE; break;
+                    case INSTR_BGEI: not_taken_cond = COND_L; break;
+                    // ucomiss b, a: above only if ordered and a < b
+                    case INSTR_BLTF: not_taken_cond = COND_BE; break;
+                    // ucomiss a, b: carry set if less or unordered
+                    case INSTR_BGEF: not_taken_cond = COND_B; break;
+                    // Equal and ordered in al, tested below
+                    case INSTR_BEQF: not_taken_cond = COND_E; break;
+                    case INSTR_BNEF: not_taken_cond = COND_NE; break;
+                }
+
+                if (instr.opcode == INSTR_BEQF || instr.opcode == INSTR_BNEF || instr.opcode == INSTR_BGEF || instr.opcode == INSTR_BLTF)
+                {
+                    uint8_t a = _guest_value_xmm(emitter, instr.reg_a_id, XMM_SCRATCH_A);
+                    uint8_t b = _guest_value_xmm(emitter, instr.reg_b_id, XMM_SCRATCH_B);
+
+                    if (instr.opcode == INSTR_BLTF)
+                    {
+                        emitter.ucomiss(b, a);
+                    }
+                    else
+                    {
+                        emitter.ucomiss(a, b);
+                    }
+
+                    if (instr.opcode == INSTR_BEQF || instr.opcode == INSTR_BNEF)
+                    {
+                        emitter.setcc(COND_E, RAX);
+                        emitter.setcc(COND_NP, RCX);
+                        emitter.alu_rr8(0x20, RAX, RCX);
+                        emitter.alu_rr8(0x84, RAX, RAX);
+                    }
+                }
+                else
+                {
+                    uint8_t a = _guest_value_gpr(emitter, instr.reg_a_id, RAX);
+                    uint8_t b = _guest_value_gpr(emitter, instr.reg_b_id, RCX);
+                    emitter.alu_rr32(0x39, a, b);
+                }
+
+                uint8_t* not_taken = emitter.jcc_rel32(not_taken_cond);
+
+                emit_poll_tick(instr.target);
+                emit_chain(instr.target);
+
+                CodeEmitter::patch_rel32(not_taken, emitter.position());
+                emit_chain(ip + 1);
+                block_ended = true;
+                break;
+            }
+            case INSTR_VLOAD:
+            case INSTR_VLOADA:
+            case INSTR_VSTORE:
+            case INSTR_VSTOREA:
+            {
+                uint8_t addr = _guest_value_gpr(emitter, instr.reg_b_id, RCX);
+
+                if (instr.opcode == INSTR_VLOADA || instr.opcode == INSTR_VSTOREA)
+                {
+                    emitter.test_ri32(addr, 15);
+                    uint8_t* aligned = emitter.jcc_rel8(COND_E);
+                    emitter.mov_ri32(RAX, ip | JIT_EXIT_STEP);
+                    emitter.jmp_rel32(common_exit);
+                    CodeEmitter::patch_rel8(aligned, emitter.position());
+                }
+
+                emitter.load_state64(RDX, STATE_OFFSET(vectors));
+                if (instr.opcode == INSTR_VLOAD || instr.opcode == INSTR_VLOADA)
+                {
+                    emitter.movups_load_guest(XMM_SCRATCH_A, addr);
+                    emitter.movups_store(XMM_SCRATCH_A, RDX, VECTOR_OFFSET(instr.reg_a_id));
+                }
+                else
+                {
+                    emitter.movups_load(XMM_SCRATCH_A, RDX, VECTOR_OFFSET(instr.reg_a_id));
+                    emitter.movups_store_guest(XMM_SCRATCH_A, addr);
+                }
+                break;
+            }
+            case INSTR_VCOPY:
+            {
+                emitter.load_state64(RDX, STATE_OFFSET(vectors));
+                emitter.movups_load(XMM_SCRATCH_A, RDX, VECTOR_OFFSET(instr.reg_a_id));
+                emitter.movups_store(XMM_SCRATCH_A, RDX, VECTOR_OFFSET(instr.reg_b_id));
+                break;
+            }
+            case INSTR_VSPLAT:
+            {
+                emitter.movd_xmm_r32(XMM_SCRATCH_A, _guest_value_gpr(emitter, instr.reg_b_id, RAX));
+                emitter.pshufd(XMM_SCRATCH_A, XMM_SCRATCH_A, 0);
+                emitter.load_state64(RDX, STATE_OFFSET(vectors));
+                emitter.movups_store(XMM_SCRATCH_A, RDX, VECTOR_OFFSET(instr.reg_a_id));
+                break;
+            }
+            case INSTR_VEXTRACT:
+            {
+                uint8_t dst = _guest_dst_gpr(instr.reg_a_id, RAX);
+                emitter.load_state64(RDX, STATE_OFFSET(vectors));
+                emitter.load_base32(dst, RDX, VECTOR_OFFSET(instr.reg_b_id) + instr.imm * 4);
+                _write_guest_gpr(emitter, instr.reg_a_id, dst);
+                break;
+            }
+            case INSTR_VINSERT:
+            {
+                uint8_t value = _guest_value_gpr(emitter, instr.reg_b_id, RAX);
+                emitter.load_state64(RDX, STATE_OFFSET(vectors));
+                emitter.store_base32(value, RDX, VECTOR_OFFSET(instr.reg_a_id) + instr.imm * 4);
+                break;
+            }
+            case INSTR_VSHUF:
+            {
+                emitter.load_state64(RDX, STATE_OFFSET(vectors));
+                emitter.movups_load(XMM_SCRATCH_B, RDX, VECTOR_OFFSET(instr.reg_b_id));
+                emitter.pshufd(XMM_SCRATCH_A, XMM_SCRATCH_B, instr.imm);
+                emitter.movups_store(XMM_SCRATCH_A, RDX, VECTOR_OFFSET(instr.reg_a_id));
+                break;
+            }
+            case INSTR_VADD:
+            case INSTR_VSUB:
+            case INSTR_VMUL:
+            case INSTR_VMIN:
+            case INSTR_VMAX:
+            case INSTR_VCMPEQ:
+            case INSTR_VCMPGT:
+            case INSTR_VAND:
+            case INSTR_VOR:
+            case INSTR_VXOR:
+            case INSTR_VFADD:
+            case INSTR_VFSUB:
+            case INSTR_VFMUL:
+            case INSTR_VFMIN:
+            case INSTR_VFMAX:
+            case INSTR_VFCMPEQ:
+            case INSTR_VFCMPLT:
+            {
+                emitter.load_state64(RDX, STATE_OFFSET(vectors));
+                emitter.movups_load(XMM_SCRATCH_A, RDX, VECTOR_OFFSET(instr.reg_a_id));
+                emitter.movups_load(XMM_SCRATCH_B, RDX, VECTOR_OFFSET(instr.reg_b_id));
+
+                switch (instr.opcode)
+                {
+                    case INSTR_VADD: emitter.sse_packed(0x66, 0xFE, XMM_SCRATCH_A, XMM_SCRATCH_B); break;
+                    case INSTR_VSUB: emitter.sse_packed(0x66, 0xFA, XMM_SCRATCH_A, XMM_SCRATCH_B); break;
+                    case INSTR_VMUL: emitter.sse_packed(0x66, 0x3840, XMM_SCRATCH_A, XMM_SCRATCH_B); break;
+                    case INSTR_VMIN: emitter.sse_packed(0x66, 0x3839, XMM_SCRATCH_A, XMM_SCRATCH_B); break;
+                    case INSTR_VMAX: emitter.sse_packed(0x66, 0x383D, XMM_SCRATCH_A, XMM_SCRATCH_B); break;
+                    case INSTR_VCMPEQ: emitter.sse_packed(0x66, 0x76, XMM_SCRATCH_A, XMM_SCRATCH_B); break;
+                    case INSTR_VCMPGT: emitter.sse_packed(0x66, 0x66, XMM_SCRATCH_A, XMM_SCRATCH_B); break;
+                    case INSTR_VAND: emitter.sse_packed(0x66, 0xDB, XMM_SCRATCH_A, XMM_SCRATCH_B); break;
+                    case INSTR_VOR: emitter.sse_packed(0x66, 0xEB, XMM_SCRATCH_A, XMM_SCRATCH_B); break;
+                    case INSTR_VXOR: emitter.sse_packed(0x66, 0xEF, XMM_SCRATCH_A, XMM_SCRATCH_B); break;
+                    case INSTR_VFADD: emitter.sse_packed(0, 0x58, XMM_SCRATCH_A, XMM_SCRATCH_B); break;
+                    case INSTR_VFSUB: emitter.sse_packed(0, 0x5C, XMM_SCRATCH_A, XMM_SCRATCH_B); break;
+                    case INSTR_VFMUL: emitter.sse_packed(0, 0x59, XMM_SCRATCH_A, XMM_SCRATCH_B); break;
+                    case INSTR_VFMIN: emitter.sse_packed(0, 0x5D, XMM_SCRATCH_A, XMM_SCRATCH_B); break;
+                    case INSTR_VFMAX: emitter.sse_packed(0, 0x5F, XMM_SCRATCH_A, XMM_SCRATCH_B); break;
+                    case INSTR_VFCMPEQ: emitter.cmpps(XMM_SCRATCH_A, XMM_SCRATCH_B, 0); break;
+                    case INSTR_VFCMPLT: emitter.cmpps(XMM_SCRATCH_A, XMM_SCRATCH_B, 1); break;
+                }
+
+                emitter.movups_store(XMM_SCRATCH_A, RDX, VECTOR_OFFSET(instr.reg_a_id));
+                break;
+            }
+            case INSTR_STOP:
+            {
+                emitter.mov_ri32(RAX, ip);
+                emitter.jmp_rel32(common_exit);
+                block_ended = true;
+                break;
+            }
+        }
+
+        ip++;
+    }
+
+    code_buffer_top += emitter.size();
+    block_table[start_ip] = block_code;
+
+    // Patch exits of earlier blocks (and this one) that were waiting for this block, the earlier ones are in
+    // executable pages and are made writable just for the patch
+    bool protected_ok = true;
+    if (auto iter = pending_chains.find(start_ip); iter != pending_chains.end())
+    {
+        const uintptr_t page = GuestMemory::page_size();
+        const uint8_t* const writable = code_buffer + (code_buffer_top - emitter.size()) / page * page;
+
+        for (uint8_t* site : iter->second)
+        {
+            const bool executable = site < writable;
+            if (executable && !protect_code(site, site + JIT_CHAIN_JUMP_BYTES, PROT_READ | PROT_WRITE))
+            {
+                protected_ok = false;
+                break;
+            }
+
+            CodeEmitter site_emitter(site);
+            site_emitter.jmp_rel32(block_code);
+
+            if (executable && !protect_code(site, site + JIT_CHAIN_JUMP_BYTES, PROT_READ | PROT_EXEC))
+            {
+                protected_ok = false;
+                break;
+            }
+        }
+
+        pending_chains.erase(iter);
+    }
+
+    if (!protected_ok || !protect_code(write_start, code_buffer + code_buffer_top, PROT_READ | PROT_EXEC))
+    {
+        disable_code_buffer();
+        return nullptr;
+    }
+
+    return block_code;
+}
+
+#else
+
+void Jit::emit_trampolines()
+{
+}
+
+void* Jit::compile_block(uint32_t ip)
+{
+    return nullptr;
+}
+
+#endif
+
+#undef JIT_PINNED_XMM_COUNT
+#undef JIT_PINNED_GPR_COUNT
+#undef JIT_EXIT_STEP
+#undef JIT_CHAIN_JUMP_BYTES
+#undef JIT_MAX_INSTRUCTION_BYTES
+#undef JIT_MAX_BLOCK_INSTRUCTIONS
+#undef JIT_CODE_BUFFER_SIZE
+#undef JIT_SUPPORTED
\ No newline at end of file
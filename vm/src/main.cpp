@@ -1,19 +1,267 @@
-#include <SDL.h>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
 
 #include "VirtualMachine.hpp"
+#include "batch.hpp"
+
+// Still needed for SDL_main on platforms that redirect main, SDL itself is only initialised by window syscalls
+#if !VM_HEADLESS
+#include <SDL.h>
+#endif
+
+static void print_usage()
+{
+    std::cout << "Usage: virtualmachine [options] program.vmex\n"
+        " --poll branches:N     poll window events every N taken branches (default 1024)\n"
+        " --poll time:US        poll window events at most every US microseconds\n"
+        " --poll syscall        only poll window events on window syscalls\n"
+        " --poll-always         keep polling while no windows are open\n"
+        " --jit                 compile hot basic blocks to native code (x86-64 Linux)\n"
+        " --jit-threshold N     times a block runs before it is compiled (default 1)\n"
+        " --memory SIZE         guest memory size, accepts K/M/G suffix (default 20M)\n"
+        " --stack SIZE          stack region after program data (default 2M)\n"
+        " --heap-stats          print malloc/free statistics when the program stops\n"
+        " --no-fuse             do not combine common instruction pairs into super-instructions\n"
+        " --batch FILE          run once per line of FILE (- for stdin) on a pool of threads\n"
+        " --batch-count N       run N times without input on a pool of threads\n"
+        " --threads N           batch worker threads (default one per core)\n";
+}
+
+static bool parse_poll_policy(const std::string& arg, EventPollPolicy& policy)
+{
+    size_t split = arg.find(':');
+    std::string mode = arg.substr(0, split);
+
+    if (mode == "syscall")
+    {
+        policy.mode = EventPollMode::WindowSyscall;
+        return split == std::string::npos;
+    }
+
+    if (split == std::string::npos) return false;
+
+    if (mode == "branches")
+    {
+        policy.mode = EventPollMode::Branches;
+    }
+    else if (mode == "time")
+    {
+        policy.mode = EventPollMode::Microseconds;
+    }
+    else
+    {
+        return false;
+    }
+
+    policy.interval = std::strtoul(arg.c_str() + split + 1, nullptr, 10);
+    return policy.interval > 0;
+}
+
+// Parses a byte count with optional K/M/G suffix, must fit in the 32 bit guest address space
+static bool parse_size(const char* arg, uint32_t& size_out)
+{
+    char* end = nullptr;
+    uint64_t size = std::strtoull(arg, &end, 10);
+
+    switch (*end)
+    {
+        case 'K': case 'k': size <<= 10; end++; break;
+        case 'M': case 'm': size <<= 20; end++; break;
+        case 'G': case 'g': size <<= 30; end++; break;
+    }
+
+    if (end == arg || *end != '\0' || size > UINT32_MAX) return false;
+
+    size_out = size;
+    return true;
+}
+
+// One input per line, a trailing carriage return is dropped
+static bool read_batch_inputs(const char* path, std::vector<std::string>& inputs)
+{
+    std::ifstream file;
+    if (std::strcmp(path, "-") != 0)
+    {
+        file.open(path);
+        if (!file.is_open())
+        {
+            std::cout << "ERROR: Could not open batch input " << path << "\n";
+            return false;
+        }
+    }
+
+    std::istream& stream = file.is_open() ? file : std::cin;
+
+    std::string line;
+    while (std::getline(stream, line))
+    {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        inputs.push_back(line);
+    }
+
+    return true;
+}
 
 int main(int argc, char** argv)
 {
-    if (argc < 2) return 1;
+    EventPollPolicy poll_policy;
+    bool jit = false;
+    uint32_t jit_threshold = 1;
+    bool fuse = true;
+    bool heap_stats = false;
+    MemoryConfig memory_config;
+    const char* program_path = nullptr;
+
+    bool batch = false;
+    const char* batch_path = nullptr;
+    uint32_t batch_count = 0;
+    uint32_t batch_threads = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "--poll") == 0 && i + 1 < argc)
+        {
+            if (!parse_poll_policy(argv[++i], poll_policy))
+            {
+                print_usage();
+                return 1;
+            }
+        }
+        else if (std::strcmp(argv[i], "--poll-always") == 0)
+        {
+            poll_policy.only_with_windows = false;
+        }
+        else if (std::strcmp(argv[i], "--jit") == 0)
+        {
+            jit = true;
+        }
+        else if (std::strcmp(argv[i], "--jit-threshold") == 0 && i + 1 < argc)
+        {
+            jit = true;
+            jit_threshold = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (std::strcmp(argv[i], "--memory") == 0 && i + 1 < argc)
+        {
+            if (!parse_size(argv[++i], memory_config.size))
+            {
+                print_usage();
+                return 1;
+            }
+        }
+        else if (std::strcmp(argv[i], "--stack") == 0 && i + 1 < argc)
+        {
+            if (!parse_size(argv[++i], memory_config.stack_size))
+            {
+                print_usage();
+                return 1;
+            }
+        }
+        else if (std::strcmp(argv[i], "--heap-stats") == 0)
+        {
+            heap_stats = true;
+        }
+        else if (std::strcmp(argv[i], "--no-fuse") == 0)
+        {
+            fuse = false;
+        }
+        else if (std::strcmp(argv[i], "--batch") == 0 && i + 1 < argc)
+        {
+            batch = true;
+            batch_path = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--batch-count") == 0 && i + 1 < argc)
+        {
+            batch = true;
+            batch_count = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            batch_threads = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (argv[i][0] == '-')
+        {
+            print_usage();
+            return 1;
+        }
+        else
+        {
+            program_path = argv[i];
+        }
+    }
+
+    if (!program_path)
+    {
+        print_usage();
+        return 1;
+    }
+
+    // Same settings for the single machine and every batch worker
+    auto setup_machine = [&](VirtualMachine& virtual_machine)
+    {
+        virtual_machine.set_event_poll_policy(poll_policy);
+
+        if (!virtual_machine.set_memory_config(memory_config))
+        {
+            return false;
+        }
+
+        virtual_machine.set_fusion_enabled(fuse);
+        virtual_machine.set_heap_stats_enabled(heap_stats);
+
+        if (jit)
+        {
+            virtual_machine.enable_jit(jit_threshold);
+        }
+
+        return true;
+    };
+
+    if (batch)
+    {
+        std::vector<std::string> inputs;
+        if (batch_path && !read_batch_inputs(batch_path, inputs))
+        {
+            return 1;
+        }
+
+        if (!batch_path)
+        {
+            inputs.resize(batch_count);
+        }
+
+        std::shared_ptr<const ProgramImage> image = load_program_image(program_path, fuse);
+        if (!image)
+        {
+            return 1;
+        }
+
+        BatchRunner runner(image, setup_machine);
+        BatchStats stats = runner.run(inputs, batch_threads);
+        BatchRunner::print_stats(stats);
 
-    if (SDL_Init(SDL_INIT_VIDEO)) return 1;
+        return stats.failed_count > 0 ? 1 : 0;
+    }
 
     VirtualMachine virtual_machine;
-    virtual_machine.load_program(argv[1]);
+    if (!setup_machine(virtual_machine))
+    {
+        return 1;
+    }
 
-    virtual_machine.run();
+    if (!virtual_machine.load_program(program_path))
+    {
+        return 1;
+    }
 
-    SDL_Quit();
+    // A guest fault or a program that does not fit in memory fails the process, like a failed batch job
+    if (!virtual_machine.run())
+    {
+        return 1;
+    }
 
     return 0;
 }
\ No newline at end of file
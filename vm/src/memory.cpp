@@ -0,0 +1,109 @@
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+
+#include "memory.hpp"
+
+#if GUEST_MEMORY_GUARDED
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+GuestMemory::~GuestMemory()
+{
+    release();
+}
+
+uint32_t GuestMemory::page_size()
+{
+    #if GUEST_MEMORY_GUARDED
+    static const uint32_t size = sysconf(_SC_PAGESIZE);
+    return size;
+    #else
+    return 4096;
+    #endif
+}
+
+bool GuestMemory::allocate(size_t size)
+{
+    release();
+
+    #if GUEST_MEMORY_GUARDED
+    size_t reserve_size = (1ull << 32) + page_size();
+
+    // Address space only, nothing is committed until a page is first written
+    void* ptr = mmap(nullptr, reserve_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (ptr == MAP_FAILED)
+    {
+        std::cout << "ERROR: Could not reserve guest address space\n";
+        return false;
+    }
+
+    if (size > 0 && mprotect(ptr, size, PROT_READ | PROT_WRITE) != 0)
+    {
+        std::cout << "ERROR: Could not commit " << size << " bytes of guest memory\n";
+        munmap(ptr, reserve_size);
+        return false;
+    }
+    #else
+    size_t reserve_size = size;
+
+    void* ptr = std::calloc(size, 1);
+    if (!ptr)
+    {
+        std::cout << "ERROR: Could not allocate " << size << " bytes of guest memory\n";
+        return false;
+    }
+    #endif
+
+    base = static_cast<uint8_t*>(ptr);
+    mapped_size = size;
+    reserved_size = reserve_size;
+
+    return true;
+}
+
+void GuestMemory::release()
+{
+    if (!base) return;
+
+    #if GUEST_MEMORY_GUARDED
+    munmap(base, reserved_size);
+    #else
+    std::free(base);
+    #endif
+
+    base = nullptr;
+    mapped_size = 0;
+    reserved_size = 0;
+}
+
+void GuestMemory::reset()
+{
+    if (!base) return;
+
+    #if GUEST_MEMORY_GUARDED
+    mprotect(base, mapped_size, PROT_READ | PROT_WRITE);
+
+    #if defined(__linux__)
+    // Private anonymous pages read back as zero after being dropped
+    if (madvise(base, mapped_size, MADV_DONTNEED) == 0) return;
+    #endif
+    #endif
+
+    memset(base, 0, mapped_size);
+}
+
+void GuestMemory::protect(uint32_t addr, uint32_t size)
+{
+    #if GUEST_MEMORY_GUARDED
+    if (size > 0) mprotect(base + addr, size, PROT_NONE);
+    #endif
+}
+
+void GuestMemory::unprotect(uint32_t addr, uint32_t size)
+{
+    #if GUEST_MEMORY_GUARDED
+    if (size > 0) mprotect(base + addr, size, PROT_READ | PROT_WRITE);
+    #endif
+}
\ No newline at end of file
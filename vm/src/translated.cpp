@@ -0,0 +1,110 @@
+#include <iostream>
+
+#include "translated.hpp"
+#include "trap.hpp"
+
+bool TranslatedRuntime::run(VirtualMachine& vm, const TranslatedProgram& program)
+{
+    vm.main_thread = ThreadContext();
+    vm.program_isa_version = program.isa_version;
+
+    if (!vm.reset_memory(program.data, program.data_size, program.static_size))
+    {
+        return false;
+    }
+
+    std::cout << "Data size: " << program.data_size << "   IP: " << program.entry_addr << "\n";
+
+    vm.last_poll_time = std::chrono::steady_clock::now();
+
+    vm.thread_runner = [&vm, &program](ThreadContext& thread, uint32_t entry_addr)
+    {
+        return run_thread(vm, program, thread, entry_addr);
+    };
+
+    bool completed = run_thread(vm, program, vm.main_thread, program.entry_addr);
+    vm.join_all_threads();
+
+    return completed;
+}
+
+bool TranslatedRuntime::run_thread(VirtualMachine& vm, const TranslatedProgram& program, ThreadContext& thread, uint32_t entry_addr)
+{
+    TranslatedContext context = {};
+    context.entry_addr = entry_addr;
+    context.memory = vm.memory.data();
+    context.vm = &vm;
+    context.thread = &thread;
+    sync_from_thread(context);
+
+    GuestTrap trap;
+    trap.memory = &vm.memory;
+
+    bool completed = run_trapped(trap, [&]() { program.entry(context); });
+    if (!completed)
+    {
+        std::cout << "ERROR: Guest memory fault at addr " << trap.fault_addr << " (thread " << thread.thread_id << ")\n";
+    }
+
+    sync_to_thread(context);
+    return completed;
+}
+
+void TranslatedRuntime::syscall(TranslatedContext& context, uint8_t id)
+{
+    ThreadContext& thread = *context.thread;
+
+    sync_to_thread(context);
+
+    context.vm->dispatch_syscall(thread, id);
+    if (--thread.poll_countdown == 0) context.vm->poll_events_tick(thread);
+
+    sync_from_thread(context);
+}
+
+void TranslatedRuntime::poll_events_tick(TranslatedContext& context)
+{
+    // Window events never touch guest registers, only the countdown needs to be passed through
+    context.thread->poll_countdown = context.poll_countdown;
+    context.vm->poll_events_tick(*context.thread);
+    context.poll_countdown = context.thread->poll_countdown;
+}
+
+void TranslatedRuntime::misaligned_access(const char* kind, uint32_t addr, uint32_t instr_addr)
+{
+    std::cout << "ERROR: Misaligned " << kind << " access at addr " << addr << " (IP: " << instr_addr << ")\n";
+}
+
+void TranslatedRuntime::sync_to_thread(const TranslatedContext& context)
+{
+    ThreadContext& thread = *context.thread;
+
+    for (int i = 0; i < REGISTER_COUNT; i++)
+    {
+        thread.registers[i] = context.registers[i];
+    }
+
+    thread.reg_stack_ptr = context.stack_ptr;
+    thread.reg_base_ptr = context.base_ptr;
+    thread.poll_countdown = context.poll_countdown;
+    thread.flag_zero = context.flag_zero;
+    thread.flag_sign = context.flag_sign;
+    thread.flag_carry = context.flag_carry;
+}
+
+void TranslatedRuntime::sync_from_thread(TranslatedContext& context)
+{
+    const ThreadContext& thread = *context.thread;
+
+    for (int i = 0; i < REGISTER_COUNT; i++)
+    {
+        context.registers[i] = thread.registers[i];
+    }
+
+    context.stack_ptr = thread.reg_stack_ptr;
+    context.base_ptr = thread.reg_base_ptr;
+    context.poll_countdown = thread.poll_countdown;
+    context.flag_zero = thread.flag_zero;
+    context.flag_sign = thread.flag_sign;
+    context.flag_carry = thread.flag_carry;
+}
\ No newline at end of file
@@ -0,0 +1,67 @@
+#include <mutex>
+
+#include "trap.hpp"
+
+#if GUEST_MEMORY_GUARDED
+#include <signal.h>
+#include <ucontext.h>
+
+static thread_local GuestTrap* active_trap = nullptr;
+
+static struct sigaction previous_segv_action;
+static struct sigaction previous_bus_action;
+
+static void _fault_handler(int signal, siginfo_t* info, void* context)
+{
+    GuestTrap* trap = active_trap;
+
+    if (trap && trap->memory && trap->memory->contains(info->si_addr))
+    {
+        trap->fault_addr = static_cast<uint32_t>(static_cast<const uint8_t*>(info->si_addr) - trap->memory->data());
+
+        #if defined(__x86_64__) && defined(__linux__)
+        trap->fault_pc = static_cast<ucontext_t*>(context)->uc_mcontext.gregs[REG_RIP];
+        #endif
+
+        active_trap = nullptr;
+        siglongjmp(trap->env, 1);
+    }
+
+    // Not a guest access, let the fault happen again under whatever handled it before
+    sigaction(signal, signal == SIGSEGV ? &previous_segv_action : &previous_bus_action, nullptr);
+}
+
+static void _install_handler()
+{
+    static std::once_flag installed;
+    std::call_once(installed, []()
+    {
+        struct sigaction action = {};
+        action.sa_sigaction = _fault_handler;
+        action.sa_flags = SA_SIGINFO | SA_NODEFER;
+        sigemptyset(&action.sa_mask);
+
+        sigaction(SIGSEGV, &action, &previous_segv_action);
+        sigaction(SIGBUS, &action, &previous_bus_action);
+    });
+}
+
+void trap_enter(GuestTrap& trap)
+{
+    _install_handler();
+    active_trap = &trap;
+}
+
+void trap_leave()
+{
+    active_trap = nullptr;
+}
+#else
+void trap_enter(GuestTrap& trap)
+{
+}
+
+void trap_leave()
+{
+}
+#endif
\ No newline at end of file